@@ -1,7 +1,9 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#ifndef RAYGL_HEADLESS
 #include "Shader.h"
+#endif
 
 class Camera
 {
@@ -25,6 +27,14 @@ public:
 		vertical = 2.0f * half_height* v;
 	}
 
+	// The uniforms Bind() uploads, for the CPU port of Compute.comp
+	glm::vec3 Origin() const { return origin; }
+	glm::vec3 LowerLeft() const { return lower_left_corner; }
+	glm::vec3 Horizontal() const { return horizontal; }
+	glm::vec3 Vertical() const { return vertical; }
+	float LensRadius() const { return lens_radius; }
+
+#ifndef RAYGL_HEADLESS
 	void Bind(Shader<ShaderType::COMPUTE>& shaderCompute)
 	{
 		shaderCompute.use();
@@ -34,6 +44,7 @@ public:
 		shaderCompute.setVector("cam.vert", vertical);
 		shaderCompute.setFloat("cam.lens_radius", lens_radius);
 	}
+#endif
 private:
 	glm::vec3 origin;//ԭ
 	glm::vec3 lower_left_corner;//½
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// Progressive scheduling of compute dispatches, independent of OpenGL and GLFW so the same logic drives
+// glDispatchCompute in main.cpp and ComputeCPU::Dispatch in main_cpu.cpp.
+//
+// The image is split into tile x tile cells. Each pass adds one sample to every active tile; a dispatch is
+// a rectangle of active tiles that all have the same iteration count, which is what Compute.comp's
+// `iteration` uniform assumes. Its size follows a time budget: the measured cost per pixel decides how many
+// tiles fit into target_seconds, so a dispatch neither stalls the display (or trips the driver watchdog)
+// nor wastes time on tiny launches. Tiles stop when they reach max_iterations or, if the caller reports
+// tile means, when their accumulated mean has stopped changing.
+
+struct ChunkDispatch {
+	int x = 0, y = 0;			// pixel offset (the shader's `chunk` uniform), y = 0 is the bottom row
+	int width = 0, height = 0;	// glDispatchCompute(width, height, 1)
+	int iteration = 0;			// samples already accumulated in every pixel of the rectangle
+	int pass = 0;
+};
+
+enum class ChunkOrder {
+	SCANLINE,	// bottom row of tiles first, left to right
+	CENTER_OUT	// tile rows from the middle of the image outwards, so the centre refines first
+};
+
+class ChunkScheduler {
+public:
+	ChunkScheduler(int width, int height, int tile = 64, double target_seconds = 1.0 / 60.0, int max_iterations = 0,
+		ChunkOrder order = ChunkOrder::SCANLINE)
+		: width(width), height(height), tile(tile), target_seconds(target_seconds), max_iterations(max_iterations)
+	{
+		tiles_x = (width + tile - 1) / tile;
+		tiles_y = (height + tile - 1) / tile;
+		iterations.assign(size_t(tiles_x) * tiles_y, 0);
+		converged.assign(iterations.size(), false);
+		last_mean.assign(iterations.size(), -1.0f);
+		stable.assign(iterations.size(), 0);
+		for (int r = 0; r < tiles_y; r++)
+			row_order.push_back(r);
+		if (order == ChunkOrder::CENTER_OUT) {
+			float mid = 0.5f * (tiles_y - 1);
+			std::stable_sort(row_order.begin(), row_order.end(), [mid](int a, int b) { return std::abs(a - mid) < std::abs(b - mid); });
+		}
+	}
+
+	// Stop a tile once the relative change of its mean stays below threshold for two reports in a row,
+	// but not before min_iterations samples
+	void SetConvergence(float threshold, int min_iterations)
+	{
+		convergence_threshold = threshold;
+		convergence_min_iterations = min_iterations;
+	}
+
+	// The next rectangle to render; false once every tile is finished
+	bool Next(ChunkDispatch& d)
+	{
+		for (int guard = 0; guard < 2; guard++) {
+			while (cursor_row < tiles_y) {
+				int row = row_order[cursor_row];
+				while (cursor_x < tiles_x && !Active(Tile(cursor_x, row)))
+					cursor_x++;
+				if (cursor_x < tiles_x) {
+					MakeDispatch(row, d);
+					return true;
+				}
+				cursor_row++;
+				cursor_x = 0;
+			}
+			// End of a pass: start the next one if anything is left to do
+			if (ActiveTiles() == 0)
+				return false;
+			pass++;
+			cursor_row = 0;
+			cursor_x = 0;
+		}
+		return false;
+	}
+
+	// The dispatch finished in `seconds`; updates the iteration counts and the cost estimate
+	void Complete(const ChunkDispatch& d, double seconds)
+	{
+		for (int ty = d.y / tile; ty * tile < d.y + d.height; ty++)
+			for (int tx = d.x / tile; tx * tile < d.x + d.width; tx++)
+				iterations[Tile(tx, ty)]++;
+		double cost = seconds / (double(d.width) * d.height);
+		seconds_per_pixel = seconds_per_pixel > 0.0 ? 0.7 * seconds_per_pixel + 0.3 * cost : cost;
+		dispatches++;
+	}
+
+	// Mean (e.g. luminance) of the accumulated tile after its latest dispatch, for convergence tracking
+	void ReportTileMean(int tx, int ty, float mean)
+	{
+		int t = Tile(tx, ty);
+		if (last_mean[t] >= 0.0f) {
+			float change = std::abs(mean - last_mean[t]) / std::max(mean, 1e-3f);
+			stable[t] = change < convergence_threshold ? stable[t] + 1 : 0;
+			if (stable[t] >= 2 && iterations[t] >= convergence_min_iterations)
+				converged[t] = true;
+		}
+		last_mean[t] = mean;
+	}
+
+	int TilesX() const { return tiles_x; }
+	int TilesY() const { return tiles_y; }
+	int TileSize() const { return tile; }
+	int Pass() const { return pass; }
+	int Dispatches() const { return dispatches; }
+	int TileIteration(int tx, int ty) const { return iterations[Tile(tx, ty)]; }
+	bool TileConverged(int tx, int ty) const { return converged[Tile(tx, ty)]; }
+	double SecondsPerPixel() const { return seconds_per_pixel; }
+
+	// Samples every pixel has received so far
+	int MinIteration() const { return *std::min_element(iterations.begin(), iterations.end()); }
+
+	int ActiveTiles() const
+	{
+		int n = 0;
+		for (size_t t = 0; t < iterations.size(); t++)
+			n += Active(int(t));
+		return n;
+	}
+
+private:
+	int Tile(int tx, int ty) const { return ty * tiles_x + tx; }
+
+	bool Active(int t) const
+	{
+		return !converged[t] && (max_iterations <= 0 || iterations[t] < max_iterations);
+	}
+
+	bool RowActive(int row) const
+	{
+		for (int tx = 0; tx < tiles_x; tx++)
+			if (!Active(Tile(tx, row)))
+				return false;
+		return true;
+	}
+
+	int TileHeight(int row) const { return std::min(tile, height - row * tile); }
+
+	// Pixels the budget allows for one dispatch; one tile until the first timing is known
+	double BudgetPixels() const
+	{
+		return seconds_per_pixel > 0.0 ? target_seconds / seconds_per_pixel : double(tile) * tile;
+	}
+
+	void MakeDispatch(int row, ChunkDispatch& d)
+	{
+		double budget = BudgetPixels();
+		d.pass = pass;
+		d.iteration = iterations[Tile(cursor_x, row)];
+		d.x = cursor_x * tile;
+		d.y = row * tile;
+		d.width = 0;
+		d.height = TileHeight(row);
+
+		// Whole rows of tiles at once while they fit, as long as the following rows in order are adjacent
+		if (cursor_x == 0 && RowActive(row) && double(width) * d.height <= budget) {
+			int rows = 1;
+			while (cursor_row + rows < tiles_y && row_order[cursor_row + rows] == row + rows && RowActive(row + rows)
+				&& iterations[Tile(0, row + rows)] == d.iteration
+				&& double(width) * (d.height + TileHeight(row + rows)) <= budget) {
+				d.height += TileHeight(row + rows);
+				rows++;
+			}
+			d.width = width;
+			cursor_row += rows;
+			cursor_x = 0;
+			return;
+		}
+
+		// Otherwise a run of active tiles within the row
+		int n = 0;
+		while (cursor_x + n < tiles_x && Active(Tile(cursor_x + n, row)) && iterations[Tile(cursor_x + n, row)] == d.iteration) {
+			int w = std::min(tile, width - (cursor_x + n) * tile);
+			if (n > 0 && double(d.width + w) * d.height > budget)
+				break;
+			d.width += w;
+			n++;
+		}
+		cursor_x += n;
+	}
+
+	int width, height, tile;
+	int tiles_x, tiles_y;
+	double target_seconds;
+	int max_iterations;
+	float convergence_threshold = 0.0f;
+	int convergence_min_iterations = 0;
+
+	std::vector<int> iterations;	// samples accumulated per tile
+	std::vector<bool> converged;
+	std::vector<float> last_mean;
+	std::vector<int> stable;		// consecutive reports below the threshold
+	std::vector<int> row_order;
+
+	int pass = 0;
+	int cursor_row = 0;				// index into row_order
+	int cursor_x = 0;
+	int dispatches = 0;
+	double seconds_per_pixel = 0.0;
+};
@@ -0,0 +1,593 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include "Shape.h"
+#include "ShapeBVH.h"
+#include "Camera.h"
+
+// CPU port of Compute.comp. Every function below mirrors the shader function of the same name,
+// including its quirks (the unused rng() in ScatterIso, A+M being returned when MAX_DEPTH is reached), and consumes rng() in the same order, so a change to
+// the shader math can be checked here on machines without OpenGL 4.3.
+// The buffers have the same layout as on the GPU: Shape (binding 2), BVHNode (binding 4) and one xorshift
+// state per pixel (binding 1); the output is the RGBA32F image (binding 0), row 0 at the bottom.
+// The skybox cube map is not ported: misses are black, as with skybox_active = false.
+// Results agree with the GPU up to the precision of the driver's sin/cos/log/sqrt.
+
+namespace ComputeCPU {
+
+const int MAX_DEPTH = 25;
+const float INV_UINT_MAX = (1.0f / 4294967296.0f);
+
+const uint32_t MAT_LAMBERT = 0x00000001u;
+const uint32_t MAT_METAL = 0x00000002u;
+const uint32_t MAT_DIELECRIC = 0x00000003u;
+
+const uint32_t SHP_SPHERE = 0x00000001u;
+const uint32_t SHP_CUBE = 0x00000002u;
+const uint32_t SHP_RECT = 0x00000003u;
+const uint32_t SHP_ISOTROPIC = 0xF0000000u;
+const uint32_t SHP_PRIMITIVE_MASK = 0x0000FFFFu;
+const uint32_t SHP_SECONDARY_MASK = 0xFFFF0000u;
+
+const uint32_t AXIS_X = 0x00000000u;
+const uint32_t AXIS_Y = 0x00000001u;
+const uint32_t AXIS_Z = 0x00000002u;
+
+const float PI = 3.14159265358979f;
+
+// std430 views of InputShape, read from the packed Shape struct
+struct ShapeData {
+	glm::vec3 A;
+	uint32_t type;
+	glm::vec3 B;
+	uint32_t param;
+	float density;
+};
+
+struct Material {
+	glm::vec3 albedo;
+	float param;
+	glm::vec3 emissive;
+	uint32_t type;
+};
+
+inline ShapeData LoadShape(const Shape& s)
+{
+	return { ShapeA(s), s.shape_type, ShapeB(s), ShapeParam(s), s.params[0] };
+}
+
+inline Material LoadMaterial(const Shape& s)
+{
+	return { glm::vec3(s.C[0], s.C[1], s.C[2]), s.param, glm::vec3(s.D[0], s.D[1], s.D[2]), s.mat_type };
+}
+
+struct CameraData {
+	glm::vec3 lower_left;
+	glm::vec3 horz;
+	glm::vec3 vert;
+	glm::vec3 origin;
+	float lens_radius;
+};
+
+inline CameraData LoadCamera(const Camera& cam)
+{
+	return { cam.LowerLeft(), cam.Horizontal(), cam.Vertical(), cam.Origin(), cam.LensRadius() };
+}
+
+struct Ray {
+	glm::vec3 A;
+	glm::vec3 B;
+};
+
+struct HitInfo {
+	bool hit = false;
+	glm::vec3 hitpoint{ 0.0f };
+	float t = 0.0f;
+	glm::vec3 normal{ 0.0f };
+	Ray r{};
+	Material m{};
+};
+
+// Everything one shader invocation can see
+struct Buffers {
+	int width = 0, height = 0;
+	std::vector<glm::vec4> image;		// binding 0
+	std::vector<uint32_t> state;		// binding 1
+	std::vector<Shape> objects;			// binding 2
+	std::vector<BVHNode> bvh_nodes;		// binding 4, empty for the linear loop
+	CameraData cam{};
+};
+
+inline uint32_t hash(uint32_t seed)
+{
+	seed = (seed ^ 61u) ^ (seed >> 16);
+	seed *= 9u;
+	seed = seed ^ (seed >> 4);
+	seed *= 0x27d4eb2du;
+	seed = seed ^ (seed >> 15);
+	return seed;
+}
+
+inline glm::vec3 custom_reflect(const glm::vec3& I, const glm::vec3& N)
+{
+	return (I - 2.0f * glm::dot(I, glm::normalize(N)) * glm::normalize(N));
+}
+
+inline float schlick(float cosine, float ri)
+{
+	float r0 = (1.0f - ri) / (1.0f + ri);
+	r0 = r0 * r0;
+	float anticos = (1.0f - cosine);
+	return r0 + (1.0f - r0) * anticos * anticos * anticos * anticos * anticos;
+}
+
+inline glm::vec2 ConcentricDisk(const glm::vec2& u)
+{
+	glm::vec2 a = 2.0f * u - 1.0f;
+	if (a.x == 0.0f && a.y == 0.0f)
+		return glm::vec2(0.0f);
+	float r, phi;
+	if (std::abs(a.x) > std::abs(a.y)) {
+		r = a.x;
+		phi = (PI / 4.0f) * (a.y / a.x);
+	}
+	else {
+		r = a.y;
+		phi = PI / 2.0f - (PI / 4.0f) * (a.x / a.y);
+	}
+	return r * glm::vec2(std::cos(phi), std::sin(phi));
+}
+
+inline HitInfo HitRectXY(float sAx, float sAy, float sBx, float sBy, float z, const Ray& r, float normal)
+{
+	HitInfo h;
+	float t = (z - r.A.z) / r.B.z;
+	float x = r.A.x + r.B.x * t;
+	float y = r.A.y + r.B.y * t;
+	h.t = t;
+	if (x < sAx || x > sBx + sAx || y < sAy || y > sBy + sAy)
+		return h;
+	h.hit = true;
+	h.hitpoint = r.A + t * r.B;
+	h.normal = glm::vec3(0, 0, normal);
+	return h;
+}
+
+inline HitInfo HitRectYZ(float sAy, float sAz, float sBy, float sBz, float x, const Ray& r, float normal)
+{
+	HitInfo h;
+	float t = (x - r.A.x) / r.B.x;
+	float z = r.A.z + r.B.z * t;
+	float y = r.A.y + r.B.y * t;
+	h.t = t;
+	if (z < sAz || z > sBz + sAz || y < sAy || y > sBy + sAy)
+		return h;
+	h.hit = true;
+	h.hitpoint = r.A + t * r.B;
+	h.normal = glm::vec3(normal, 0, 0);
+	return h;
+}
+
+inline HitInfo HitRectXZ(float sAx, float sAz, float sBx, float sBz, float y, const Ray& r, float normal)
+{
+	HitInfo h;
+	float t = (y - r.A.y) / r.B.y;
+	float z = r.A.z + r.B.z * t;
+	float x = r.A.x + r.B.x * t;
+	h.t = t;
+	if (z < sAz || z > sBz + sAz || x < sAx || x > sBx + sAx)
+		return h;
+	h.hit = true;
+	h.hitpoint = r.A + t * r.B;
+	h.normal = glm::vec3(0, normal, 0);
+	return h;
+}
+
+inline bool HitNode(const BVHNode& node, const Ray& r, const glm::vec3& inv_dir, float tmin, float tmax)
+{
+	glm::vec3 t0 = (glm::vec3(node.bmin[0], node.bmin[1], node.bmin[2]) - r.A) * inv_dir;
+	glm::vec3 t1 = (glm::vec3(node.bmax[0], node.bmax[1], node.bmax[2]) - r.A) * inv_dir;
+	glm::vec3 tnear = glm::min(t0, t1);
+	glm::vec3 tfar = glm::max(t0, t1);
+	tmin = glm::max(tmin, glm::max(tnear.x, glm::max(tnear.y, tnear.z)));
+	tmax = glm::min(tmax, glm::min(tfar.x, glm::min(tfar.y, tfar.z)));
+	return tmin <= tmax;
+}
+
+// GLSL sign(): 0 for 0
+inline float sign(float x)
+{
+	return float((x > 0.0f) - (x < 0.0f));
+}
+
+// One invocation of main(): the global rng_state of the shader plus counters for benchmarking
+struct Invocation {
+	const Buffers& buf;
+	uint32_t rng_state = 0;
+	uint64_t rays = 0;	// WorldHit calls
+
+	explicit Invocation(const Buffers& b) : buf(b) {}
+
+	void rngseed(uint32_t seed) { rng_state = seed; }
+	uint32_t rngstate() const { return rng_state; }
+
+	uint32_t rand_xor()
+	{
+		rng_state ^= (rng_state << 13);
+		rng_state ^= (rng_state >> 17);
+		rng_state ^= (rng_state << 5);
+		return hash(rng_state);
+	}
+
+	float rng() { return float(rand_xor()) * INV_UINT_MAX; }
+
+	// GLSL evaluates arguments left to right; C++ does not, hence the named temporaries below
+	glm::vec3 RandomUnitVector()
+	{
+		float z = 1.0f - 2.0f * rng();
+		float r = std::sqrt(glm::max(0.0f, 1.0f - z * z));
+		float phi = 2.0f * PI * rng();
+		return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+	}
+
+	glm::vec3 RandomInUnitSphere()
+	{
+		glm::vec3 d = RandomUnitVector();
+		return std::pow(rng(), 1.0f / 3.0f) * d;
+	}
+
+	glm::vec2 RandomInUnitDisk()
+	{
+		float u = rng();
+		float v = rng();
+		return ConcentricDisk(glm::vec2(u, v));
+	}
+
+	glm::vec3 RandomCosineDirection(const glm::vec3& n)
+	{
+		float u = rng();
+		float v = rng();
+		glm::vec2 d = ConcentricDisk(glm::vec2(u, v));
+		glm::vec3 local = glm::vec3(d, std::sqrt(glm::max(0.0f, 1.0f - glm::dot(d, d))));
+		float s = n.z >= 0.0f ? 1.0f : -1.0f;
+		float a = -1.0f / (s + n.z);
+		float b = n.x * n.y * a;
+		glm::vec3 t = glm::vec3(1.0f + s * n.x * n.x * a, s * b, -s * n.x);
+		glm::vec3 bt = glm::vec3(b, s + n.y * n.y * a, -n.y);
+		return local.x * t + local.y * bt + local.z * n;
+	}
+
+	Ray GetRay(const CameraData& cam, float x, float y)
+	{
+		glm::vec2 rd = cam.lens_radius * RandomInUnitDisk();
+		glm::vec3 offset = glm::normalize(cam.horz) * rd.x + glm::normalize(cam.vert) * rd.y;
+		return { cam.origin + offset, (cam.lower_left + x * cam.horz + y * cam.vert - offset - cam.origin) };
+	}
+
+	glm::vec3 ScatterLambert(HitInfo& hit)
+	{
+		hit.r.A = hit.hitpoint;
+		hit.r.B = RandomCosineDirection(glm::normalize(hit.normal));
+		hit.hit = true;
+		return hit.m.albedo;
+	}
+
+	glm::vec3 ScatterMetal(HitInfo& hit)
+	{
+		hit.r.A = hit.hitpoint;
+		hit.r.B = glm::normalize(custom_reflect(hit.r.B, hit.normal)) + 0.2f * RandomInUnitSphere() * hit.m.param;
+		hit.hit = glm::dot(hit.r.B, hit.normal) > 0.0f;
+		return (hit.hit) ? hit.m.albedo : glm::vec3(0.0f);
+	}
+
+	glm::vec3 refract_dielectric(const glm::vec3& v, const glm::vec3& norm, float nu, float refl_prob)
+	{
+		glm::vec3 uv = glm::normalize(v);
+		float dt = glm::dot(uv, norm);
+		float disc = 1.0f - nu * nu * (1.0f - dt * dt);
+		if (disc > 0.0f && rng() > refl_prob)
+			return nu * (uv - norm * dt) - norm * std::sqrt(disc);
+		else
+			return custom_reflect(uv, norm);
+	}
+
+	glm::vec3 ScatterDielectric(HitInfo& hit)
+	{
+		glm::vec3 norm;
+		float nu;
+		float cosine;
+		if (glm::dot(hit.normal, hit.r.B) > 0) {
+			norm = -hit.normal;
+			nu = hit.m.param;
+			cosine = hit.m.param * glm::dot(glm::normalize(hit.r.B), hit.normal);
+		}
+		else {
+			norm = hit.normal;
+			nu = 1.0f / hit.m.param;
+			cosine = -glm::dot(glm::normalize(hit.r.B), hit.normal);
+		}
+
+		float ref_prob = schlick(cosine, hit.m.param);
+
+		hit.r.A = hit.hitpoint;
+		hit.r.B = refract_dielectric(hit.r.B, norm, nu, ref_prob);
+
+		return hit.m.albedo;
+	}
+
+	glm::vec3 ScatterIso(HitInfo& hit)
+	{
+		rng();	// drawn and unused by the shader as well
+
+		hit.r.A = hit.hitpoint;
+		hit.r.B = RandomUnitVector();
+		hit.hit = true;
+		return hit.m.albedo;
+	}
+
+	glm::vec3 Scatter(HitInfo& hit)
+	{
+		if (hit.m.type == MAT_LAMBERT)
+			return ScatterLambert(hit);
+		else if (hit.m.type == MAT_METAL)
+			return ScatterMetal(hit);
+		else if (hit.m.type == MAT_DIELECRIC)
+			return ScatterDielectric(hit);
+		else
+			return ScatterIso(hit);
+	}
+
+	HitInfo HitSphere(const ShapeData& s, const Ray& r, float tmin)
+	{
+		glm::vec3 oc = r.A - s.A;
+		float a = glm::dot(r.B, r.B);
+		float b = 2.0f * glm::dot(oc, r.B);
+		float c = glm::dot(oc, oc) - s.B.x * s.B.x;
+		float disc = b * b - 4 * a * c;
+		HitInfo h;
+		h.hit = (disc > 0.0f);
+		if (!h.hit)
+			return h;
+		h.t = (-b - std::sqrt(disc)) / (2.0f * a);
+		float t2 = (-b + std::sqrt(disc)) / (2.0f * a);
+		if (h.t < tmin) {
+			h.t = t2;
+			if (h.t < tmin) {
+				h.hit = false;
+				return h;
+			}
+		}
+
+		if ((s.type & SHP_SECONDARY_MASK) == SHP_ISOTROPIC) {
+			float d = std::abs(t2 - h.t) * glm::length(r.B);
+			float hit_d = -(1.0f / s.density) * std::log(rng());
+			if (hit_d < d) {
+				h.t = h.t + (hit_d / glm::length(r.B));
+				h.hitpoint = r.A + h.t * r.B;
+			}
+			else
+				h.hit = false;
+		}
+		else {
+			h.hitpoint = r.A + h.t * r.B;
+			h.normal = (h.hitpoint - s.A) / s.B.x;
+		}
+		return h;
+	}
+
+	HitInfo HitCuboid(const ShapeData& s, Ray r, float tmin)
+	{
+		float theta = float(s.param) / 1000.0f;
+		glm::vec3 center = s.A + s.B * 0.5f;
+		glm::vec3 A = center + RotateXZ(r.A - center, -theta);
+		glm::vec3 B = center + RotateXZ(r.B + r.A - center, -theta) - A;
+
+		r = Ray{ A, B };
+		HitInfo h;
+		HitInfo hmin;
+		HitInfo hmax;
+		// only faces that are actually hit may become the nearest / farthest one
+		hmin.hit = false;
+		hmin.t = 1e30f;
+		hmax.hit = false;
+		hmax.t = -1e30f;
+		h = HitRectXY(s.A.x, s.A.y, s.B.x, s.B.y, s.A.z, r, -1);
+		if (h.hit && h.t < hmin.t) hmin = h;
+		if (h.hit && h.t > hmax.t) hmax = h;
+		h = HitRectXY(s.A.x, s.A.y, s.B.x, s.B.y, s.A.z + s.B.z, r, 1);
+		if (h.hit && h.t < hmin.t) hmin = h;
+		if (h.hit && h.t > hmax.t) hmax = h;
+		h = HitRectYZ(s.A.y, s.A.z, s.B.y, s.B.z, s.A.x, r, -1);
+		if (h.hit && h.t < hmin.t) hmin = h;
+		if (h.hit && h.t > hmax.t) hmax = h;
+		h = HitRectYZ(s.A.y, s.A.z, s.B.y, s.B.z, s.A.x + s.B.x, r, 1);
+		if (h.hit && h.t < hmin.t) hmin = h;
+		if (h.hit && h.t > hmax.t) hmax = h;
+		h = HitRectXZ(s.A.x, s.A.z, s.B.x, s.B.z, s.A.y, r, -1);
+		if (h.hit && h.t < hmin.t) hmin = h;
+		if (h.hit && h.t > hmax.t) hmax = h;
+		h = HitRectXZ(s.A.x, s.A.z, s.B.x, s.B.z, s.A.y + s.B.y, r, 1);
+		if (h.hit && h.t < hmin.t) hmin = h;
+		if (h.hit && h.t > hmax.t) hmax = h;
+
+		if (!hmin.hit)
+			return hmin;
+		// starting inside the box the nearest face lies behind tmin, use the farthest one
+		h = hmin;
+		if (hmin.t < tmin) {
+			hmin = hmax;
+			hmax = h;
+		}
+		if (hmin.t < tmin) {
+			hmin.hit = false;
+			return hmin;
+		}
+
+		if ((s.type & SHP_SECONDARY_MASK) == SHP_ISOTROPIC) {
+			float d = std::abs(hmax.t - hmin.t) * glm::length(r.B);
+			float hit_d = -(1.0f / s.density) * std::log(rng());
+			if (hit_d < d) {
+				hmin.t = hmin.t + (hit_d / glm::length(r.B));
+				hmin.hitpoint = r.A + hmin.t * r.B;
+			}
+			else
+				hmin.hit = false;
+		}
+		else {
+			hmin.normal = RotateXZ(hmin.normal, theta);
+			hmin.hitpoint = center + RotateXZ(hmin.hitpoint - center, theta);
+		}
+
+		return hmin;
+	}
+
+	HitInfo HitShape(const ShapeData& s, const Ray& r, float tmin)
+	{
+		switch (s.type & SHP_PRIMITIVE_MASK) {
+		case SHP_SPHERE:
+			return HitSphere(s, r, tmin);
+		case SHP_CUBE:
+			return HitCuboid(s, r, tmin);
+		case SHP_RECT: {
+			HitInfo h;
+			switch (s.param) {
+			case AXIS_X:
+				h = HitRectYZ(s.A.y, s.A.z, s.B.y, s.B.z, s.A.x, r, sign(s.B.x));
+				if (h.t < tmin) h.hit = false;
+				break;
+			case AXIS_Y:
+				h = HitRectXZ(s.A.x, s.A.z, s.B.x, s.B.z, s.A.y, r, sign(s.B.y));
+				if (h.t < tmin) h.hit = false;
+				break;
+			case AXIS_Z:
+				h = HitRectXY(s.A.x, s.A.y, s.B.x, s.B.y, s.A.z, r, sign(s.B.z));
+				if (h.t < tmin) h.hit = false;
+				break;
+			}
+			return h;
+		}
+		default:
+			return HitSphere(s, r, tmin);
+		}
+	}
+
+	HitInfo WorldHit(const Ray& r, float tmin, float tmax)
+	{
+		rays++;
+		HitInfo hmin;
+		hmin.hit = false;
+		hmin.t = tmax;
+		const std::vector<Shape>& input_obj = buf.objects;
+		const std::vector<BVHNode>& bvh_nodes = buf.bvh_nodes;
+		if (bvh_nodes.empty()) {
+			for (size_t i = 0; i < input_obj.size(); i++) {
+				HitInfo h = HitShape(LoadShape(input_obj[i]), r, tmin);
+				if (h.hit && hmin.t > h.t) {
+					hmin = h;
+					hmin.m = LoadMaterial(input_obj[i]);
+				}
+			}
+			hmin.r = r;
+			return hmin;
+		}
+
+		glm::vec3 inv_dir = 1.0f / r.B;
+		uint32_t stack[BVH_STACK_SIZE];
+		int sp = 0;
+		stack[sp++] = 0u;
+		while (sp > 0) {
+			uint32_t index = stack[--sp];
+			const BVHNode& node = bvh_nodes[index];
+			if (!HitNode(node, r, inv_dir, tmin, hmin.t))
+				continue;
+			if (node.count > 0u) {
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					HitInfo h = HitShape(LoadShape(input_obj[i]), r, tmin);
+					if (h.hit && hmin.t > h.t) {
+						hmin = h;
+						hmin.m = LoadMaterial(input_obj[i]);
+					}
+				}
+			}
+			else {
+				uint32_t left = index + 1u, right = node.first & BVH_INDEX_MASK;
+				bool flip = r.B[node.first >> BVH_AXIS_SHIFT] < 0.0f;
+				stack[sp++] = flip ? left : right;
+				stack[sp++] = flip ? right : left;
+			}
+		}
+		hmin.r = r;
+		return hmin;
+	}
+
+	glm::vec4 Color(Ray r)
+	{
+		glm::vec3 A = glm::vec3(0);
+		glm::vec3 M = glm::vec3(1);
+		for (int depth = 0; depth < MAX_DEPTH; depth++) {
+			HitInfo h = WorldHit(r, 0.001f, 1000.0f);
+			if (h.hit) {
+				A = A + M * h.m.emissive;
+				M = M * Scatter(h);
+				if (!h.hit) break;
+				r = h.r;
+			}
+			else {
+				M = M * glm::vec3(0.0f);	// no skybox on the CPU
+				break;
+			}
+		}
+		return glm::vec4(A + M, 1.0f);
+	}
+
+	// main() for the pixel gl_GlobalInvocationID.xy + chunk
+	void Run(glm::ivec2 pixel_coords, int iteration, std::vector<glm::vec4>& img_output, std::vector<uint32_t>& state)
+	{
+		glm::ivec2 dims(buf.width, buf.height);
+		size_t idx = size_t(pixel_coords.y) * dims.x + pixel_coords.x;
+		glm::vec4 img = img_output[idx];
+
+		rngseed(state[idx]);
+
+		float x = (pixel_coords.x + rng()) / float(dims.x);
+		float y = (pixel_coords.y + rng()) / float(dims.y);
+		Ray r = GetRay(buf.cam, x, y);
+		glm::vec4 pixel = (Color(r) + float(iteration) * img) * (1.0f / (1.0f + float(iteration)));
+
+		img_output[idx] = pixel;
+		state[idx] = rngstate();
+	}
+};
+
+// glDispatchCompute(size.x, size.y, 1) with the given chunk offset, on `threads` threads.
+// Rows are handed out one at a time; each pixel only depends on its own rng state, so the image is
+// the same for any thread count. Returns the number of rays traced (WorldHit calls).
+inline uint64_t Dispatch(Buffers& buf, int iteration, glm::ivec2 chunk, glm::ivec2 size, int threads)
+{
+	std::atomic<int> next_row{ 0 };
+	std::atomic<uint64_t> rays{ 0 };
+	auto worker = [&]() {
+		Invocation inv(buf);
+		for (int j = next_row++; j < size.y; j = next_row++)
+			for (int i = 0; i < size.x; i++)
+				inv.Run(chunk + glm::ivec2(i, j), iteration, buf.image, buf.state);
+		rays += inv.rays;
+	};
+	if (threads <= 1) {
+		worker();
+		return rays;
+	}
+	std::vector<std::thread> pool;
+	for (int k = 0; k < threads; k++)
+		pool.emplace_back(worker);
+	for (std::thread& t : pool)
+		t.join();
+	return rays;
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <fstream>
+
+// Writes the accumulated RGBA32F texture as a binary PPM, the way fragment.frag shows it:
+// clamped to [0,1], no gamma. Row 0 of the texture is the bottom of the image.
+inline bool WritePPM(const std::string& path, int width, int height, const std::vector<glm::vec4>& image)
+{
+	std::ofstream file(path, std::ios::binary);
+	file << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<unsigned char> row(size_t(width) * 3);
+	for (int j = height - 1; j >= 0; j--) {
+		for (int i = 0; i < width; i++) {
+			glm::vec3 c = glm::clamp(glm::vec3(image[size_t(j) * width + i]), 0.0f, 1.0f);
+			row[3 * i + 0] = (unsigned char)(255.99f * c.r);
+			row[3 * i + 1] = (unsigned char)(255.99f * c.g);
+			row[3 * i + 2] = (unsigned char)(255.99f * c.b);
+		}
+		file.write((const char*)row.data(), row.size());
+	}
+	return bool(file);
+}
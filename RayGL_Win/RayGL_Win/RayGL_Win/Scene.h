@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <random>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include "Shape.h"
+#include "Camera.h"
+#include "scene_file.h"
+
+// Scenes come from the text format in src/scene_file.h, shared with the CPU ray tracer (src/scene_hitable.h).
+// This header exports them to the Shape buffer the GPU (main.cpp) and the CPU port of Compute.comp
+// (main_cpu.cpp) trace, and provides the initial rng state both of them start from.
+
+// Shape has to stay byte compatible with `struct InputShape { Shape S; Material M; }` in Compute.comp (std430)
+static_assert(sizeof(Shape) == 80, "Shape must match InputShape in Compute.comp");
+static_assert(offsetof(Shape, A) == 0 && offsetof(Shape, shape_type) == 12, "Shape.A / Shape.type");
+static_assert(offsetof(Shape, B) == 16 && offsetof(Shape, rotation) == 28, "Shape.B / Shape.param");
+static_assert(offsetof(Shape, params) == 32, "Shape.density");
+static_assert(offsetof(Shape, C) == 48 && offsetof(Shape, param) == 60, "Material.albedo / Material.param");
+static_assert(offsetof(Shape, D) == 64 && offsetof(Shape, mat_type) == 76, "Material.emissive / Material.type");
+
+inline glm::vec3 SceneVec3(const float* v) { return glm::vec3(v[0], v[1], v[2]); }
+
+// One packed Shape per scene object, in the same order as scene.objects
+inline Shape ExportShape(const scene_desc& scene, const scene_object& o)
+{
+	const scene_material& m = scene.materials[o.material];
+	glm::vec3 albedo = SceneVec3(m.albedo), emissive(0.0f);
+	MaterialType type = MaterialType::LAMBERTIAN;
+	float param = 0.0f;
+	switch (m.kind) {
+	case scene_material::lambertian:
+		break;
+	case scene_material::metal:
+		// ScatterMetal perturbs by 0.2 * param, metal in src/ by the fuzz clamped to 1
+		type = MaterialType::METALLIC;
+		param = std::min(m.param, 1.0f) / 0.2f;
+		break;
+	case scene_material::dielectric:
+		// src/ glass does not absorb; the shader multiplies by the albedo
+		type = MaterialType::DIELECTRIC;
+		albedo = glm::vec3(1.0f);
+		param = m.param;
+		break;
+	case scene_material::light:
+		// The shader adds the emission of any material; a black lambertian stops carrying light after the hit
+		emissive = albedo;
+		albedo = glm::vec3(0.0f);
+		break;
+	}
+
+	glm::vec3 p0 = SceneVec3(o.p0), p1 = SceneVec3(o.p1);
+	switch (o.kind) {
+	case scene_object::sphere:
+		return Sphere(p0, o.p1[0], albedo, emissive, param, type);
+	case scene_object::box: {
+		Shape s = Cube(p0, p1 - p0, 0.0f, albedo, emissive, param, type);
+		uint32_t rotation = scene_box_milliradians(o.rotate_y);	// the angle src/ rotates by as well
+		memcpy(&s.rotation, &rotation, sizeof(rotation));
+		return s;
+	}
+	default:
+		return Rect(p0, p1 - p0, albedo, emissive, param, type, o.flip ? -1.0f : 1.0f);
+	}
+}
+
+inline std::vector<Shape> ExportShapes(const scene_desc& scene)
+{
+	std::vector<Shape> shapes;
+	for (const scene_object& o : scene.objects)
+		shapes.push_back(ExportShape(scene, o));
+	return shapes;
+}
+
+// The shader focuses at distance 1, so a non-zero aperture blurs differently from src/ (focused on lookat)
+inline Camera ExportCamera(const scene_desc& scene, float aspect)
+{
+	return Camera(SceneVec3(scene.lookfrom), SceneVec3(scene.lookat), glm::vec3(0, 1, 0), scene.vfov, aspect, scene.aperture);
+}
+
+// Initial xorshift state of every pixel (binding 1), indexed y * width + x.
+// Raw mt19937 output is the same with every standard library, unlike default_random_engine
+// and uniform_int_distribution, so the GPU and the CPU port start from identical states.
+// xorshift never leaves 0, so a zero seed is replaced.
+inline std::vector<uint32_t> InitialRngState(int width, int height, uint32_t seed = 5489u)
+{
+	std::mt19937 rng(seed);
+	std::vector<uint32_t> state(size_t(width) * height);
+	for (int i = 0; i < width; i++)
+		for (int j = 0; j < height; j++) {
+			uint32_t s = uint32_t(rng());
+			state[size_t(j) * width + i] = s ? s : 0x9E3779B9u;
+		}
+	return state;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include "Shape.h"
+
+// Flattened BVH over the Shape buffer that Compute.comp traverses instead of looping over every object.
+// Nodes are stored depth first: the left child of an interior node is the node right after it,
+// so only the right child index has to be stored.
+
+// std430 layout (32 bytes), matches `struct BVHNode` in Compute.comp:
+//   leaf:     count > 0, objects [first, first + count) of the reordered Shape buffer
+//   interior: count == 0, right child = first & BVH_INDEX_MASK, split axis = first >> BVH_AXIS_SHIFT
+struct BVHNode {
+	float bmin[3];
+	uint32_t first;
+	float bmax[3];
+	uint32_t count;
+};
+static_assert(sizeof(BVHNode) == 32, "BVHNode must match the std430 layout in Compute.comp");
+static_assert(sizeof(Shape) == 80, "Shape must match InputShape in Compute.comp");
+
+const uint32_t BVH_AXIS_SHIFT = 30u;
+const uint32_t BVH_INDEX_MASK = (1u << BVH_AXIS_SHIFT) - 1u;
+const int BVH_STACK_SIZE = 32;	// also the traversal stack size in Compute.comp
+
+struct ShapeBounds {
+	glm::vec3 min{ FLT_MAX };
+	glm::vec3 max{ -FLT_MAX };
+
+	void Grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+	void Grow(const ShapeBounds& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	glm::vec3 Center() const { return 0.5f * (min + max); }
+	float Area() const
+	{
+		glm::vec3 d = max - min;
+		return (d.x < 0.0f) ? 0.0f : 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+};
+
+inline glm::vec3 ShapeA(const Shape& s) { return glm::vec3(s.A[0], s.A[1], s.A[2]); }
+inline glm::vec3 ShapeB(const Shape& s) { return glm::vec3(s.B[0], s.B[1], s.B[2]); }
+
+// The uint the shader reads as Shape.param: rotation*1000 for cubes, plane axis for rects
+inline uint32_t ShapeParam(const Shape& s)
+{
+	uint32_t p;
+	memcpy(&p, &s.rotation, sizeof(p));
+	return p;
+}
+
+// Same rotation as rotateXZ() in Compute.comp
+inline glm::vec3 RotateXZ(const glm::vec3& a, float angle)
+{
+	return glm::vec3(cos(angle) * a.x - sin(angle) * a.z, a.y, sin(angle) * a.x + cos(angle) * a.z);
+}
+
+// World space bounds of a shape, following the intersection code in Compute.comp
+inline ShapeBounds BoundsOf(const Shape& s)
+{
+	ShapeBounds b;
+	glm::vec3 A = ShapeA(s), B = ShapeB(s);
+	switch (s.shape_type & 0x0000FFFFu) {
+	case uint32_t(ShapeType::CUBE): {
+		// The box [A, A+B] is rotated about its center A + B/2 by rotation/1000 radians, exactly as HitCuboid does
+		float theta = ShapeParam(s) / 1000.0f;
+		glm::vec3 center = A + B * 0.5f;
+		for (int k = 0; k < 8; k++) {
+			glm::vec3 corner = A + glm::vec3((k & 1) ? B.x : 0.0f, (k & 2) ? B.y : 0.0f, (k & 4) ? B.z : 0.0f);
+			b.Grow(center + RotateXZ(corner - center, theta));
+		}
+	} break;
+	case uint32_t(ShapeType::RECT): {
+		// B holds the extent on the two in-plane axes and the normal sign on the plane axis
+		uint32_t axis = ShapeParam(s);
+		glm::vec3 far = A + B;
+		far[axis] = A[axis];
+		b.Grow(A);
+		b.Grow(far);
+		b.min[axis] -= 1e-4f;
+		b.max[axis] += 1e-4f;
+	} break;
+	default:	// sphere
+		b.Grow(A - glm::vec3(fabs(B.x)));
+		b.Grow(A + glm::vec3(fabs(B.x)));
+		break;
+	}
+	return b;
+}
+
+struct ShapeBVHStats {
+	int nodes = 0;
+	int leaves = 0;
+	int max_depth = 0;
+	float sah_cost = 0.0f;	// expected cost relative to intersecting every object (1 = no better than a loop)
+};
+
+// Binned SAH builder. Produces the node buffer and the Shape buffer reordered so every leaf is contiguous.
+class ShapeBVHBuilder {
+public:
+	static const int BINS = 12;
+	int max_leaf_size = 4;
+	float traversal_cost = 1.0f;	// relative to one shape intersection
+	int depth_limit = BVH_STACK_SIZE - 2;	// the shader's traversal stack bounds the depth; never set it higher
+
+	ShapeBVHStats Build(const std::vector<Shape>& shapes, std::vector<BVHNode>& nodes, std::vector<Shape>& ordered)
+	{
+		nodes.clear();
+		ordered.clear();
+		stats = ShapeBVHStats();
+		prims.clear();
+		for (uint32_t i = 0; i < shapes.size(); i++) {
+			ShapeBounds b = BoundsOf(shapes[i]);
+			prims.push_back({ b, b.Center(), i });
+		}
+		if (!prims.empty()) {
+			Build(nodes, 0, (int)prims.size(), 0);
+			for (const Prim& p : prims)
+				ordered.push_back(shapes[p.index]);
+			float root_area = BoundsOfNode(nodes[0]).Area();
+			for (const BVHNode& n : nodes) {
+				float a = root_area > 0.0f ? BoundsOfNode(n).Area() / root_area : 1.0f;
+				stats.sah_cost += a * (n.count > 0 ? float(n.count) : traversal_cost);
+			}
+			stats.sah_cost /= float(prims.size());
+		}
+		stats.nodes = (int)nodes.size();
+		return stats;
+	}
+
+	static ShapeBounds BoundsOfNode(const BVHNode& n)
+	{
+		ShapeBounds b;
+		b.min = glm::vec3(n.bmin[0], n.bmin[1], n.bmin[2]);
+		b.max = glm::vec3(n.bmax[0], n.bmax[1], n.bmax[2]);
+		return b;
+	}
+
+private:
+	struct Prim {
+		ShapeBounds bounds;
+		glm::vec3 centroid;
+		uint32_t index;
+	};
+
+	std::vector<Prim> prims;
+	ShapeBVHStats stats;
+
+	int Build(std::vector<BVHNode>& nodes, int begin, int end, int depth)
+	{
+		stats.max_depth = std::max(stats.max_depth, depth);
+		int index = (int)nodes.size();
+		nodes.push_back(BVHNode());
+		ShapeBounds bounds, centroids;
+		for (int i = begin; i < end; i++) {
+			bounds.Grow(prims[i].bounds);
+			centroids.Grow(prims[i].centroid);
+		}
+		for (int k = 0; k < 3; k++) {
+			nodes[index].bmin[k] = bounds.min[k];
+			nodes[index].bmax[k] = bounds.max[k];
+		}
+
+		int count = end - begin;
+		int axis = -1, split_bin = 0;
+		float best = FLT_MAX;
+		if (count > 1) {
+			for (int a = 0; a < 3; a++) {
+				float extent = centroids.max[a] - centroids.min[a];
+				if (extent <= 0.0f)
+					continue;
+				ShapeBounds bin_bounds[BINS];
+				int bin_count[BINS] = { 0 };
+				for (int i = begin; i < end; i++) {
+					int b = Bin(prims[i].centroid[a], centroids.min[a], extent);
+					bin_count[b]++;
+					bin_bounds[b].Grow(prims[i].bounds);
+				}
+				// sweep from the right to get the area and count of every right side
+				float right_area[BINS];
+				int right_count[BINS];
+				ShapeBounds acc;
+				int n = 0;
+				for (int b = BINS - 1; b > 0; b--) {
+					acc.Grow(bin_bounds[b]);
+					n += bin_count[b];
+					right_area[b] = acc.Area();
+					right_count[b] = n;
+				}
+				acc = ShapeBounds();
+				n = 0;
+				for (int b = 0; b < BINS - 1; b++) {
+					acc.Grow(bin_bounds[b]);
+					n += bin_count[b];
+					if (n == 0 || right_count[b + 1] == 0)
+						continue;
+					float cost = acc.Area() * n + right_area[b + 1] * right_count[b + 1];
+					if (cost < best) {
+						best = cost;
+						axis = a;
+						split_bin = b;
+					}
+				}
+			}
+		}
+
+		// Leaf when splitting is not expected to pay off (or is impossible)
+		float leaf_cost = float(count);
+		float split_cost = axis < 0 ? FLT_MAX : traversal_cost + best / std::max(bounds.Area(), FLT_MIN);
+		if (axis < 0 || depth >= depth_limit || (count <= max_leaf_size && split_cost >= leaf_cost)) {
+			nodes[index].first = (uint32_t)begin;
+			nodes[index].count = (uint32_t)count;
+			stats.leaves++;
+			return index;
+		}
+
+		float lo = centroids.min[axis], extent = centroids.max[axis] - lo;
+		Prim* mid = std::partition(&prims[begin], &prims[begin] + count, [&](const Prim& p) {
+			return Bin(p.centroid[axis], lo, extent) <= split_bin;
+		});
+		int m = int(mid - &prims[0]);
+		Build(nodes, begin, m, depth + 1);
+		int right = Build(nodes, m, end, depth + 1);
+		nodes[index].first = (uint32_t)right | ((uint32_t)axis << BVH_AXIS_SHIFT);
+		nodes[index].count = 0;
+		return index;
+	}
+
+	static int Bin(float c, float lo, float extent)
+	{
+		return std::min(BINS - 1, (int)((c - lo) / extent * BINS));
+	}
+};
@@ -4,21 +4,59 @@
 #include "Shader.h"
 #include "Camera.h"
 #include "Shape.h"
+#include "ShapeBVH.h"
+#include "Scene.h"
+#include "ChunkScheduler.h"
+#include "ImageFile.h"
 #include <iostream>
-#include <random>
 #include <iomanip>
+#include <cstring>
+#include <cstdlib>
 
 const float rad2deg = 180.0f / 3.1415926535f;
 
-int main()
+int main(int argc, char* argv[])
 {
+	// RayGL [--scene file] [--headless out.ppm] [--iterations N] [--budget ms]
+	// Scene file shared with the CPU ray tracer; the default path is relative to the project directory
+	std::string scene_path = "../../../scenes/cornell_box.scene";
+	std::string headless_out;	// render without showing the window, then write the image here
+	int max_iterations = 0;		// 0: keep refining until the window is closed
+	double budget_ms = 1000.0 / 60.0;	// target latency of one dispatch, keeps the window responsive
+	for (int a = 1; a < argc; a++)
+	{
+		if (!strcmp(argv[a], "--scene") && a + 1 < argc)
+			scene_path = argv[++a];
+		else if (!strcmp(argv[a], "--headless") && a + 1 < argc)
+			headless_out = argv[++a];
+		else if (!strcmp(argv[a], "--iterations") && a + 1 < argc)
+			max_iterations = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--budget") && a + 1 < argc)
+			budget_ms = atof(argv[++a]);
+		else
+		{
+			std::cout << "usage: " << argv[0] << " [--scene file] [--headless out.ppm] [--iterations N] [--budget ms]" << std::endl;
+			return -1;
+		}
+	}
+	const bool HEADLESS = !headless_out.empty();
+	if (HEADLESS && max_iterations <= 0)
+		max_iterations = 64;
+
+	scene_desc scene;
+	std::string scene_error;
+	if (!read_scene_file(scene_path, scene, scene_error))
+	{
+		std::cout << scene_error << std::endl;
+		return -1;
+	}
+
 	GLFWwindow* window = nullptr;
 
 	const int WIDTH = 1920;
 	const int HEIGHT = 1080;
 
-	const int CHUNKS_X = 2;
-	const int CHUNKS_Y = 2;
+	const int TILE = 64;
 	const bool FULLSCREEN = true;
 	const bool SKYBOX_ACTIVE = false;
 
@@ -29,6 +67,8 @@ int main()
 #ifdef __APPLE__
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
+	// headless still needs a GL context, but the window is never shown
+	glfwWindowHint(GLFW_VISIBLE, HEADLESS ? GLFW_FALSE : GLFW_TRUE);
 
 	window = glfwCreateWindow(WIDTH, HEIGHT, "RayGL", nullptr, nullptr);
 	if (!window)
@@ -80,12 +120,8 @@ int main()
 
 	// SSBO for random engine
 	// the each pixel store a random number
-	std::default_random_engine rng;
-	std::uniform_int_distribution<uint32_t> distr;
-	std::vector<unsigned int> init_rng(WIDTH * HEIGHT);
-	for (int i = 0; i < WIDTH; i++)
-		for (int j = 0; j < HEIGHT; j++)
-			init_rng[j * WIDTH + i] = distr(rng);
+	// the same initial state as the CPU port (Scene.h)
+	std::vector<unsigned int> init_rng = InitialRngState(WIDTH, HEIGHT);
 
 	compshdr.use();
 	unsigned int SSBO_rng;
@@ -94,48 +130,67 @@ int main()
 	glBufferData(GL_SHADER_STORAGE_BUFFER, init_rng.size() * sizeof(unsigned int), init_rng.data(), GL_STATIC_DRAW);
 
 	//The object store the list of Sphere and trans data to the shader
-	std::vector<Shape> obj{
-		//5wall, 1 Cube and 1 Sphere
-		(Rect(glm::vec3{-3,-3,-2}, glm::vec3(6,6,0), glm::vec3(0.73f), 1.0f, MaterialType::LAMBERTIAN)),
-		(Rect(glm::vec3(-3,-3,-2), glm::vec3(0,6,6), glm::vec3(0.65f, 0.05f, 0.05f), 1.0f, MaterialType::LAMBERTIAN)),
-		(Rect(glm::vec3(3,-3,-2), glm::vec3(0,6,6), glm::vec3(0.12f, 0.45f, 0.15f), 1.0f, MaterialType::LAMBERTIAN, -1.0f)),
-		(Rect(glm::vec3(-3,-3,-2), glm::vec3(6,0,6), glm::vec3(0.8f, 0.8f, 0.8f), 1.0f, MaterialType::LAMBERTIAN, 1.0f)),
-		(Rect(glm::vec3(-3, 3,-2), glm::vec3(6,0,6), glm::vec3(0.8f, 0.8f, 0.8f), 1.0f, MaterialType::LAMBERTIAN, -1.0f)),
-		(Rect(glm::vec3(-2.0f, 2.99f,-1.0f), glm::vec3(4,0,4), glm::vec3(0.8f, 0.8f, 0.8f), glm::vec3(2.0f), 1.0f, MaterialType::LAMBERTIAN, -1.0f)),
-		(Cube(glm::vec3(-2.5, -3, -1), glm::vec3(2,4,2), 20.0f, glm::vec3(0.8f), 0.1f, MaterialType::LAMBERTIAN)),
-		(Sphere(glm::vec3(-2.5f, 1.5f, -1.0f), 0.5f, glm::vec3(1.0f), 1.5f, MaterialType::DIELECTRIC)),
-	};
+	std::vector<Shape> obj = ExportShapes(scene);
+
+	// Build the BVH on the CPU; the shader traverses the node buffer and reads the objects in BVH order
+	std::vector<BVHNode> bvh_nodes;
+	std::vector<Shape> bvh_objects;
+	ShapeBVHStats bvh_stats = ShapeBVHBuilder().Build(obj, bvh_nodes, bvh_objects);
+	std::cout << "BVH: " << obj.size() << " objects, " << bvh_stats.nodes << " nodes, " << bvh_stats.leaves << " leaves, depth "
+		<< bvh_stats.max_depth << ", SAH cost " << bvh_stats.sah_cost << std::endl;
 
 	compshdr.use();
 	unsigned int SSBO_objects;
 	glGenBuffers(1, &SSBO_objects);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, SSBO_objects);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, obj.size() * sizeof(Sphere), obj.data(), GL_STATIC_DRAW);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bvh_objects.size() * sizeof(Shape), bvh_objects.data(), GL_STATIC_DRAW);
+
+	unsigned int SSBO_bvh;
+	glGenBuffers(1, &SSBO_bvh);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, SSBO_bvh);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bvh_nodes.size() * sizeof(BVHNode), bvh_nodes.data(), GL_STATIC_DRAW);
 
 	// Camera
-	Camera cam({ 0,0,16 }, { 0,0,0 }, { 0,1,0 }, 30.0f, (float)WIDTH / (float)HEIGHT);
+	Camera cam = ExportCamera(scene, (float)WIDTH / (float)HEIGHT);
 	cam.Bind(compshdr);
 
 	// Variables.
-	int iteration = 0;
 	bool wait_after_quit = false;
 	double start = glfwGetTime();
-	const int CHUNK_W = TEX_W / CHUNKS_X;
-	const int CHUNK_H = TEX_H / CHUNKS_Y;
-	const int N_CHUNKS = CHUNKS_X * CHUNKS_Y;
 	compshdr.setBool("skybox_active", SKYBOX_ACTIVE);
 
-	double prev = start;
+	// Rectangles of equally sampled tiles, sized so each dispatch stays within the budget
+	ChunkScheduler scheduler(TEX_W, TEX_H, TILE, budget_ms * 1e-3, max_iterations);
+	int shown_pass = -1;
+	bool done = false;
 	while (!glfwWindowShouldClose(window)) {
-		//draw the picture following the left_bottom -> right_bottom -> left_top -> right-top
-		int chunk_x, chunk_y;
-		chunk_x = iteration % CHUNKS_X;
-		chunk_y = (iteration / CHUNKS_X) % CHUNKS_Y;
-
-		compshdr.use();
-		compshdr.setInt("iteration", (iteration++ / N_CHUNKS));
-		compshdr.setVector("chunk", glm::ivec2(chunk_x * CHUNK_W, chunk_y * CHUNK_H));
-		glDispatchCompute(static_cast<unsigned int>(TEX_W / CHUNKS_X), static_cast<unsigned int>(TEX_H / CHUNKS_Y), 1);
+		ChunkDispatch d;
+		if (!done && scheduler.Next(d))
+		{
+			compshdr.use();
+			compshdr.setInt("iteration", d.iteration);
+			compshdr.setVector("chunk", glm::ivec2(d.x, d.y));
+			double t0 = glfwGetTime();
+			glDispatchCompute(static_cast<unsigned int>(d.width), static_cast<unsigned int>(d.height), 1);
+			glFinish();	// the scheduler needs the real duration of the dispatch
+			scheduler.Complete(d, glfwGetTime() - t0);
+
+			if (d.pass != shown_pass)
+			{
+				shown_pass = d.pass;
+				double time = glfwGetTime();
+				std::cout << "Number of iterations: " << std::setw(4) << d.pass << " Dispatches: " << std::setw(6) << scheduler.Dispatches()
+					<< " Dispatch size: " << std::setw(8) << d.width * d.height << " Time: " << std::setw(7) << time - start << "\t\t\t\r";
+			}
+		}
+		else
+			done = true;
+		if (HEADLESS)
+		{
+			if (done)
+				break;
+			continue;
+		}
 
 		glfwPollEvents();
 		if (glfwGetKey(window, GLFW_KEY_SPACE) || glfwGetKey(window, GLFW_KEY_ESCAPE) || glfwGetKey(window, GLFW_KEY_ENTER))
@@ -149,19 +204,26 @@ int main()
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
 		glfwSwapBuffers(window);
+	}
+	std::cout << std::endl;
 
-		if (iteration % N_CHUNKS == 0)
-		{
-			double time = glfwGetTime();
-			std::cout << "Number of iterations: " << std::setw(4) << iteration / N_CHUNKS << " FPS: " << std::setw(7) << iteration / (N_CHUNKS * (time - start)) << " Delta: " << std::setw(7) << time - prev << "\t\t\t\r";
-			prev = time;
-		}
+	if (HEADLESS)
+	{
+		std::vector<glm::vec4> pixels(size_t(TEX_W) * TEX_H);
+		glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D, tex_output);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, pixels.data());
+		double time = glfwGetTime() - start;
+		std::cout << scheduler.MinIteration() << " samples per pixel in " << time << " s, " << scheduler.Dispatches() << " dispatches -> " << headless_out << std::endl;
+		if (!WritePPM(headless_out, TEX_W, TEX_H, pixels))
+			std::cout << "cannot write " << headless_out << std::endl;
 	}
 
 	// Cleanup
 	glDeleteBuffers(1, &VBO);
 	glDeleteBuffers(1, &SSBO_rng);
 	glDeleteBuffers(1, &SSBO_objects);
+	glDeleteBuffers(1, &SSBO_bvh);
 	glDeleteTextures(1, &tex_output);
 	glDeleteVertexArrays(1, &VAO);
 
@@ -0,0 +1,255 @@
+// Headless CPU renderer of a RayGL scene file, running the C++ port of Compute.comp (ComputeCPU.h).
+// Used to benchmark CPU against GPU throughput and to regression-test the shader math without OpenGL.
+//   RayGL_CPU [--scene file] [--size W H] [--iterations N] [--threads N] [--no-bvh] [--out file.ppm]
+//             [--budget ms] [--tile N] [--center-out] [--converge threshold] [--check-bvh N]
+// Dispatches are scheduled by ChunkScheduler exactly as on the GPU, each kept under the --budget latency.
+// --check-bvh N traces N random rays through WorldHit with and without the BVH node buffer and exits non-zero
+// if any of them hits differently or a node buffer is malformed. It runs on the scene, on the scene with 200 and 5000
+// random shapes added, and with 5000 shapes under a depth limit of 6 so the depth cap (which real scenes rarely reach
+// before BVH_STACK_SIZE - 2) forces large leaves.
+#include "Camera.h"
+#include "Shape.h"
+#include "ShapeBVH.h"
+#include "Scene.h"
+#include "ComputeCPU.h"
+#include "ChunkScheduler.h"
+#include "ImageFile.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <random>
+
+// Structure of a built node buffer: every interior node has its left child right after it and a right child
+// further on, every shape is in exactly one leaf, nodes = 2 * leaves - 1, and the depth is within the builder's limit.
+static bool CheckBVHNodes(const std::vector<BVHNode>& nodes, const ShapeBVHStats& stats, size_t shapes, int depth_limit)
+{
+	std::vector<int> covered(shapes, 0);
+	int leaves = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const BVHNode& n = nodes[i];
+		if (n.count > 0) {
+			leaves++;
+			if (n.first + n.count > shapes)
+				return false;
+			for (uint32_t k = n.first; k < n.first + n.count; k++)
+				covered[k]++;
+		}
+		else {
+			uint32_t right = n.first & BVH_INDEX_MASK;
+			if (right <= i + 1 || right >= nodes.size())
+				return false;
+		}
+	}
+	return leaves == stats.leaves && int(nodes.size()) == 2 * leaves - 1 && stats.max_depth <= depth_limit &&
+		std::all_of(covered.begin(), covered.end(), [](int c) { return c == 1; });
+}
+
+// Random rays from inside the (slightly enlarged) bounds must find the same nearest hit with the BVH
+// as with the linear loop over the same reordered Shape buffer. Isotropic volumes draw a random scattering
+// distance, so for this check they are turned into plain surfaces and report their boundary.
+// Only t is compared, to a relative 1e-5: coincident faces (a box standing on the floor) tie, either shape may win
+// and the two shapes may compute the same point a few ulps apart.
+static int CheckBVH(const char* name, const std::vector<Shape>& shapes, int rays, int depth_limit = BVH_STACK_SIZE - 2)
+{
+	std::vector<Shape> obj = shapes;
+	for (Shape& s : obj)
+		s.shape_type &= ~ComputeCPU::SHP_SECONDARY_MASK;
+	ComputeCPU::Buffers bvh, linear;
+	ShapeBVHBuilder builder;
+	builder.depth_limit = depth_limit;
+	ShapeBVHStats stats = builder.Build(obj, bvh.bvh_nodes, bvh.objects);
+	linear.objects = bvh.objects;
+	ShapeBounds bounds;
+	for (const Shape& s : obj)
+		bounds.Grow(BoundsOf(s));
+	glm::vec3 lo = bounds.min - 0.1f * (bounds.max - bounds.min), extent = 1.2f * (bounds.max - bounds.min);
+
+	ComputeCPU::Invocation with(bvh), without(linear);
+	with.rngseed(12345u);
+	int mismatches = 0, hits = 0;
+	for (int i = 0; i < rays; i++) {
+		glm::vec3 o = lo + extent * glm::vec3(with.rng(), with.rng(), with.rng());
+		ComputeCPU::Ray r{ o, with.RandomUnitVector() };
+		ComputeCPU::HitInfo a = with.WorldHit(r, 0.001f, 1000.0f);
+		ComputeCPU::HitInfo b = without.WorldHit(r, 0.001f, 1000.0f);
+		hits += a.hit;
+		if (a.hit != b.hit || (a.hit && std::fabs(a.t - b.t) > 1e-5f * std::max(1.0f, a.t))) {
+			if (mismatches++ < 10)
+				std::cout << "ray " << i << ": bvh " << a.hit << " t " << a.t << ", linear " << b.hit << " t " << b.t << std::endl;
+		}
+	}
+	bool nodes_ok = depth_limit <= BVH_STACK_SIZE - 2 && CheckBVHNodes(bvh.bvh_nodes, stats, obj.size(), depth_limit);
+	std::cout << "BVH check " << name << ": " << obj.size() << " objects, " << stats.nodes << " nodes, " << stats.leaves
+		<< " leaves, depth " << stats.max_depth << (nodes_ok ? "" : " (invalid node buffer)") << ", " << rays << " rays, "
+		<< hits << " hits, " << mismatches << " mismatches" << std::endl;
+	return mismatches || !nodes_ok ? 1 : 0;
+}
+
+// The scene's shapes plus `count` random spheres, rotated cubes and rects spread over the scene bounds,
+// so the check also covers SAH splits over thousands of shapes, not just the handful in a scene file
+static std::vector<Shape> AddRandomShapes(std::vector<Shape> shapes, int count, uint32_t seed)
+{
+	ShapeBounds bounds;
+	for (const Shape& s : shapes)
+		bounds.Grow(BoundsOf(s));
+	glm::vec3 extent = bounds.max - bounds.min;
+	float size = std::max(extent.x, std::max(extent.y, extent.z)) / std::cbrt(float(count)) * 0.5f;
+	std::mt19937 rng(seed);
+	auto uniform = [&]() { return float(rng() >> 8) / float(1u << 24); };
+	for (int i = 0; i < count; i++) {
+		glm::vec3 p = bounds.min + extent * glm::vec3(uniform(), uniform(), uniform());
+		glm::vec3 albedo(uniform(), uniform(), uniform());
+		switch (i % 3) {
+		case 0:
+			shapes.push_back(Sphere(p, size * (0.2f + uniform()), albedo, 0.0f, MaterialType::LAMBERTIAN));
+			break;
+		case 1:
+			shapes.push_back(Cube(p, size * glm::vec3(0.2f + uniform(), 0.2f + uniform(), 0.2f + uniform()), 360.0f * uniform(),
+				albedo, 0.0f, MaterialType::LAMBERTIAN));
+			break;
+		default: {
+			glm::vec3 d = size * glm::vec3(0.2f + uniform(), 0.2f + uniform(), 0.2f + uniform());
+			d[rng() % 3] = 0.0f;
+			shapes.push_back(Rect(p, d, albedo, 0.0f, MaterialType::LAMBERTIAN));
+		} break;
+		}
+	}
+	return shapes;
+}
+
+int main(int argc, char* argv[])
+{
+	int WIDTH = 640;
+	int HEIGHT = 360;
+	int iterations = 16;
+	int threads = int(std::thread::hardware_concurrency());
+	bool use_bvh = true;
+	std::string out = "raygl_cpu.ppm";
+	std::string scene_path = "../scenes/cornell_box.scene";
+	double budget_ms = 100.0;
+	int tile = 64;
+	ChunkOrder order = ChunkOrder::SCANLINE;
+	float converge = 0.0f;	// 0: every pixel gets --iterations samples
+	int check_bvh = 0;
+
+	for (int a = 1; a < argc; a++) {
+		if (!strcmp(argv[a], "--scene") && a + 1 < argc)
+			scene_path = argv[++a];
+		else if (!strcmp(argv[a], "--size") && a + 2 < argc) {
+			WIDTH = atoi(argv[++a]);
+			HEIGHT = atoi(argv[++a]);
+		}
+		else if (!strcmp(argv[a], "--iterations") && a + 1 < argc)
+			iterations = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--threads") && a + 1 < argc)
+			threads = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--no-bvh"))
+			use_bvh = false;
+		else if (!strcmp(argv[a], "--out") && a + 1 < argc)
+			out = argv[++a];
+		else if (!strcmp(argv[a], "--budget") && a + 1 < argc)
+			budget_ms = atof(argv[++a]);
+		else if (!strcmp(argv[a], "--tile") && a + 1 < argc)
+			tile = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--center-out"))
+			order = ChunkOrder::CENTER_OUT;
+		else if (!strcmp(argv[a], "--converge") && a + 1 < argc)
+			converge = float(atof(argv[++a]));
+		else if (!strcmp(argv[a], "--check-bvh") && a + 1 < argc)
+			check_bvh = atoi(argv[++a]);
+		else {
+			std::cout << "usage: " << argv[0] << " [--scene file] [--size W H] [--iterations N] [--threads N] [--no-bvh] [--out file.ppm]"
+				" [--budget ms] [--tile N] [--center-out] [--converge threshold] [--check-bvh N]" << std::endl;
+			return 1;
+		}
+	}
+	if (WIDTH <= 0 || HEIGHT <= 0 || iterations <= 0 || tile <= 0 || budget_ms <= 0.0) {
+		std::cout << "size, iterations, tile and budget must be positive" << std::endl;
+		return 1;
+	}
+	if (threads < 1)
+		threads = 1;
+	scene_desc scene;
+	std::string scene_error;
+	if (!read_scene_file(scene_path, scene, scene_error)) {
+		std::cout << scene_error << std::endl;
+		return 1;
+	}
+
+	// Same buffers main.cpp uploads to the GPU
+	ComputeCPU::Buffers buf;
+	buf.width = WIDTH;
+	buf.height = HEIGHT;
+	buf.image.assign(size_t(WIDTH) * HEIGHT, glm::vec4(0.0f));
+	buf.state = InitialRngState(WIDTH, HEIGHT);
+	std::vector<Shape> obj = ExportShapes(scene);
+	if (check_bvh > 0)
+		return CheckBVH(scene_path.c_str(), obj, check_bvh) | CheckBVH("+200 random shapes", AddRandomShapes(obj, 200, 1u), check_bvh) |
+			CheckBVH("+5000 random shapes", AddRandomShapes(obj, 5000, 2u), check_bvh) |
+			CheckBVH("+5000 random shapes, depth limit 6", AddRandomShapes(obj, 5000, 2u), check_bvh, 6);
+	if (use_bvh) {
+		ShapeBVHStats bvh_stats = ShapeBVHBuilder().Build(obj, buf.bvh_nodes, buf.objects);
+		std::cout << "BVH: " << obj.size() << " objects, " << bvh_stats.nodes << " nodes, depth " << bvh_stats.max_depth << std::endl;
+	}
+	else
+		buf.objects = obj;
+	Camera cam = ExportCamera(scene, (float)WIDTH / (float)HEIGHT);
+	buf.cam = ComputeCPU::LoadCamera(cam);
+
+	ChunkScheduler scheduler(WIDTH, HEIGHT, tile, budget_ms * 1e-3, iterations, order);
+	if (converge > 0.0f)
+		scheduler.SetConvergence(converge, 8);
+
+	// Mean luminance of every tile a dispatch touched, for convergence tracking
+	auto report_means = [&](const ChunkDispatch& d) {
+		for (int ty = d.y / tile; ty * tile < d.y + d.height; ty++)
+			for (int tx = d.x / tile; tx * tile < d.x + d.width; tx++) {
+				int x1 = std::min(WIDTH, (tx + 1) * tile), y1 = std::min(HEIGHT, (ty + 1) * tile);
+				double sum = 0.0;
+				for (int y = ty * tile; y < y1; y++)
+					for (int x = tx * tile; x < x1; x++)
+						sum += glm::dot(glm::vec3(buf.image[size_t(y) * WIDTH + x]), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+				scheduler.ReportTileMean(tx, ty, float(sum / (double(x1 - tx * tile) * (y1 - ty * tile))));
+			}
+	};
+
+	uint64_t rays = 0;
+	double paths = 0.0;
+	int shown_pass = -1;
+	ChunkDispatch d;
+	auto start = std::chrono::steady_clock::now();
+	while (scheduler.Next(d)) {
+		auto t0 = std::chrono::steady_clock::now();
+		rays += ComputeCPU::Dispatch(buf, d.iteration, glm::ivec2(d.x, d.y), glm::ivec2(d.width, d.height), threads);
+		scheduler.Complete(d, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+		paths += double(d.width) * d.height;
+		if (converge > 0.0f)
+			report_means(d);
+		if (d.pass != shown_pass) {
+			shown_pass = d.pass;
+			double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "Pass: " << std::setw(4) << d.pass + 1 << " active tiles: " << std::setw(5) << scheduler.ActiveTiles()
+				<< " dispatches: " << std::setw(6) << scheduler.Dispatches() << " time: " << std::setw(7) << time << "\t\t\t\r" << std::flush;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << std::endl << threads << " threads, " << seconds << " s, " << scheduler.Dispatches() << " dispatches, "
+		<< paths / seconds * 1e-6 << " Mpaths/s, " << rays / seconds * 1e-6 << " Mrays/s, " << rays / paths << " rays/path, "
+		<< scheduler.MinIteration() << " samples per pixel at least" << std::endl;
+
+	if (!WritePPM(out, WIDTH, HEIGHT, buf.image)) {
+		std::cout << "cannot write " << out << std::endl;
+		return 1;
+	}
+	glm::dvec3 sum(0.0);
+	for (const glm::vec4& c : buf.image)
+		sum += glm::dvec3(glm::vec3(c));
+	sum /= double(WIDTH) * HEIGHT;
+	std::cout << "mean " << sum.r << " " << sum.g << " " << sum.b << " -> " << out << std::endl;
+	return 0;
+}
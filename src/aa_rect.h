@@ -6,15 +6,25 @@
 #define RAYTRACE_AA_RECT_H
 
 #include "hitable.h"
+#include "sampler.h"
+#include "material.h"
+#include "distribution.h"
 
 class xy_rect : public hitable
 {
 public:
 	xy_rect(){}
-	xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material *mat) : x0(_x0), x1(_x1), y0(_y0), y1(_y1),
+	xy_rect(real _x0, real _x1, real _y0, real _y1, real _k, material *mat) : x0(_x0), x1(_x1), y0(_y0), y1(_y1),
 																				   k(_k), mp(mat){};
 
-	virtual bool hit(const ray &r, float t0, float t1, hit_record &rec) const;
+	virtual bool hit(const ray &r, real t0, real t1, hit_record &rec) const;
+	virtual real pdf_value(const vec3 &o, const vec3 &v) const;
+	virtual vec3 random(const vec3 &o) const;
+	virtual bool emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const;
+	virtual bool tabulate_emission(int res, real &power);
+
+	virtual void bind_materials(material_binder &binder)
+	{ mat_id = binder.bind(mp); }
 
 	virtual bool bounding_box(float t0, float t1, aabb &box) const
 	{
@@ -23,17 +33,26 @@ public:
 	}
 
 	material *mp;
-	float x0, x1, y0, y1, k;
+	int mat_id = -1;
+	real x0, x1, y0, y1, k;
+	distribution_2d *emit_dist = nullptr;//tabulate_emission()得到的发光分布，为空时按面积均匀取点
 };
 
 class xz_rect : public hitable
 {
 public:
 	xz_rect(){}
-	xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material *mat) : x0(_x0), x1(_x1), z0(_z0), z1(_z1),
+	xz_rect(real _x0, real _x1, real _z0, real _z1, real _k, material *mat) : x0(_x0), x1(_x1), z0(_z0), z1(_z1),
 																				   k(_k), mp(mat){}
 
-	virtual bool hit(const ray &r, float t0, float t1, hit_record &rec) const;
+	virtual bool hit(const ray &r, real t0, real t1, hit_record &rec) const;
+	virtual real pdf_value(const vec3 &o, const vec3 &v) const;
+	virtual vec3 random(const vec3 &o) const;
+	virtual bool emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const;
+	virtual bool tabulate_emission(int res, real &power);
+
+	virtual void bind_materials(material_binder &binder)
+	{ mat_id = binder.bind(mp); }
 
 	virtual bool bounding_box(float t0, float t1, aabb &box) const
 	{
@@ -42,17 +61,26 @@ public:
 	}
 
 	material *mp;
-	float x0, x1, z0, z1, k;
+	int mat_id = -1;
+	real x0, x1, z0, z1, k;
+	distribution_2d *emit_dist = nullptr;//tabulate_emission()得到的发光分布，为空时按面积均匀取点
 };
 
 class yz_rect : public hitable
 {
 public:
 	yz_rect(){}
-	yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material *mat) : y0(_y0), y1(_y1), z0(_z0), z1(_z1),
+	yz_rect(real _y0, real _y1, real _z0, real _z1, real _k, material *mat) : y0(_y0), y1(_y1), z0(_z0), z1(_z1),
 																				   k(_k), mp(mat){};
 
-	virtual bool hit(const ray &r, float t0, float t1, hit_record &rec) const;
+	virtual bool hit(const ray &r, real t0, real t1, hit_record &rec) const;
+	virtual real pdf_value(const vec3 &o, const vec3 &v) const;
+	virtual vec3 random(const vec3 &o) const;
+	virtual bool emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const;
+	virtual bool tabulate_emission(int res, real &power);
+
+	virtual void bind_materials(material_binder &binder)
+	{ mat_id = binder.bind(mp); }
 
 	virtual bool bounding_box(float t0, float t1, aabb &box) const
 	{
@@ -61,61 +89,186 @@ public:
 	}
 
 	material *mp;
-	float y0, y1, z0, z1, k;
+	int mat_id = -1;
+	real y0, y1, z0, z1, k;
+	distribution_2d *emit_dist = nullptr;//tabulate_emission()得到的发光分布，为空时按面积均匀取点
 };
 
-bool xy_rect::hit(const ray &r, float t0, float t1, hit_record &rec) const
+bool xy_rect::hit(const ray &r, real t0, real t1, hit_record &rec) const
 {
-	float t = (k - r.origin().z()) / r.direction().z();//通过k计算得到t值，并且判断合理性
+	real t = (k - r.origin().z()) / r.direction().z();//通过k计算得到t值，并且判断合理性
 	if (t < t0 || t > t1)
 		return false;
-	float x = r.origin().x() + t * r.direction().x();//计算得到x和y并判断合理性
-	float y = r.origin().y() + t * r.direction().y();
+	real x = r.origin().x() + t * r.direction().x();//计算得到x和y并判断合理性
+	real y = r.origin().y() + t * r.direction().y();
 	if (x < x0 || x > x1 || y < y0 || y > y1)
 		return false;
 	rec.u = (x - x0) / (x1 - x0);//得到光线击中点在矩形表面的uv值
 	rec.v = (y - y0) / (y1 - y0);
 	rec.t = t;
 	rec.mat_ptr = mp;//材质绑定
+	rec.mat_id = mat_id;
+	rec.prim = this;
 	rec.p = r.point_at_parameter(t);//击中点的光线常数：(A+tB)的值
 	rec.normal = vec3(0, 0, 1);//因为是xy平面，必定与z轴垂直，所以z = 1即是法线方向
 	return true;
 }
 
-bool xz_rect::hit(const ray &r, float t0, float t1, hit_record &rec) const
+bool xz_rect::hit(const ray &r, real t0, real t1, hit_record &rec) const
 {
-	float t = (k - r.origin().y()) / r.direction().y();
+	real t = (k - r.origin().y()) / r.direction().y();
 	if (t < t0 || t > t1)
 		return false;
-	float x = r.origin().x() + t * r.direction().x();
-	float z = r.origin().z() + t * r.direction().z();
+	real x = r.origin().x() + t * r.direction().x();
+	real z = r.origin().z() + t * r.direction().z();
 	if (x < x0 || x > x1 || z < z0 || z > z1)
 		return false;
 	rec.u = (x - x0) / (x1 - x0);
 	rec.v = (z - z0) / (z1 - z0);
 	rec.t = t;
 	rec.mat_ptr = mp;
+	rec.mat_id = mat_id;
+	rec.prim = this;
 	rec.p = r.point_at_parameter(t);
 	rec.normal = vec3(0, 1, 0);
 	return true;
 }
 
-bool yz_rect::hit(const ray &r, float t0, float t1, hit_record &rec) const
+bool yz_rect::hit(const ray &r, real t0, real t1, hit_record &rec) const
 {
-	float t = (k - r.origin().x()) / r.direction().x();
+	real t = (k - r.origin().x()) / r.direction().x();
 	if (t < t0 || t > t1)
 		return false;
-	float y = r.origin().y() + t * r.direction().y();
-	float z = r.origin().z() + t * r.direction().z();
+	real y = r.origin().y() + t * r.direction().y();
+	real z = r.origin().z() + t * r.direction().z();
 	if (y < y0 || y > y1 || z < z0 || z > z1)
 		return false;
 	rec.u = (y - y0) / (y1 - y0);
 	rec.v = (z - z0) / (z1 - z0);
 	rec.t = t;
 	rec.mat_ptr = mp;
+	rec.mat_id = mat_id;
+	rec.prim = this;
 	rec.p = r.point_at_parameter(t);
 	rec.normal = vec3(1, 0, 0);
 	return true;
 }
 
+//矩形上按面积均匀（有emit_dist时按发光功率）取点，面积pdf换算成立体角：距离^2 / (|cos| * 面积)
+real xy_rect::pdf_value(const vec3 &o, const vec3 &v) const
+{
+	hit_record rec;
+	if (!hit(ray(o, v), ray_epsilon, FLT_MAX, rec))
+		return 0;
+	real area = (x1 - x0) * (y1 - y0);
+	real distance_squared = rec.t * rec.t * v.squared_length();
+	real cosine = fabs(v.z()) / v.length();
+	return distance_squared * (emit_dist ? emit_dist->pdf(rec.u, rec.v) : 1) / (cosine * area);
+}
+
+vec3 xy_rect::random(const vec3 &o) const
+{
+	float a, b;
+	sample_uv(emit_dist, a, b);
+	return vec3(x0 + a * (x1 - x0), y0 + b * (y1 - y0), k) - o;
+}
+
+bool xy_rect::emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const
+{
+	area = (x1 - x0) * (y1 - y0);
+	axis = vec3(0, 0, 1);
+	theta_o = 0;
+	two_sided = true;//diffuse_light不区分正反面
+	return true;
+}
+
+//矩形上按面积均匀（有emit_dist时按发光功率）取点，面积pdf换算成立体角：距离^2 / (|cos| * 面积)
+real xz_rect::pdf_value(const vec3 &o, const vec3 &v) const
+{
+	hit_record rec;
+	if (!hit(ray(o, v), ray_epsilon, FLT_MAX, rec))
+		return 0;
+	real area = (x1 - x0) * (z1 - z0);
+	real distance_squared = rec.t * rec.t * v.squared_length();
+	real cosine = fabs(v.y()) / v.length();
+	return distance_squared * (emit_dist ? emit_dist->pdf(rec.u, rec.v) : 1) / (cosine * area);
+}
+
+vec3 xz_rect::random(const vec3 &o) const
+{
+	float a, b;
+	sample_uv(emit_dist, a, b);
+	return vec3(x0 + a * (x1 - x0), k, z0 + b * (z1 - z0)) - o;
+}
+
+bool xz_rect::emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const
+{
+	area = (x1 - x0) * (z1 - z0);
+	axis = vec3(0, 1, 0);
+	theta_o = 0;
+	two_sided = true;//diffuse_light不区分正反面
+	return true;
+}
+
+//矩形上按面积均匀（有emit_dist时按发光功率）取点，面积pdf换算成立体角：距离^2 / (|cos| * 面积)
+real yz_rect::pdf_value(const vec3 &o, const vec3 &v) const
+{
+	hit_record rec;
+	if (!hit(ray(o, v), ray_epsilon, FLT_MAX, rec))
+		return 0;
+	real area = (y1 - y0) * (z1 - z0);
+	real distance_squared = rec.t * rec.t * v.squared_length();
+	real cosine = fabs(v.x()) / v.length();
+	return distance_squared * (emit_dist ? emit_dist->pdf(rec.u, rec.v) : 1) / (cosine * area);
+}
+
+vec3 yz_rect::random(const vec3 &o) const
+{
+	float a, b;
+	sample_uv(emit_dist, a, b);
+	return vec3(k, y0 + a * (y1 - y0), z0 + b * (z1 - z0)) - o;
+}
+
+bool yz_rect::emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const
+{
+	area = (y1 - y0) * (z1 - z0);
+	axis = vec3(1, 0, 0);
+	theta_o = 0;
+	two_sided = true;//diffuse_light不区分正反面
+	return true;
+}
+
+bool xy_rect::tabulate_emission(int res, real &power)
+{
+	real area = (x1 - x0) * (y1 - y0);
+	delete emit_dist;
+	emit_dist = tabulate_surface_emission(res, [&](float u, float v, real &jacobian) {
+		jacobian = area;
+		return luminance(mp->emitted(u, v, vec3(x0 + u * (x1 - x0), y0 + v * (y1 - y0), k)));
+	}, power);
+	return emit_dist != nullptr;
+}
+
+bool xz_rect::tabulate_emission(int res, real &power)
+{
+	real area = (x1 - x0) * (z1 - z0);
+	delete emit_dist;
+	emit_dist = tabulate_surface_emission(res, [&](float u, float v, real &jacobian) {
+		jacobian = area;
+		return luminance(mp->emitted(u, v, vec3(x0 + u * (x1 - x0), k, z0 + v * (z1 - z0))));
+	}, power);
+	return emit_dist != nullptr;
+}
+
+bool yz_rect::tabulate_emission(int res, real &power)
+{
+	real area = (y1 - y0) * (z1 - z0);
+	delete emit_dist;
+	emit_dist = tabulate_surface_emission(res, [&](float u, float v, real &jacobian) {
+		jacobian = area;
+		return luminance(mp->emitted(u, v, vec3(k, y0 + u * (y1 - y0), z0 + v * (z1 - z0))));
+	}, power);
+	return emit_dist != nullptr;
+}
+
 #endif //RAYTRACE_AA_RECT_H
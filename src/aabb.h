@@ -7,24 +7,28 @@
 #include "rays.h"
 #include "hitable.h"
 
-inline float ffmin(float a, float b) { return a < b ? a : b; }
-inline float ffmax(float a, float b) { return a > b ? a : b; }
+//两个参数类型可以不同（float和double混用），返回两者的公共类型
+template<typename A, typename B>
+inline auto ffmin(A a, B b) -> decltype(a + b) { return a < b ? a : b; }
+template<typename A, typename B>
+inline auto ffmax(A a, B b) -> decltype(a + b) { return a > b ? a : b; }
 
-class aabb {
+template<typename T>
+class aabb_t {
 public:
-	aabb() {}
-	aabb(const vec3& a, const vec3& b) { _min = a; _max = b;}
+	aabb_t() {}
+	aabb_t(const vec3_t<T>& a, const vec3_t<T>& b) { _min = a; _max = b;}
 
-	vec3 min() const {return _min; }
-	vec3 max() const {return _max; }
+	vec3_t<T> min() const {return _min; }
+	vec3_t<T> max() const {return _max; }
 
-	bool hit(const ray& r, float tmin, float tmax) const {
+	bool hit(const ray_t<T>& r, T tmin, T tmax) const {
 		for (int a = 0; a < 3; a++) //分别针对xyz三个方向进行判定，找到光线与box相交的两个t
 		{
-			float t0 = ffmin((_min[a] - r.origin()[a]) / r.direction()[a],
-							 (_max[a] - r.origin()[a]) / r.direction()[a]);
-			float t1 = ffmax((_min[a] - r.origin()[a]) / r.direction()[a],
-							 (_max[a] - r.origin()[a]) / r.direction()[a]);
+			T t0 = ffmin((_min[a] - r.origin()[a]) / r.direction()[a],
+						 (_max[a] - r.origin()[a]) / r.direction()[a]);
+			T t1 = ffmax((_min[a] - r.origin()[a]) / r.direction()[a],
+						 (_max[a] - r.origin()[a]) / r.direction()[a]);
 			tmin = ffmax(t0, tmin);
 			tmax = ffmin(t1, tmax);
 			if (tmax <= tmin)
@@ -33,12 +37,20 @@ public:
 		return true;
 	}
 
+	//盒子的表面积，用于SAH代价估计
+	T area() const {
+		vec3_t<T> d = _max - _min;
+		return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+	}
+
 private:
 	//可以想象成一个是盒子左下角，一个是盒子右上角
-	vec3 _min;//最小顶点
-	vec3 _max;//最大顶点
+	vec3_t<T> _min;//最小顶点
+	vec3_t<T> _max;//最大顶点
 };
 
+typedef aabb_t<real> aabb;
+
 //把两个box拼起来组成一个大的box
 aabb surrounding_box(aabb box0, aabb box1) {
 	vec3 small( fmin(box0.min().x(), box1.min().x()),
@@ -0,0 +1,92 @@
+//合并按样本切分渲染的累加文件：检查各文件属于同一帧（尺寸、总样本数、scene_hash相同）
+//且样本范围互不重叠，逐像素加起来除以样本数，做gamma后写成ppm
+//用法：accmerge <输出.ppm> <a.acc> <b.acc> ...
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <math.h>
+#include "accum_file.h"
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: accmerge <output.ppm> <input.acc>...\n";
+		return 1;
+	}
+
+	struct part
+	{
+		std::string path;
+		accum_header header;
+	};
+	std::vector<part> parts;
+	std::vector<accum_pixel> sum, pixels;
+	for (int a = 2; a < argc; a++)
+	{
+		part p;
+		p.path = argv[a];
+		std::string error;
+		if (!read_accum_file(p.path, p.header, pixels, error))
+		{
+			std::cerr << p.path << ": " << error << "\n";
+			return 1;
+		}
+		if (!parts.empty())
+		{
+			const accum_header &first = parts[0].header;
+			if (p.header.nx != first.nx || p.header.ny != first.ny || p.header.spp != first.spp ||
+				p.header.scene_hash != first.scene_hash)
+			{
+				std::cerr << p.path << ": different frame from " << parts[0].path << " (size " << p.header.nx << "x"
+						  << p.header.ny << " spp " << p.header.spp << " vs " << first.nx << "x" << first.ny << " spp "
+						  << first.spp << ", or different scene)\n";
+				return 1;
+			}
+		}
+		else
+			sum.assign(pixels.size(), {0, 0, 0, 0});
+		for (size_t k = 0; k < pixels.size(); k++)
+		{
+			sum[k].r += pixels[k].r;
+			sum[k].g += pixels[k].g;
+			sum[k].b += pixels[k].b;
+			sum[k].count += pixels[k].count;
+		}
+		parts.push_back(p);
+	}
+
+	//样本范围按起点排序后，相邻两段不能重叠，否则同一批样本会被算两次
+	std::sort(parts.begin(), parts.end(), [](const part &a, const part &b) { return a.header.s0 < b.header.s0; });
+	uint32_t covered = 0;
+	for (size_t k = 0; k < parts.size(); k++)
+	{
+		const accum_header &h = parts[k].header;
+		if (k > 0 && h.s0 < parts[k - 1].header.s1)
+		{
+			std::cerr << "sample ranges overlap: " << parts[k - 1].path << " [" << parts[k - 1].header.s0 << ", "
+					  << parts[k - 1].header.s1 << ") and " << parts[k].path << " [" << h.s0 << ", " << h.s1 << ")\n";
+			return 1;
+		}
+		covered += h.s1 - h.s0;
+	}
+
+	const accum_header &h = parts[0].header;
+	std::ofstream file(argv[1]);
+	file << "P3\n" << h.nx << " " << h.ny << "\n255\n";
+	for (const accum_pixel &p : sum)
+	{
+		float n = p.count > 0 ? float(p.count) : 1.0f;
+		file << int(255.99 * sqrt(p.r / n)) << " " << int(255.99 * sqrt(p.g / n)) << " " << int(255.99 * sqrt(p.b / n))
+			 << "\n";
+	}
+	if (!file)
+	{
+		std::cerr << "cannot write " << argv[1] << "\n";
+		return 1;
+	}
+	std::cerr << parts.size() << " files, " << covered << "/" << h.spp << " samples per pixel -> " << argv[1] << "\n";
+	if (covered < h.spp)
+		std::cerr << "note: sample ranges do not cover the whole frame\n";
+	return 0;
+}
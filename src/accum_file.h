@@ -0,0 +1,103 @@
+#ifndef RAYTRACE_ACCUM_FILE_H
+#define RAYTRACE_ACCUM_FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+//累加文件（.acc）：一帧画面中一段样本[s0, s1)的结果，每个像素存线性颜色之和与样本数，
+//没有除以样本数，也没有做gamma。同一帧按样本切成几段分给不同的机器/进程渲染，
+//再用accmerge把这些文件加起来得到最终画面。像素按ppm的行序（从上往下）排列
+struct accum_header
+{
+	char magic[4];//"RACC"
+	uint32_t version;//1
+	uint32_t nx, ny;
+	uint32_t spp;//整帧的样本数，各段的s1不超过它
+	uint32_t s0, s1;//本文件包含的样本范围[s0, s1)
+	uint32_t reserved;
+	uint64_t scene_hash;//场景、采样器等影响结果的设置的哈希，只有相同的文件才能合并
+};
+
+struct accum_pixel
+{
+	float r, g, b;
+	uint32_t count;
+};
+
+//FNV-1a，用于由场景描述字符串得到scene_hash
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t h = 0xcbf29ce484222325ULL)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+inline uint64_t fnv1a(const std::string &s)
+{ return fnv1a(s.data(), s.size()); }
+
+//文件内容的FNV-1a，用来把场景文件、体积文件这类输入的内容（而不只是路径）计入scene_hash；读不了时为0
+inline uint64_t fnv1a_file(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return 0;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	char buf[1 << 16];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		h = fnv1a(buf, n, h);
+	fclose(f);
+	return h;
+}
+
+inline accum_header make_accum_header(int nx, int ny, int spp, int s0, int s1, uint64_t scene_hash)
+{
+	accum_header h = {{'R', 'A', 'C', 'C'}, 1, uint32_t(nx), uint32_t(ny), uint32_t(spp), uint32_t(s0), uint32_t(s1),
+					  0, scene_hash};
+	return h;
+}
+
+bool write_accum_file(const std::string &path, const accum_header &header, const std::vector<accum_pixel> &pixels)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(pixels.data(), sizeof(accum_pixel), pixels.size(), f);
+	bool ok = !ferror(f);
+	return fclose(f) == 0 && ok;
+}
+
+//读入累加文件并检查头部；失败时error说明原因
+bool read_accum_file(const std::string &path, accum_header &header, std::vector<accum_pixel> &pixels,
+					 std::string &error)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+	{
+		error = "cannot open";
+		return false;
+	}
+	bool ok = fread(&header, sizeof(header), 1, f) == 1;
+	if (!ok || memcmp(header.magic, "RACC", 4) != 0 || header.version != 1)
+		error = "not an accumulation file";
+	else if (header.s0 >= header.s1 || header.s1 > header.spp)
+		error = "bad sample range";
+	else
+	{
+		pixels.resize(size_t(header.nx) * header.ny);
+		if (fread(pixels.data(), sizeof(accum_pixel), pixels.size(), f) != pixels.size())
+			error = "truncated";
+	}
+	fclose(f);
+	return error.empty();
+}
+
+#endif //RAYTRACE_ACCUM_FILE_H
@@ -0,0 +1,142 @@
+#ifndef RAYTRACE_ANIMATION_H
+#define RAYTRACE_ANIMATION_H
+
+#include <vector>
+#include "hitable.h"
+#include "camera.h"
+
+//关键帧上物体的平移量
+struct object_keyframe
+{
+	float time;
+	vec3 offset;
+};
+
+//按关键帧做平移动画的物体，和translate一样是通过反向移动光线来实现的
+class keyframed : public hitable
+{
+public:
+	keyframed(hitable *p, const std::vector<object_keyframe> &keys) : ptr(p), keyframes(keys), offset(0, 0, 0)
+	{ set_time(0); }
+
+	virtual bool hit(const ray &r, real t_min, real t_max, hit_record &rec) const;
+	virtual bool bounding_box(float t0, float t1, aabb &box) const;
+	virtual void bind_materials(material_binder &binder)
+	{ ptr->bind_materials(binder); }
+
+	//在相邻两个关键帧之间线性插值得到当前帧的平移量
+	void set_time(float time);
+
+private:
+	hitable *ptr;
+	std::vector<object_keyframe> keyframes;
+	vec3 offset;
+};
+
+void keyframed::set_time(float time)
+{
+	if (keyframes.empty())
+		return;
+	if (time <= keyframes.front().time)
+	{
+		offset = keyframes.front().offset;
+		return;
+	}
+	for (size_t i = 1; i < keyframes.size(); i++)
+	{
+		if (time <= keyframes[i].time)
+		{
+			const object_keyframe &a = keyframes[i - 1];
+			const object_keyframe &b = keyframes[i];
+			float s = (time - a.time) / (b.time - a.time);
+			offset = (1 - s) * a.offset + s * b.offset;
+			return;
+		}
+	}
+	offset = keyframes.back().offset;
+}
+
+bool keyframed::hit(const ray &r, real t_min, real t_max, hit_record &rec) const
+{
+	ray moved_r(r.origin() - offset, r.direction(), r.time());
+	if (ptr->hit(moved_r, t_min, t_max, rec))
+	{
+		rec.p += offset;
+		return true;
+	}
+	else
+		return false;
+}
+
+bool keyframed::bounding_box(float t0, float t1, aabb &box) const
+{
+	if (ptr->bounding_box(t0, t1, box))
+	{
+		box = aabb(box.min() + offset, box.max() + offset);
+		return true;
+	}
+	else
+		return false;
+}
+
+//相机路径上的一个关键帧
+struct camera_keyframe
+{
+	float time;
+	vec3 lookfrom;
+	vec3 lookat;
+};
+
+class camera_path
+{
+public:
+	camera_path() {}
+	camera_path(const std::vector<camera_keyframe> &keys) : keyframes(keys) {}
+
+	//绕center一周的转台路径，frames帧后回到起点
+	static camera_path orbit(const vec3 &center, float radius, float height, int frames);
+
+	//在time时刻插值得到lookfrom和lookat
+	void at(float time, vec3 &lookfrom, vec3 &lookat) const;
+
+	std::vector<camera_keyframe> keyframes;
+};
+
+camera_path camera_path::orbit(const vec3 &center, float radius, float height, int frames)
+{
+	//每帧一个关键帧，保证插值出来的路径仍然是圆周
+	std::vector<camera_keyframe> keys;
+	for (int i = 0; i <= frames; i++)
+	{
+		float phi = 2 * M_PI * i / frames;
+		vec3 from = center + vec3(radius * sin(phi), height, radius * cos(phi));
+		keys.push_back({float(i), from, center});
+	}
+	return camera_path(keys);
+}
+
+void camera_path::at(float time, vec3 &lookfrom, vec3 &lookat) const
+{
+	if (time <= keyframes.front().time)
+	{
+		lookfrom = keyframes.front().lookfrom;
+		lookat = keyframes.front().lookat;
+		return;
+	}
+	for (size_t i = 1; i < keyframes.size(); i++)
+	{
+		if (time <= keyframes[i].time)
+		{
+			const camera_keyframe &a = keyframes[i - 1];
+			const camera_keyframe &b = keyframes[i];
+			float s = (time - a.time) / (b.time - a.time);
+			lookfrom = (1 - s) * a.lookfrom + s * b.lookfrom;
+			lookat = (1 - s) * a.lookat + s * b.lookat;
+			return;
+		}
+	}
+	lookfrom = keyframes.back().lookfrom;
+	lookat = keyframes.back().lookat;
+}
+
+#endif //RAYTRACE_ANIMATION_H
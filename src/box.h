@@ -7,17 +7,21 @@
 
 #include "aa_rect.h"
 #include "hitable_list.h"
+#include <utility>
 
 class box: public hitable  {
 public:
 	box() = default;
 	box(const vec3& p0, const vec3& p1, material *ptr);//p0:左下角顶点，p1:右上角顶点
-	virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+	virtual bool hit(const ray& r, real t0, real t1, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const
 	{
 		box = aabb(pmin, pmax);
 		return true;
 	}
+	virtual bool hit_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const;
+	virtual void bind_materials(material_binder &binder)
+	{ list_ptr->bind_materials(binder); }
 
 private:
 	vec3 pmin, pmax;
@@ -38,8 +42,25 @@ box::box(const vec3& p0, const vec3& p1, material *ptr) {
 	list_ptr = new hitable_list(list, 6);
 }
 
-bool box::hit(const ray& r, float t0, float t1, hit_record& rec) const {
+bool box::hit(const ray& r, real t0, real t1, hit_record& rec) const {
 	return list_ptr->hit(r, t0, t1, rec);
 }
 
+//slab法一次得到进出盒子的t，不必分别与6个面求交
+bool box::hit_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const {
+	real t0 = -FLT_MAX, t1 = FLT_MAX;
+	for (int a = 0; a < 3; a++)
+	{
+		real inv = 1 / r.direction()[a];
+		real near = (pmin[a] - r.origin()[a]) * inv;
+		real far = (pmax[a] - r.origin()[a]) * inv;
+		if (inv < 0)
+			std::swap(near, far);
+		//分量为0且起点在slab面上时是NaN，放在前面让比较落到另一边，忽略这个轴
+		t0 = ffmax(near, t0);
+		t1 = ffmin(far, t1);
+	}
+	return clip_interval(t0, t1, t_min, t_max, t_enter, t_exit);
+}
+
 #endif //RAYTRACE_BOX_H
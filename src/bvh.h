@@ -11,10 +11,25 @@ class bvh_node : public hitable {
 public:
 	bvh_node() {}
 	bvh_node(hitable **l, int n, float time0, float time1);
-	virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+	virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
+	virtual void bind_materials(material_binder &binder)
+	{
+		left->bind_materials(binder);
+		right->bind_materials(binder);
+	}
+
+	//物体移动后自底向上重新计算各节点的包围盒，不改变树的拓扑结构
+	void refit(float time0, float time1);
+	//以根节点表面积归一化的SAH代价，用来判断refit之后树的质量是否退化
+	float sah_cost() const;
+	//释放整棵树的内部节点（叶子上的物体不归bvh管理）
+	static void destroy(hitable *node);
 
 private:
+	friend struct ray_packet;
+	float sah_area_cost() const;
+
 	hitable *left;
 	hitable *right;
 	aabb box;
@@ -25,7 +40,7 @@ bool bvh_node::bounding_box(float t0, float t1, aabb& b) const {
 	return true;
 }
 
-bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
 	if (box.hit(r, t_min, t_max)) {
 		hit_record left_rec, right_rec;
 		bool hit_left = left->hit(r, t_min, t_max, left_rec);
@@ -52,6 +67,50 @@ bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	else return false;
 }
 
+void bvh_node::refit(float time0, float time1) {
+	aabb box_left, box_right;
+	if (auto *l = dynamic_cast<bvh_node *>(left))
+		l->refit(time0, time1);
+	if (right != left)
+		if (auto *r = dynamic_cast<bvh_node *>(right))
+			r->refit(time0, time1);
+	if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
+		std::cerr << "no bounding box in bvh_node::refit\n";
+	box = surrounding_box(box_left, box_right);
+}
+
+//遍历一个内部节点的代价记为1，与一个叶子物体求交的代价记为1，都按表面积加权
+float bvh_node::sah_area_cost() const {
+	float cost = box.area();
+	const hitable *children[2] = {left, right};
+	for (int i = 0; i < (left == right ? 1 : 2); i++)
+	{
+		if (auto *node = dynamic_cast<const bvh_node *>(children[i]))
+			cost += node->sah_area_cost();
+		else
+		{
+			aabb leaf_box;
+			if (children[i]->bounding_box(0, 0, leaf_box))
+				cost += leaf_box.area();
+		}
+	}
+	return cost;
+}
+
+float bvh_node::sah_cost() const {
+	float root_area = box.area();
+	return root_area > 0 ? sah_area_cost() / root_area : 0;
+}
+
+void bvh_node::destroy(hitable *node) {
+	auto *n = dynamic_cast<bvh_node *>(node);
+	if (!n)
+		return;
+	destroy(n->left);
+	if (n->right != n->left)
+		destroy(n->right);
+	delete n;
+}
 
 int box_x_compare(const void *a, const void *b)
 {
@@ -5,15 +5,7 @@
 #ifndef RAYTRACE_CAMERA_H
 #define RAYTRACE_CAMERA_H
 #include "rays.h"
-
-vec3 random_in_unit_disk(){
-	vec3 p;
-	do
-	{
-		p = 2.0 * vec3(drand48(), drand48(), 0) - vec3(1, 1, 0);
-	} while (dot(p, p) >= 1.0);
-	return p;
-}
+#include "sampling.h"
 
 class camera{
 public:
@@ -45,8 +37,19 @@ public:
 	{
 		vec3 rd = lens_radius * random_in_unit_disk();
 		vec3 offset = u * rd.x() + v * rd.y();
-		float time = time0 + drand48() * (time1 - time0);//使得随机在[time0,time1)的时间段内产生一条光线
-		return ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, time);
+		float time = time0 + sample_1d() * (time1 - time0);//使得随机在[time0,time1)的时间段内产生一条光线
+		vec3 dir = lower_left_corner + s * horizontal + t * vertical - origin - offset;
+		ray r(origin + offset, dir, time);
+		if (ds > 0)//相邻像素的光线共用同一个透镜采样点
+			r.set_differentials(origin + offset, dir + ds * horizontal, origin + offset, dir + dt * vertical);
+		return r;
+	}
+
+	//设置画面分辨率后get_ray会带上光线微分
+	void set_resolution(int nx, int ny)
+	{
+		ds = 1.0f / nx;
+		dt = 1.0f / ny;
 	}
 
 private:
@@ -58,6 +61,7 @@ private:
 	float time0, time1;
 
 	float lens_radius;
+	float ds = 0, dt = 0;//一个像素在s、t上的跨度，0表示不生成光线微分
 };
 
 #endif //RAYTRACE_CAMERA_H
@@ -0,0 +1,134 @@
+#ifndef RAYTRACE_CONSTANT_MEDIUM_H
+#define RAYTRACE_CONSTANT_MEDIUM_H
+
+#include "hitable.h"
+#include "material.h"
+#include "texture.h"
+#include "sampler.h"
+
+//各向同性的相函数：散射方向在整个球面上均匀分布，与入射方向无关
+class isotropic : public material
+{
+public:
+	isotropic(texture *a) : albedo(a) {}
+
+	virtual bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
+	{
+		scattered = ray(rec.p, random_unit_vector(), r_in.time());
+		attenuation = albedo->value(rec.u, rec.v, rec.p);
+		return true;
+	}
+
+	virtual bool eval(const ray &r_in, const hit_record &rec, const vec3 &wi, vec3 &f_cos, float &pdf) const
+	{
+		pdf = 1 / (4 * M_PI);
+		f_cos = albedo->value(rec.u, rec.v, rec.p) * pdf;
+		return true;
+	}
+
+	virtual bool one_sided() const
+	{ return false; }
+
+private:
+	friend class material_table;
+	texture *albedo;
+};
+
+//指数分布的自由程：密度为sigma的介质中下一次碰撞的距离（按世界空间长度）
+inline real sample_free_flight(real sigma)
+{ return -log(1 - sample_1d()) / sigma; }
+
+//参与介质。hit()用delta tracking随机地取一个真实碰撞点，散射光线用它；
+//transmittance()是光线在(t_min, t_max)内穿过介质不发生碰撞的概率，阴影光线用它连乘，不需要取碰撞点
+class medium : public hitable
+{
+public:
+	virtual real transmittance(const ray &r, real t_min, real t_max) const = 0;
+};
+
+//以一个封闭凸边界（球、盒子，可以再经过translate/rotate_y）为外形的参与介质（雾、烟）。
+//边界只求一次进出区间（hitable::hit_interval），然后在区间内采样碰撞点：
+//  均匀密度时直接按指数分布取自由程；
+//  非均匀密度（density_tex的x分量乘以density，例如noise_texture）时用delta tracking：
+//  按上界majorant取试探碰撞，以density(p)/majorant的概率接受为真实碰撞，否则是虚碰撞继续前进。
+//这样不需要按固定步长ray march，结果也没有步长带来的偏差。
+//光线起点在介质内部时区间从t_min开始，所以散射之后的光线可以继续在介质中传播
+class constant_medium : public medium
+{
+public:
+	//均匀密度
+	constant_medium(hitable *b, real d, texture *a) : boundary(b), density(d), density_tex(nullptr), phase_function(new isotropic(a))
+	{}
+
+	//非均匀密度density * density_tex(p).x()；density_tex的值应当在[0, 1]内，超出的部分按1截断
+	constant_medium(hitable *b, real max_density, texture *density_tex, texture *a)
+		: boundary(b), density(max_density), density_tex(density_tex), phase_function(new isotropic(a))
+	{}
+
+	virtual bool hit(const ray &r, real t_min, real t_max, hit_record &rec) const;
+
+	virtual bool bounding_box(float t0, float t1, aabb &box) const
+	{ return boundary->bounding_box(t0, t1, box); }
+
+	//击中介质时rec.mat_ptr只会是相函数，边界的材质用不到
+	virtual void bind_materials(material_binder &binder)
+	{ mat_id = binder.bind(phase_function); }
+
+	//非均匀密度时用ratio tracking：每个试探碰撞把透过率乘以(1 - density(p)/majorant)，是无偏的估计
+	virtual real transmittance(const ray &r, real t_min, real t_max) const;
+
+private:
+	//p点的密度相对于上界的比例，[0, 1]
+	real density_ratio(const vec3 &p) const
+	{
+		real d = density_tex->value(0, 0, p).x();
+		return d < 0 ? 0 : (d > 1 ? 1 : d);
+	}
+
+	hitable *boundary;
+	real density;//均匀密度，或非均匀时的上界
+	texture *density_tex;
+	material *phase_function;
+	int mat_id = -1;
+};
+
+bool constant_medium::hit(const ray &r, real t_min, real t_max, hit_record &rec) const
+{
+	real t0, t1;
+	if (!boundary->hit_interval(r, t_min, t_max, t0, t1))
+		return false;
+	real ray_length = r.direction().length();
+	real t = t0;
+	for (;;)
+	{
+		t += sample_free_flight(density) / ray_length;
+		if (t >= t1)
+			return false;
+		if (!density_tex || sample_1d() < density_ratio(r.point_at_parameter(t)))
+			break;
+	}
+	rec.t = t;
+	rec.p = r.point_at_parameter(t);
+	rec.normal = vec3(1, 0, 0);//介质内部没有表面，法线任意
+	rec.u = rec.v = 0;
+	rec.mat_ptr = phase_function;
+	rec.mat_id = mat_id;
+	rec.prim = this;
+	return true;
+}
+
+real constant_medium::transmittance(const ray &r, real t_min, real t_max) const
+{
+	real t0, t1;
+	if (!boundary->hit_interval(r, t_min, t_max, t0, t1))
+		return 1;
+	real ray_length = r.direction().length();
+	if (!density_tex)
+		return exp(-density * (t1 - t0) * ray_length);
+	real tr = 1;
+	for (real t = t0 + sample_free_flight(density) / ray_length; t < t1; t += sample_free_flight(density) / ray_length)
+		tr *= 1 - density_ratio(r.point_at_parameter(t));
+	return tr;
+}
+
+#endif //RAYTRACE_CONSTANT_MEDIUM_H
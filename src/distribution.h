@@ -0,0 +1,188 @@
+#ifndef RAYTRACE_DISTRIBUTION_H
+#define RAYTRACE_DISTRIBUTION_H
+
+#include <vector>
+#include <algorithm>
+#include "float.h"
+#include "aabb.h"
+#include "sampler.h"
+
+//离散分布的alias表（Vose的方法）：n个桶每个最多装两个结果，一个[0, 1)上的均匀数就能O(1)地取样。
+//u * n的整数部分选桶，小数部分和桶的阈值比较决定取桶本身还是它的alias，剩下的比例再缩放回[0, 1)，
+//可以接着当作选中结果内部的连续样本
+class alias_table
+{
+public:
+	alias_table() {}
+	explicit alias_table(const std::vector<real> &weights);
+
+	//weights全为0时取样结果是均匀的
+	int sample(float u, float &remapped) const;
+
+	real pmf(int i) const
+	{ return bins[i].p; }
+
+	size_t size() const
+	{ return bins.size(); }
+
+private:
+	struct bin
+	{
+		float q;//取桶本身的概率，否则取alias
+		int alias;
+		real p;//归一化后的概率
+	};
+	std::vector<bin> bins;
+};
+
+alias_table::alias_table(const std::vector<real> &weights) : bins(weights.size())
+{
+	int n = int(weights.size());
+	double sum = 0;
+	for (real w : weights)
+		sum += w;
+	std::vector<double> scaled(n);
+	std::vector<int> small, large;
+	for (int i = 0; i < n; i++)
+	{
+		bins[i].p = sum > 0 ? real(weights[i] / sum) : real(1) / n;
+		scaled[i] = sum > 0 ? weights[i] / sum * n : 1;
+		(scaled[i] < 1 ? small : large).push_back(i);
+	}
+	//每次拿一个不足1的桶，用一个超过1的桶把它补满，超出部分放回相应的队列
+	while (!small.empty() && !large.empty())
+	{
+		int s = small.back(), l = large.back();
+		small.pop_back();
+		large.pop_back();
+		bins[s].q = float(scaled[s]);
+		bins[s].alias = l;
+		scaled[l] -= 1 - scaled[s];
+		(scaled[l] < 1 ? small : large).push_back(l);
+	}
+	//剩下的只差舍入误差，当作恰好装满
+	for (int i : small)
+	{
+		bins[i].q = 1;
+		bins[i].alias = i;
+	}
+	for (int i : large)
+	{
+		bins[i].q = 1;
+		bins[i].alias = i;
+	}
+}
+
+int alias_table::sample(float u, float &remapped) const
+{
+	int n = int(bins.size());
+	float x = u * n;
+	int i = std::min(int(x), n - 1);
+	float f = std::min(x - i, 0x1.fffffep-1f);
+	const bin &b = bins[i];
+	if (f < b.q)
+	{
+		remapped = std::min(f / b.q, 0x1.fffffep-1f);
+		return i;
+	}
+	remapped = std::min((f - b.q) / (1 - b.q), 0x1.fffffep-1f);
+	return b.alias;
+}
+
+//[0, 1)^2上的二维分段常数分布，nu x nv个格子，格子内均匀。
+//先按每行的总和（边缘分布）选行v，再在该行内（条件分布）选列u，两步都用alias表
+class distribution_2d
+{
+public:
+	//weights按行存放，u最快
+	distribution_2d(const std::vector<real> &weights, int nu, int nv);
+
+	//取样(u, v)，pdf是相对于uv面积的密度
+	void sample(float a, float b, float &u, float &v, real &pdf) const;
+
+	real pdf(float u, float v) const;
+
+	int nu, nv;
+
+private:
+	alias_table marginal;
+	std::vector<alias_table> conditional;
+};
+
+distribution_2d::distribution_2d(const std::vector<real> &weights, int nu, int nv) : nu(nu), nv(nv)
+{
+	std::vector<real> rows(nv, 0);
+	conditional.reserve(nv);
+	for (int j = 0; j < nv; j++)
+	{
+		std::vector<real> row(weights.begin() + size_t(j) * nu, weights.begin() + size_t(j + 1) * nu);
+		for (real w : row)
+			rows[j] += w;
+		conditional.emplace_back(row);
+	}
+	marginal = alias_table(rows);
+}
+
+void distribution_2d::sample(float a, float b, float &u, float &v, real &pdf) const
+{
+	float fu, fv;
+	int j = marginal.sample(b, fv);
+	int i = conditional[j].sample(a, fu);
+	u = (i + fu) / nu;
+	v = (j + fv) / nv;
+	pdf = marginal.pmf(j) * conditional[j].pmf(i) * nu * nv;
+}
+
+real distribution_2d::pdf(float u, float v) const
+{
+	int i = std::max(0, std::min(int(u * nu), nu - 1));
+	int j = std::max(0, std::min(int(v * nv), nv - 1));
+	return marginal.pmf(j) * conditional[j].pmf(i) * nu * nv;
+}
+
+//[0, 1)^2上取一个点，dist不为空时按它的分布
+inline void sample_uv(const distribution_2d *dist, float &u, float &v)
+{
+	sample_2d(u, v);
+	if (dist)
+	{
+		real pdf;
+		dist->sample(u, v, u, v, pdf);
+	}
+}
+
+inline real luminance(const vec3 &c)
+{ return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z(); }
+
+//把表面上的发光按uv制表：res x res个格子，每个格子取2x2个点，
+//权重 = 发光的亮度 * 面积元dA / (du dv)，即格子的功率。
+//radiance(u, v, jacobian)返回(u, v)处发光的亮度并给出面积元。
+//power得到表面单侧的总功率；发光在所有取样点上都一样时不需要分布，返回nullptr
+template<typename F>
+distribution_2d *tabulate_surface_emission(int res, F radiance, real &power)
+{
+	std::vector<real> weights(size_t(res) * res);
+	real lo = FLT_MAX, hi = 0;
+	double sum = 0;
+	for (int j = 0; j < res; j++)
+		for (int i = 0; i < res; i++)
+		{
+			real w = 0;
+			for (int s = 0; s < 4; s++)
+			{
+				real jacobian;
+				real l = radiance((i + 0.25f + 0.5f * (s & 1)) / res, (j + 0.25f + 0.5f * (s >> 1)) / res, jacobian);
+				lo = ffmin(lo, l);
+				hi = ffmax(hi, l);
+				w += 0.25 * l * jacobian;
+			}
+			weights[size_t(j) * res + i] = w;
+			sum += w;
+		}
+	power = real(sum / (double(res) * res));
+	if (hi <= 0 || hi - lo <= 1e-6 * hi)
+		return nullptr;
+	return new distribution_2d(weights, res, res);
+}
+
+#endif //RAYTRACE_DISTRIBUTION_H
@@ -5,42 +5,138 @@
 #ifndef RAYTRACE_HITABLE_H
 #define RAYTRACE_HITABLE_H
 
+#include <vector>
 #include "aabb.h"
 #include "math.h"
 #include "float.h"
 
 class material;
+class hitable;
+
+//material_table编表时的接口：把材质编入表中，返回它在表中的下标
+class material_binder
+{
+public:
+	virtual int bind(const material *m) = 0;
+};
 
 //通过坐标变换得到球面u，v
 void get_sphere_uv(const vec3 &p, float &u, float &v)
 {
 	float phi = atan2(p.z(), p.x());
-	float theta = asin(p.y());
+	float theta = asin(fmax(-1.0f, fmin(1.0f, float(p.y()))));//舍入误差可能让|y|略大于1，asin会得到NaN
 	u = 1 - (phi + M_PI) / (2 * M_PI);
 	v = (theta + M_PI / 2) / M_PI;
 }
 
+//光线没有击中任何物体时看到的背景。所有积分器（递归、光线包、NEE、wavefront的shade_miss）都用它，
+//改背景只需要改这里
+inline vec3 background(const ray &r)
+{
+//	vec3 unit_direction = unit_vector(r.direction());//归一化成单位坐标
+//	float t = 0.5 * (unit_direction.y() + 1.0f);//全部变成正数方便混色，t=1时变成blue，t=0时变成white
+//	return (1.0f - t) * vec3(1.0f, 1.0f, 1.0f) + t * vec3(0.5f, 0.7f, 1.0f);//就是混色操作，类似线性插值
+	return vec3(0, 0, 0);
+}
+
 struct hit_record
 {
-	float t;//击中时的t值
+	real t;//击中时的t值
 	float u,v;//球面对应的u,v值
 	vec3 p;//击中点的光线
 	vec3 normal;//击中点的表面法线（归一化后）
 	material *mat_ptr;
+	int mat_id = -1;//mat_ptr在material_table中的下标，物体在hit()中填写，没有编表时为-1
+
+	//由光线微分得到的相邻像素击中点、法线的差，以及像素在uv空间中的足迹宽度
+	bool has_differentials = false;
+	vec3 dpdx, dpdy;
+	vec3 dndx, dndy;
+	float du = 0, dv = 0;
+
+	//击中的图元（球、矩形、介质），光源采样用它认出击中的是哪个光源。
+	//hitable_list会复用同一个记录，所以每个填写记录的hit()都要设置它
+	const hitable *prim = nullptr;
 };
 
 class hitable
 {
 public:
-	virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const = 0;
+	virtual bool hit(const ray &r, real t_min, real t_max, hit_record &rec) const = 0;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
+
+	//光线在物体内部的区间[t_enter, t_exit]与(t_min, t_max)的交集，只对封闭的凸边界有意义（参与介质用）。
+	//默认用两次hit()：先找到第一个交点，再从它之后找第二个；能一次求出两个交点的物体应当覆盖它
+	virtual bool hit_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const
+	{
+		hit_record rec1, rec2;
+		if (!hit(r, -FLT_MAX, FLT_MAX, rec1) || !hit(r, rec1.t + 0.0001, FLT_MAX, rec2))
+			return false;
+		return clip_interval(rec1.t, rec2.t, t_min, t_max, t_enter, t_exit);
+	}
+
+	//下面三个函数让物体可以作为光源被直接采样（next event estimation），球和矩形以及包在外面的变换实现了它们。
+	//从o出发沿方向v击中物体的立体角pdf，击不中为0
+	virtual real pdf_value(const vec3 &o, const vec3 &v) const
+	{ return 0; }
+
+	//从o出发按pdf_value的分布取一个指向物体的方向（不一定是单位向量）
+	virtual vec3 random(const vec3 &o) const
+	{ return vec3(1, 0, 0); }
+
+	//发光的面积，以及包住所有表面法线的锥（轴axis、半角theta_o）；two_sided时法线只确定到正负号，
+	//即两面都发光。不能作为光源时返回false
+	virtual bool emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const
+	{ return false; }
+
+	//渲染前的预处理：把表面的发光按uv制表（res x res），发光不均匀（图片、噪声纹理）时之后的random()/pdf_value()
+	//按发光功率而不是面积在表面上取点，并返回true。支持制表的物体总把单侧发光的总功率写进power，不支持的不改动它
+	virtual bool tabulate_emission(int res, real &power)
+	{ return false; }
+
+	//渲染前由material_table调用：物体把自己的材质交给binder编表，记下返回的下标，之后hit()直接写进rec.mat_id
+	virtual void bind_materials(material_binder &binder)
+	{}
+
+protected:
+	static bool clip_interval(real t0, real t1, real t_min, real t_max, real &t_enter, real &t_exit)
+	{
+		t_enter = t0 > t_min ? t0 : t_min;
+		t_exit = t1 < t_max ? t1 : t_max;
+		return t_enter < t_exit;
+	}
 };
 
+//u的差值跨过球面uv的接缝（0和1之间）时取较短的那一边
+inline float uv_delta(float a, float b)
+{
+	float d = fabs(a - b);
+	return d > 0.5f ? 1 - d : d;
+}
+
+//把光线的两条微分光线也与场景求交，击中同一材质时用有限差分得到rec的微分信息；
+//否则保持没有微分（纹理退回最精细的mip层）
+void compute_differentials(const hitable *world, const ray &r, hit_record &rec)
+{
+	hit_record rx, ry;
+	if (!world->hit(ray(r.rx_origin(), r.rx_direction(), r.time()), ray_epsilon, FLT_MAX, rx) ||
+		!world->hit(ray(r.ry_origin(), r.ry_direction(), r.time()), ray_epsilon, FLT_MAX, ry) ||
+		rx.mat_ptr != rec.mat_ptr || ry.mat_ptr != rec.mat_ptr)
+		return;
+	rec.dpdx = rx.p - rec.p;
+	rec.dpdy = ry.p - rec.p;
+	rec.dndx = rx.normal - rec.normal;
+	rec.dndy = ry.normal - rec.normal;
+	rec.du = fmax(uv_delta(rx.u, rec.u), uv_delta(ry.u, rec.u));
+	rec.dv = fmax(uv_delta(rx.v, rec.v), uv_delta(ry.v, rec.v));
+	rec.has_differentials = true;
+}
+
 //翻转法线方向
 class flip_normals : public hitable {
 public:
 	flip_normals(hitable *p) : ptr(p) {}
-	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
 		if (ptr->hit(r, t_min, t_max, rec)) {
 			rec.normal = -rec.normal;
 			return true;
@@ -51,6 +147,27 @@ public:
 	virtual bool bounding_box(float t0, float t1, aabb& box) const {
 		return ptr->bounding_box(t0, t1, box);
 	}
+	virtual bool hit_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const {
+		return ptr->hit_interval(r, t_min, t_max, t_enter, t_exit);
+	}
+	virtual real pdf_value(const vec3 &o, const vec3 &v) const {
+		return ptr->pdf_value(o, v);
+	}
+	virtual vec3 random(const vec3 &o) const {
+		return ptr->random(o);
+	}
+	virtual bool emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const {
+		if (!ptr->emitter_shape(area, axis, theta_o, two_sided))
+			return false;
+		axis = -axis;
+		return true;
+	}
+	virtual bool tabulate_emission(int res, real &power) {
+		return ptr->tabulate_emission(res, power);
+	}
+	virtual void bind_materials(material_binder &binder) {
+		ptr->bind_materials(binder);
+	}
 	hitable *ptr;
 };
 
@@ -58,15 +175,34 @@ public:
 class translate : public hitable {
 public:
 	translate(hitable *p, const vec3& displacement) : ptr(p), offset(displacement) {}
-	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
+	virtual bool hit_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const {
+		return ptr->hit_interval(ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max, t_enter, t_exit);
+	}
+	virtual real pdf_value(const vec3 &o, const vec3 &v) const {
+		return ptr->pdf_value(o - offset, v);
+	}
+	virtual vec3 random(const vec3 &o) const {
+		return ptr->random(o - offset);
+	}
+	virtual bool emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const {
+		return ptr->emitter_shape(area, axis, theta_o, two_sided);
+	}
+	//发光随位置变化的纹理在这里按物体自身坐标求值，只影响取样的分布，不影响结果
+	virtual bool tabulate_emission(int res, real &power) {
+		return ptr->tabulate_emission(res, power);
+	}
+	virtual void bind_materials(material_binder &binder) {
+		ptr->bind_materials(binder);
+	}
 
 private:
 	hitable *ptr;
 	vec3 offset;
 };
 
-bool translate::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+bool translate::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
 	ray moved_r(r.origin() - offset, r.direction(), r.time());//声明一个反向移动了光源的光线
 	if (ptr->hit(moved_r, t_min, t_max, rec))
 	{
@@ -91,23 +227,56 @@ bool translate::bounding_box(float t0, float t1, aabb &box) const {
 class rotate_y : public hitable {
 public:
 	rotate_y(hitable *p, float angle);
-	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const
 	{
 		box = bbox;
 		return hasbox;
 	}
+	virtual bool hit_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const {
+		return ptr->hit_interval(rotated(r), t_min, t_max, t_enter, t_exit);
+	}
+	virtual real pdf_value(const vec3 &o, const vec3 &v) const {
+		ray r = rotated(ray(o, v));
+		return ptr->pdf_value(r.origin(), r.direction());
+	}
+	virtual vec3 random(const vec3 &o) const {
+		return to_world(ptr->random(to_local(o)));
+	}
+	virtual bool emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const {
+		if (!ptr->emitter_shape(area, axis, theta_o, two_sided))
+			return false;
+		axis = to_world(axis);
+		return true;
+	}
+	virtual bool tabulate_emission(int res, real &power) {
+		return ptr->tabulate_emission(res, power);
+	}
+	virtual void bind_materials(material_binder &binder) {
+		ptr->bind_materials(binder);
+	}
 
 private:
+	//把光线转到物体自身的坐标系，t不变
+	ray rotated(const ray &r) const;
+
+	//世界坐标系与物体坐标系之间转换点或方向
+	vec3 to_local(const vec3 &d) const {
+		return vec3(cos_theta * d[0] - sin_theta * d[2], d[1], sin_theta * d[0] + cos_theta * d[2]);
+	}
+	vec3 to_world(const vec3 &d) const {
+		return vec3(cos_theta * d[0] + sin_theta * d[2], d[1], -sin_theta * d[0] + cos_theta * d[2]);
+	}
+
 	hitable *ptr;
-	float sin_theta;
-	float cos_theta;
+	real sin_theta;
+	real cos_theta;
 	bool hasbox;
 	aabb bbox;
 };
 
 rotate_y::rotate_y(hitable *p, float angle) : ptr(p) {
-	float radians = (M_PI / 180.) * angle;
+	real radians = (M_PI / 180.) * angle;
 	sin_theta = sin(radians);
 	cos_theta = cos(radians);
 	hasbox = ptr->bounding_box(0, 1, bbox);
@@ -119,11 +288,11 @@ rotate_y::rotate_y(hitable *p, float angle) : ptr(p) {
 		{
 			for (int k = 0; k < 2; k++)
 			{
-				float x = i * bbox.max().x() + (1 - i) * bbox.min().x();
-				float y = j * bbox.max().y() + (1 - j) * bbox.min().y();
-				float z = k * bbox.max().z() + (1 - k) * bbox.min().z();
-				float newx = cos_theta * x + sin_theta * z;
-				float newz = -sin_theta * x + cos_theta * z;
+				real x = i * bbox.max().x() + (1 - i) * bbox.min().x();
+				real y = j * bbox.max().y() + (1 - j) * bbox.min().y();
+				real z = k * bbox.max().z() + (1 - k) * bbox.min().z();
+				real newx = cos_theta * x + sin_theta * z;
+				real newz = -sin_theta * x + cos_theta * z;
 				vec3 tester(newx, y, newz);
 				for (int c = 0; c < 3; c++)
 				{
@@ -138,24 +307,15 @@ rotate_y::rotate_y(hitable *p, float angle) : ptr(p) {
 	bbox = aabb(min, max);
 }
 
-bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-	vec3 origin = r.origin();
-	vec3 direction = r.direction();
-	origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-	origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-	direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-	direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-	ray rotated_r(origin, direction, r.time());
-	if (ptr->hit(rotated_r, t_min, t_max, rec))
+ray rotate_y::rotated(const ray &r) const {
+	return ray(to_local(r.origin()), to_local(r.direction()), r.time());
+}
+
+bool rotate_y::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	if (ptr->hit(rotated(r), t_min, t_max, rec))
 	{
-		vec3 p = rec.p;
-		vec3 normal = rec.normal;
-		p[0] = cos_theta * rec.p[0] + sin_theta * rec.p[2];
-		p[2] = -sin_theta * rec.p[0] + cos_theta * rec.p[2];
-		normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
-		normal[2] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
-		rec.p = p;
-		rec.normal = normal;
+		rec.p = to_world(rec.p);
+		rec.normal = to_world(rec.normal);
 		return true;
 	}
 	else
@@ -10,15 +10,20 @@ class hitable_list: public hitable  {
 public:
 	hitable_list() {}
 	hitable_list(hitable **l, int n) {list = l; list_size = n; }
-	virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+	virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
+	virtual void bind_materials(material_binder &binder)
+	{
+		for (int i = 0; i < list_size; i++)
+			list[i]->bind_materials(binder);
+	}
 
 private:
 	hitable **list;
 	int list_size;
 };
 
-bool hitable_list::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
+bool hitable_list::hit(const ray &r, real t_min, real t_max, hit_record &rec) const
 {
 	hit_record temp_rec;
 	bool hit_anything = false;
@@ -52,7 +57,7 @@ bool hitable_list::bounding_box(float t0, float t1, aabb &box) const
 
 	for (int i = 1; i < list_size; i++)
 	{
-		if (list[0]->bounding_box(t0, t1, temp_box))
+		if (list[i]->bounding_box(t0, t1, temp_box))
 			box = surrounding_box(box, temp_box);//尝试扩大绑定到box成为可以容纳整个list上所有物体
 		else
 			return false;
@@ -5,34 +5,123 @@
 #ifndef RAYTRACE_IMAGE_TEXTURE_H
 #define RAYTRACE_IMAGE_TEXTURE_H
 
+#include <vector>
+#include <memory>
 #include "texture.h"
+#include "tex_file.h"
 
+//足迹du、dv对应的mip层（浮点数，小数部分用于两层之间插值）：足迹在第0层上覆盖的像素数取以2为底的对数
+inline float texture_lod(float du, float dv, int nx, int ny)
+{
+	float width = fmax(du * nx, dv * ny);
+	return width > 1 ? log2f(width) : 0;
+}
+
+//图片纹理。载入时生成mip金字塔，采样时根据像素足迹选择mip层做三线性滤波，
+//远处的表面既不会走样，也不会每个样本都在整张原图上跳着读。
+//也可以直接映射texconv离线生成的.tex文件，启动时不需要解码图片、生成mip
 class image_texture : public texture
 {
 public:
 	image_texture(){}
-	image_texture(unsigned char *pixels, int A, int B) : data(pixels), nx(A), ny(B)
-	{}
+	image_texture(unsigned char *pixels, int A, int B);
+
+	//映射.tex文件，失败时返回nullptr
+	static image_texture *open(const std::string &path);
+
+	//没有足迹时在最精细的一层上做双线性插值
+	virtual vec3 value(float u, float v, const vec3 &p) const
+	{ return filtered_value(u, v, p, 0, 0); }
+
+	virtual vec3 filtered_value(float u, float v, const vec3 &p, float du, float dv) const;
+
+	virtual bool filtered() const
+	{ return true; }
+
+	int levels() const
+	{ return file ? int(file->header()->levels) : int(mips.size()); }
 
-	virtual vec3 value(float u, float v, const vec3 &p) const;
 private:
-	unsigned char *data;
-	int nx, ny;
+	void level_size(int level, int &nx, int &ny) const;
+	vec3 texel(int level, int i, int j) const;
+	vec3 bilinear(int level, float u, float v) const;
+
+	std::vector<texture_level> mips;
+	std::unique_ptr<mapped_tex_file> file;//映射的.tex文件，不为空时代替mips
 };
 
-vec3 image_texture::value(float u, float v, const vec3 &p) const
+image_texture::image_texture(unsigned char *pixels, int A, int B) : mips(build_mip_chain(pixels, A, B))
+{}
+
+image_texture *image_texture::open(const std::string &path)
+{
+	mapped_tex_file *f = mapped_tex_file::open(path);
+	if (!f)
+		return nullptr;
+	image_texture *t = new image_texture;
+	t->file.reset(f);
+	return t;
+}
+
+void image_texture::level_size(int level, int &nx, int &ny) const
+{
+	if (file)
+	{
+		nx = file->level(level)->nx;
+		ny = file->level(level)->ny;
+	}
+	else
+	{
+		nx = mips[level].nx;
+		ny = mips[level].ny;
+	}
+}
+
+vec3 image_texture::texel(int level, int i, int j) const
 {
-	int i = u * nx;
-	int j = (1 - v) * ny - 0.001;
+	int nx, ny;
+	level_size(level, nx, ny);
 	if (i < 0) i = 0;
 	if (j < 0) j = 0;
-	if (i > nx - 1)i = nx - 1;
-	if (j > ny - 1)j = ny - 1;
-	float r = int(data[3 * i + 3 * nx * j]) / 255.0;
-	float g = int(data[3 * i + 3 * nx * j + 1]) / 255.0;
-	float b = int(data[3 * i + 3 * nx * j + 2]) / 255.0;
-	return vec3(r, g, b);
+	if (i > nx - 1) i = nx - 1;
+	if (j > ny - 1) j = ny - 1;
+	if (file)
+	{
+		uint32_t format = file->header()->format;
+		const unsigned char *tile = file->tile(level, i / TEX_TILE, j / TEX_TILE);
+		return decode_texel(format, tile + tex_texel_bytes(format) * tile_morton(i % TEX_TILE, j % TEX_TILE));
+	}
+	const float *c = &mips[level].rgb[3 * (i + nx * j)];
+	return vec3(c[0], c[1], c[2]);
+}
+
+vec3 image_texture::bilinear(int level, float u, float v) const
+{
+	int nx, ny;
+	level_size(level, nx, ny);
+	float x = u * nx - 0.5f;//图片的第一行是v=1
+	float y = (1 - v) * ny - 0.5f;
+	int i = int(floor(x));
+	int j = int(floor(y));
+	float fx = x - i, fy = y - j;
+	return (1 - fy) * ((1 - fx) * texel(level, i, j) + fx * texel(level, i + 1, j)) +
+		   fy * ((1 - fx) * texel(level, i, j + 1) + fx * texel(level, i + 1, j + 1));
+}
+
+vec3 image_texture::filtered_value(float u, float v, const vec3 &p, float du, float dv) const
+{
+	int nx, ny;
+	level_size(0, nx, ny);
+	float lod = texture_lod(du, dv, nx, ny);
+	int top = levels() - 1;
+	if (lod >= top)
+		return bilinear(top, u, v);
+	int level = int(lod);
+	float f = lod - level;
+	if (f == 0)
+		return bilinear(level, u, v);
+	return (1 - f) * bilinear(level, u, v) + f * bilinear(level + 1, u, v);
 }
 
 
-#endif //RAYTRACE_IMAGE_TEXTURE_H
\ No newline at end of file
+#endif //RAYTRACE_IMAGE_TEXTURE_H
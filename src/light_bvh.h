@@ -0,0 +1,358 @@
+#ifndef RAYTRACE_LIGHT_BVH_H
+#define RAYTRACE_LIGHT_BVH_H
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "hitable.h"
+#include "material.h"
+#include "distribution.h"
+
+//光源包围体：位置的aabb、总功率、包住所有法线的锥。发光的都是diffuse_light，发光方向不超出法线的半球（theta_e = pi/2）
+struct light_bounds
+{
+	aabb box;
+	real power = 0;
+	vec3 axis = vec3(0, 0, 1);
+	real theta_o = 0;
+	bool two_sided = false;
+
+	//从点p（法线n，为空时不考虑接收面朝向）看这组光源贡献的估计：功率 / 距离^2，
+	//再乘上发光面和接收面朝向的保守上界（Conty Estevez & Kulla, Importance Sampling of Many Lights
+	//with Adaptive Tree Splitting, 2018）。一定照不到p的返回0
+	real importance(const vec3 &p, const vec3 *n) const
+	{
+		vec3 pc = 0.5 * (box.min() + box.max());
+		real radius = 0.5 * (box.max() - box.min()).length();
+		real d2 = (p - pc).squared_length();
+		//盒子的张角：p在包围球内时任何方向都可能
+		real cos_b = -1, sin_b = 0;
+		if (d2 > radius * radius)
+		{
+			real sin2 = radius * radius / d2;
+			sin_b = sqrt(sin2);
+			cos_b = sqrt(1 - sin2);
+		}
+		vec3 wi = d2 > 0 ? (p - pc) / sqrt(d2) : vec3(0, 0, 1);//从光源指向p
+
+		//发光面：p的方向与法线锥的夹角减去锥的半角和盒子的张角
+		real cos_w = dot(axis, wi);
+		if (two_sided)
+			cos_w = fabs(cos_w);
+		real cos_p = reduced_cos(reduced_cos(cos_w, theta_o), cos_b, sin_b);
+		if (cos_p <= 0)
+			return 0;
+
+		//接收面：只有法线一侧能被照亮
+		real cos_r = 1;
+		if (n)
+		{
+			cos_r = reduced_cos(dot(*n, -wi), cos_b, sin_b);
+			if (cos_r <= 0)
+				return 0;
+		}
+		//离得很近时按盒子的尺寸截断，避免一个大的节点因为距离趋于0而吃掉所有概率
+		return power * cos_p * cos_r / ffmax(d2, 0.25 * radius * radius);
+	}
+
+	//cos(max(0, theta - delta))，theta、delta都以余弦（和正弦）给出
+	static real reduced_cos(real cos_t, real cos_d, real sin_d)
+	{
+		if (cos_t >= cos_d)
+			return 1;
+		real sin_t = sqrt(std::max(real(0), 1 - cos_t * cos_t));
+		return cos_t * cos_d + sin_t * sin_d;
+	}
+
+	static real reduced_cos(real cos_t, real delta)
+	{ return delta >= M_PI ? 1 : reduced_cos(cos_t, cos(delta), sin(delta)); }
+};
+
+//两个法线锥的并；two_sided时轴的正负号可以任选，取夹角小的那个
+inline void union_cone(light_bounds &a, const light_bounds &b)
+{
+	vec3 bx = b.axis;
+	a.two_sided = a.two_sided || b.two_sided;
+	if (a.two_sided && dot(a.axis, bx) < 0)
+		bx = -bx;
+	if (a.theta_o >= M_PI || b.theta_o >= M_PI)
+	{
+		a.theta_o = M_PI;
+		return;
+	}
+	real theta_d = acos(ffmax(real(-1), ffmin(real(1), dot(a.axis, bx))));
+	if (ffmin(theta_d + b.theta_o, real(M_PI)) <= a.theta_o)
+		return;
+	if (ffmin(theta_d + a.theta_o, real(M_PI)) <= b.theta_o)
+	{
+		a.axis = bx;
+		a.theta_o = b.theta_o;
+		return;
+	}
+	real theta_o = 0.5 * (a.theta_o + theta_d + b.theta_o);
+	vec3 w = cross(a.axis, bx);
+	if (theta_o >= M_PI || w.squared_length() < 1e-12)
+	{
+		a.theta_o = M_PI;
+		return;
+	}
+	//把a的轴朝b转theta_o - theta_a
+	real theta_r = theta_o - a.theta_o;
+	a.axis = unit_vector(a.axis * real(cos(theta_r)) + cross(unit_vector(w), a.axis) * real(sin(theta_r)));
+	a.theta_o = theta_o;
+}
+
+inline void union_bounds(light_bounds &a, const light_bounds &b)
+{
+	if (b.power <= 0)
+		return;
+	if (a.power <= 0)
+	{
+		a = b;
+		return;
+	}
+	a.box = surrounding_box(a.box, b.box);
+	a.power += b.power;
+	union_cone(a, b);
+}
+
+//按光源的估计贡献选光源的层次结构。每个内部节点在着色点p处比较两个孩子的importance，
+//按比例随机走向一边，到叶子时就选中了一个光源，概率是沿途各次选择概率的乘积。
+//pmf()沿叶子到根的路径重新算出同一个概率，给击中光源时的MIS用
+class light_bvh
+{
+public:
+	//lights是场景中发光的物体，必须实现emitter_shape/pdf_value/random（球、矩形及其变换）。
+	//emission_res > 0时先让每个光源把发光制表（hitable::tabulate_emission），功率按表的积分算，
+	//发光不均匀的光源在表面上按功率取点；为0时功率按中心一点的发光估计，在表面上均匀取点
+	explicit light_bvh(const std::vector<hitable *> &lights, int emission_res = 32);
+
+	bool empty() const
+	{ return lights.empty(); }
+
+	size_t size() const
+	{ return lights.size(); }
+
+	hitable *light(int i) const
+	{ return lights[i]; }
+
+	//击中的图元（hit_record::prim）是第几个光源，不是光源时为-1
+	int find(const hitable *prim) const
+	{
+		auto it = by_prim.find(prim);
+		return it == by_prim.end() ? -1 : it->second;
+	}
+
+	//在p（表面法线n，介质中为空）处选一个光源，u是[0, 1)上的均匀样本；没有能照到p的光源时返回-1
+	int sample(const vec3 &p, const vec3 *n, float u, real &pmf) const;
+
+	//sample()在p处选中光源i的概率
+	real pmf(const vec3 &p, const vec3 *n, int i) const;
+
+	//uniform为true时不用层次结构，所有光源等概率，用来对比
+	bool uniform = false;
+
+	int depth = 0;
+	int skipped = 0;//不能作为光源采样（没有emitter_shape）或不发光的物体数
+	int tabulated = 0;//制表后发光不均匀、按功率分布取点的光源数
+
+private:
+	struct node
+	{
+		light_bounds bounds;
+		int left = -1, right = -1;//内部节点的两个孩子
+		int light = -1;//叶子节点的光源下标
+		int parent = -1;
+	};
+
+	int build(std::vector<int> &order, int begin, int end, int parent, int level);
+
+	std::vector<hitable *> lights;
+	std::vector<light_bounds> light_info;
+	std::vector<node> nodes;
+	std::vector<int> leaf;//每个光源的叶子节点
+	std::unordered_map<const hitable *, int> by_prim;
+};
+
+//法线锥对应的方向集合的度量（PBRT-v4的LightBounds中的M_Omega），theta_e = pi/2
+inline real cone_measure(const light_bounds &b)
+{
+	real theta_w = ffmin(b.theta_o + M_PI / 2, real(M_PI));
+	return 2 * M_PI * (1 - cos(b.theta_o)) +
+		   M_PI / 2 * (2 * theta_w * sin(b.theta_o) - cos(b.theta_o - 2 * theta_w) - 2 * b.theta_o * sin(b.theta_o) +
+					   cos(b.theta_o));
+}
+
+light_bvh::light_bvh(const std::vector<hitable *> &candidates, int emission_res)
+{
+	for (hitable *h : candidates)
+	{
+		light_bounds b;
+		real area;
+		if (!h->emitter_shape(area, b.axis, b.theta_o, b.two_sided) || !h->bounding_box(0, 1, b.box))
+		{
+			skipped++;
+			continue;
+		}
+		//从包围盒外朝中心打一条光线，击中点的发光近似整个光源的发光，击中的图元用来在着色时认出这个光源
+		vec3 c = 0.5 * (b.box.min() + b.box.max());
+		vec3 o = c + (b.theta_o >= M_PI ? vec3(0.1, 1, 0.2) : b.axis) * (b.box.max() - b.box.min()).length();
+		hit_record rec;
+		if (!h->hit(ray(o, c - o), 0, FLT_MAX, rec) || !rec.prim)
+		{
+			skipped++;
+			continue;
+		}
+		real power = -1;
+		if (emission_res > 0 && h->tabulate_emission(emission_res, power))
+			tabulated++;
+		if (power >= 0)
+			b.power = power * (b.two_sided ? 2 : 1);
+		else
+			b.power = luminance(rec.mat_ptr->emitted(rec.u, rec.v, rec.p)) * area * (b.two_sided ? 2 : 1);
+		if (b.power <= 0)
+		{
+			skipped++;
+			continue;
+		}
+		by_prim[rec.prim] = int(lights.size());
+		lights.push_back(h);
+		light_info.push_back(b);
+	}
+	leaf.assign(lights.size(), -1);
+	if (lights.empty())
+		return;
+	std::vector<int> order(lights.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = int(i);
+	nodes.reserve(2 * lights.size());
+	build(order, 0, int(order.size()), -1, 1);
+}
+
+//按质心在最长轴上分12个桶，代价 = 功率 * 法线锥度量 * 包围盒表面积（PBRT-v4的SAOH，略去了长宽比项）
+int light_bvh::build(std::vector<int> &order, int begin, int end, int parent, int level)
+{
+	int index = int(nodes.size());
+	nodes.push_back(node());
+	nodes[index].parent = parent;
+	depth = std::max(depth, level);
+	light_bounds all;
+	for (int i = begin; i < end; i++)
+		union_bounds(all, light_info[order[i]]);
+	nodes[index].bounds = all;
+	if (end - begin == 1)
+	{
+		nodes[index].light = order[begin];
+		leaf[order[begin]] = index;
+		return index;
+	}
+
+	aabb centroids(vec3(FLT_MAX, FLT_MAX, FLT_MAX), vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+	for (int i = begin; i < end; i++)
+	{
+		const aabb &b = light_info[order[i]].box;
+		vec3 c = 0.5 * (b.min() + b.max());
+		centroids = surrounding_box(centroids, aabb(c, c));
+	}
+	vec3 extent = centroids.max() - centroids.min();
+	int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+	int mid = (begin + end) / 2;
+	if (extent[axis] > 0)
+	{
+		const int buckets = 12;
+		auto bucket_of = [&](int l) {
+			const aabb &b = light_info[l].box;
+			real c = 0.5 * (b.min()[axis] + b.max()[axis]);
+			return std::min(buckets - 1, int(buckets * (c - centroids.min()[axis]) / extent[axis]));
+		};
+		light_bounds bucket[buckets];
+		for (int i = begin; i < end; i++)
+			union_bounds(bucket[bucket_of(order[i])], light_info[order[i]]);
+		real best = FLT_MAX;
+		int split = -1;
+		for (int s = 0; s < buckets - 1; s++)
+		{
+			light_bounds below, above;
+			for (int k = 0; k <= s; k++)
+				union_bounds(below, bucket[k]);
+			for (int k = s + 1; k < buckets; k++)
+				union_bounds(above, bucket[k]);
+			if (below.power <= 0 || above.power <= 0)
+				continue;
+			real cost = below.power * cone_measure(below) * below.box.area() +
+						above.power * cone_measure(above) * above.box.area();
+			if (cost < best)
+			{
+				best = cost;
+				split = s;
+			}
+		}
+		if (split >= 0)
+		{
+			auto m = std::partition(order.begin() + begin, order.begin() + end, [&](int l) { return bucket_of(l) <= split; });
+			mid = int(m - order.begin());
+		}
+	}
+	if (mid == begin || mid == end)//质心重合或分不开时按原顺序对半分
+		mid = (begin + end) / 2;
+	int left = build(order, begin, mid, index, level + 1);
+	int right = build(order, mid, end, index, level + 1);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	return index;
+}
+
+int light_bvh::sample(const vec3 &p, const vec3 *n, float u, real &pmf) const
+{
+	if (lights.empty())
+		return -1;
+	if (uniform)
+	{
+		pmf = real(1) / lights.size();
+		return std::min(int(u * lights.size()), int(lights.size()) - 1);
+	}
+	int i = 0;
+	pmf = 1;
+	while (nodes[i].light < 0)
+	{
+		real l = nodes[nodes[i].left].bounds.importance(p, n);
+		real r = nodes[nodes[i].right].bounds.importance(p, n);
+		if (l <= 0 && r <= 0)
+			return -1;
+		real pl = l / (l + r);
+		//u在选中的一边重新缩放到[0, 1)，一个样本用到底
+		if (u < pl)
+		{
+			u = ffmin(u / pl, 0x1.fffffep-1f);
+			pmf *= pl;
+			i = nodes[i].left;
+		}
+		else
+		{
+			u = ffmin((u - pl) / (1 - pl), 0x1.fffffep-1f);
+			pmf *= 1 - pl;
+			i = nodes[i].right;
+		}
+	}
+	return nodes[i].light;
+}
+
+real light_bvh::pmf(const vec3 &p, const vec3 *n, int light) const
+{
+	if (uniform)
+		return real(1) / lights.size();
+	real pmf = 1;
+	for (int i = leaf[light]; nodes[i].parent >= 0; i = nodes[i].parent)
+	{
+		const node &parent = nodes[nodes[i].parent];
+		real l = nodes[parent.left].bounds.importance(p, n);
+		real r = nodes[parent.right].bounds.importance(p, n);
+		real mine = i == parent.left ? l : r;
+		if (mine <= 0)
+			return 0;
+		pmf *= mine / (l + r);
+	}
+	return pmf;
+}
+
+#endif //RAYTRACE_LIGHT_BVH_H
@@ -14,43 +14,178 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "image_texture.h"
+#include "tiled_texture.h"
 #include "aa_rect.h"
 #include "hitable.h"
 #include "box.h"
+#include "constant_medium.h"
+#include "volume_grid.h"
+#include "light_bvh.h"
+#include "animation.h"
+#include "material_table.h"
+#include "wavefront.h"
+#include "packet.h"
+#include "sampler.h"
+#include "render_farm.h"
+#include "accum_file.h"
+#include "scene_hitable.h"
+#include <vector>
+#include <string>
+#include <cstring>
+#include <filesystem>
+#include <chrono>
+#include <memory>
 
-//depth：进行多少次光线追踪
-vec3 color(const ray &r, hitable *world, int depth)
+//与color()相同的递归，但材质和纹理通过material_table的switch分派，而不是虚函数
+vec3 color_table(const ray &r, hitable *world, const material_table &table, int depth)
 {
 	hit_record rec;
-	if (world->hit(r, 0.001, FLT_MAX, rec))
+	if (world->hit(r, ray_epsilon, FLT_MAX, rec))
 	{
-		ray scattered;//散射光线
-		vec3 attenuation;//反射率
-		vec3 emitted = rec.mat_ptr->emitted(rec.u,rec.v,rec.p);//增加了自发光的效应
-		if (depth < 50 && rec.mat_ptr->scatter(r,rec,attenuation,scattered))//调用两个派生类进行分别的渲染
-			return emitted + attenuation * color(scattered, world, depth + 1);
+		ray scattered;
+		vec3 attenuation;
+		if (r.has_differentials() && rec.mat_ptr->uses_differentials())
+			compute_differentials(world, r, rec);
+		vec3 emitted = table.emitted(rec);
+		if (depth < 50 && table.scatter(r, rec, attenuation, scattered))
+			return emitted + attenuation * color_table(scattered, world, table, depth + 1);
 		else
 			return emitted;
 	}
 	else
+		return background(r);
+}
+
+vec3 color(const ray &r, hitable *world, int depth);
+
+//光线已经求得交点rec之后的着色，color()和光线包追踪共用
+vec3 shade(const ray &r, hit_record &rec, hitable *world, int depth)
+{
+	if (r.has_differentials() && rec.mat_ptr->uses_differentials())//只有需要时才追踪两条微分光线
+		compute_differentials(world, r, rec);
+	ray scattered;//散射光线
+	vec3 attenuation;//反射率
+	vec3 emitted = rec.mat_ptr->emitted(rec.u,rec.v,rec.p);//增加了自发光的效应
+	if (depth < 50 && rec.mat_ptr->scatter(r,rec,attenuation,scattered))//调用两个派生类进行分别的渲染
+		return emitted + attenuation * color(scattered, world, depth + 1);
+	else
+		return emitted;
+}
+
+//上一次散射的信息：BSDF采样的光线击中光源时，用它求出NEE取到同一方向的概率，两者做MIS
+struct bounce_info
+{
+	bool specular = true;//相机光线或镜面散射，击中光源时计入全部发光
+	vec3 p, n;
+	bool one_sided = true;//散射点是表面（光源选择用到法线）还是介质
+	float pdf = 0;//散射方向的立体角pdf
+};
+
+//power heuristic（beta = 2）
+inline real mis_weight(real a, real b)
+{ return a * a / (a * a + b * b); }
+
+//场景中登记的参与介质，以及不含这些介质的表面。阴影光线只与表面求交，
+//穿过的介质不取碰撞点，而是乘上各自的transmittance()（ratio tracking）
+struct participating_media
+{
+	hitable *surfaces = nullptr;//为空时场景没有登记介质，阴影光线直接与world求交
+	std::vector<const medium *> media;
+};
+
+//color_nee用到的光源和阴影光线的求交对象
+struct nee_scene
+{
+	const light_bvh *lights;
+	hitable *surfaces;
+	std::vector<const medium *> media;
+};
+
+//与color()相同的递归，另外在每个非镜面散射点上对光源做一次直接采样（next event estimation）：
+//由light_bvh按估计的贡献选一个光源，在它上面取一个方向，阴影光线最近击中的正是这个光源时计入它的发光，
+//再乘上到光源之间各个介质的透过率。
+//BSDF采样击中光源时的发光和NEE用power heuristic做MIS，镜面散射之后仍然只能由BSDF采样得到
+vec3 color_nee(const ray &r, hitable *world, const nee_scene &nee, int depth, const bounce_info &prev)
+{
+	const light_bvh &lights = *nee.lights;
+	hit_record rec;
+	if (!world->hit(r, ray_epsilon, FLT_MAX, rec))
+		return background(r);
+	if (r.has_differentials() && rec.mat_ptr->uses_differentials())
+		compute_differentials(world, r, rec);
+	vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+	int hit_light = prev.specular ? -1 : lights.find(rec.prim);
+	if (hit_light >= 0)
+	{
+		real light_pdf = lights.pmf(prev.p, prev.one_sided ? &prev.n : nullptr, hit_light) *
+						 lights.light(hit_light)->pdf_value(prev.p, r.direction());
+		emitted *= mis_weight(prev.pdf, light_pdf);
+	}
+	if (depth >= 50)
+		return emitted;
+
+	//eval返回false的是镜面材质，不做NEE
+	vec3 n = unit_vector(rec.normal), f_cos;
+	float pdf;
+	bool diffuse = rec.mat_ptr->eval(r, rec, n, f_cos, pdf);
+	const vec3 *receiver = rec.mat_ptr->one_sided() ? &n : nullptr;
+	vec3 direct(0, 0, 0);
+	real pmf;
+	int l = diffuse ? lights.sample(rec.p, receiver, sample_1d(), pmf) : -1;
+	if (l >= 0)
 	{
-//		vec3 unit_direction = unit_vector(r.direction());//归一化成单位坐标
-//		float t = 0.5 * (unit_direction.y() + 1.0f);//全部变成正数方便混色，t=1时变成blue，t=0时变成white
-//		return (1.0f - t) * vec3(1.0f, 1.0f, 1.0f) + t * vec3(0.5f, 0.7f, 1.0f);//就是混色操作，类似线性插值
-		return vec3(0,0,0);
+		hitable *light = lights.light(l);
+		vec3 to_light = light->random(rec.p);
+		real light_pdf = pmf * light->pdf_value(rec.p, to_light);
+		ray shadow(rec.p, to_light, r.time());
+		hit_record lrec;
+		if (light_pdf > 0 && rec.mat_ptr->eval(r, rec, unit_vector(to_light), f_cos, pdf) && pdf > 0 &&
+			nee.surfaces->hit(shadow, ray_epsilon, FLT_MAX, lrec) && lights.find(lrec.prim) == l)
+		{
+			real tr = 1;
+			for (const medium *m : nee.media)
+				tr *= m->transmittance(shadow, ray_epsilon, lrec.t);
+			direct = f_cos * lrec.mat_ptr->emitted(lrec.u, lrec.v, lrec.p) * (tr * mis_weight(light_pdf, pdf) / light_pdf);
+		}
 	}
+
+	ray scattered;
+	vec3 attenuation;
+	if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+		return emitted + direct;
+	bounce_info next;
+	if (diffuse)
+	{
+		next.specular = false;
+		next.p = rec.p;
+		next.n = n;
+		next.one_sided = receiver != nullptr;
+		rec.mat_ptr->eval(r, rec, unit_vector(scattered.direction()), f_cos, next.pdf);
+	}
+	return emitted + direct + attenuation * color_nee(scattered, world, nee, depth + 1, next);
 }
 
-hitable *random_scene(){
-	int n = 200;//200个球
+//depth：进行多少次光线追踪
+vec3 color(const ray &r, hitable *world, int depth)
+{
+	hit_record rec;
+	if (world->hit(r, ray_epsilon, FLT_MAX, rec))
+		return shade(r, rec, world, depth);
+	else
+		return background(r);
+}
+
+//grid控制小球网格的半宽，默认的5对应原来的100个小球；158大约是10万个
+hitable *random_scene(int grid = 5){
+	int n = 4 * grid * grid + 3;
 	texture *checker = new checker_texture(new constant_texture(vec3(0.2, 0.3, 0.1)),
 										 new constant_texture(vec3(0.9, 0.9, 0.9)));
 	hitable **list = new hitable *[n + 1];
 	list[0] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker));//大地表面背景
 	int i = 1;
-	for (int a = -5; a < 5; a++)
+	for (int a = -grid; a < grid; a++)
 	{
-		for (int b = -5; b < 5; b++)
+		for (int b = -grid; b < grid; b++)
 		{
 			float choose_mat = drand48();
 			vec3 center(a + 0.9 * drand48(), 0.2, b + 0.9 * drand48());
@@ -84,36 +219,114 @@ hitable *random_scene(){
 	return new bvh_node(list, i, 0, 1);
 }
 
+size_t noise_bake_budget = 0;//--bake-noise <MB>：静态场景里的noise_texture预先烘焙成三维网格
+
+//地面和球共用一个noise纹理时的烘焙：地面只取相机附近一层薄板，球取它的包围盒，各用一半的预算
+void bake_ground_and_sphere(noise_texture *tex, hitable *ball)
+{
+	aabb boxes[2];
+	boxes[0] = aabb(vec3(-20, -0.45, -20), vec3(20, 0.01, 20));//半径1000的地面在|x|,|z|<20内最多下沉约0.4（角上r≈28.3）
+	ball->bounding_box(0, 1, boxes[1]);
+	for (const aabb &box : boxes)
+	{
+		noise_bake_report r = tex->bake(box, noise_bake_budget / 2);
+		std::cerr << "baked noise " << r.nx << "x" << r.ny << "x" << r.nz << " (" << (r.bytes >> 10) << " KB) in "
+				  << r.seconds << " s, turbulence error mean " << r.mean_error << " max " << r.max_error << "\n";
+	}
+}
+
 hitable *two_perlin_spheres()
 {
-	texture *pertext = new noise_texture(1.0);
+	noise_texture *pertext = new noise_texture(1.0);
 	hitable **list = new hitable* [2];
 	list[0] = new sphere(vec3(0,-1000,0),1000,new lambertian(pertext));
 	list[1] = new sphere(vec3(0,2,0),2,new lambertian(pertext));
+	if (noise_bake_budget > 0)
+		bake_ground_and_sphere(pertext, list[1]);
 	return new hitable_list(list,2);
 }
 
-hitable *earth()
+texture_cache *tile_cache = nullptr;//--texture-cache <MB>：图片纹理改为经这个缓存从.tex分块文件按需读tile
+
+//载入图片纹理。图片旁边有不旧于图片的.tex文件（texconv生成）时直接映射它，不再解码图片；
+//使用tile缓存时，没有.tex文件会先生成一份
+texture *load_image_texture(const std::string &path)
 {
 	int nx, ny, nn;
-	unsigned char *tex_data = stbi_load("../texture/earthmap.jpg", &nx, &ny, &nn, 0);
-	material *mat = new lambertian(new image_texture(tex_data, nx, ny));
+	std::string tex_path = path.substr(0, path.rfind('.')) + ".tex";
+	bool has_tex = std::filesystem::exists(tex_path) &&
+				   std::filesystem::last_write_time(tex_path) >= std::filesystem::last_write_time(path);
+	if (tile_cache)
+	{
+		if (!has_tex)
+		{
+			unsigned char *pixels = stbi_load(path.c_str(), &nx, &ny, &nn, 3);
+			if (pixels)
+			{
+				write_tiled_texture(tex_path, build_mip_chain(pixels, nx, ny), uint32_t(tex_format::rgb8));
+				stbi_image_free(pixels);
+			}
+			else
+				std::cerr << "cannot decode " << path << ": " << stbi_failure_reason() << "\n";
+		}
+		if (texture *t = tiled_texture::open(*tile_cache, tex_path))
+			return t;
+		std::cerr << "cannot open " << tex_path << ", loading " << path << " directly\n";
+	}
+	else if (has_tex)
+	{
+		if (texture *t = image_texture::open(tex_path))
+			return t;
+		std::cerr << "cannot map " << tex_path << ", loading " << path << " directly\n";
+	}
+	unsigned char *tex_data = stbi_load(path.c_str(), &nx, &ny, &nn, 3);
+	if (!tex_data)
+	{
+		std::cerr << "cannot decode " << path << ": " << stbi_failure_reason() << "\n";
+		exit(1);
+	}
+	return new image_texture(tex_data, nx, ny);
+}
+
+hitable *earth()
+{
+	material *mat = new lambertian(load_image_texture("../texture/earthmap.jpg"));
 	return new sphere(vec3(0, 0, 0), 2, mat);
 }
 
-hitable *simple_light()
+//一片向远处延伸的地球仪，加一个镜面球，用来观察图片纹理在缩小和镜面反射下的滤波效果
+hitable *earth_field()
+{
+	material *mat = new lambertian(load_image_texture("../texture/earthmap.jpg"));
+	std::vector<hitable *> list;
+	for (int z = 0; z < 12; z++)
+		for (int x = -3; x <= 3; x++)
+			list.push_back(new sphere(vec3(3 * x, 1, -3 * z), 1, mat));
+	list.push_back(new sphere(vec3(0, 3, 3), 1.5, new metal(vec3(0.9, 0.9, 0.9), 0)));
+	list.push_back(new sphere(vec3(0, -1000, 0), 1000, new lambertian(new constant_texture(vec3(0.5, 0.5, 0.5)))));
+	list.push_back(new xz_rect(-40, 40, -60, 20, 30, new diffuse_light(new constant_texture(vec3(2, 2, 2)))));
+	hitable **objects = new hitable *[list.size()];
+	std::copy(list.begin(), list.end(), objects);
+	return new bvh_node(objects, int(list.size()), 0, 1);
+}
+
+hitable *simple_light(std::vector<hitable *> *lights = nullptr)
 {
-	texture *pertext = new noise_texture(4);
+	noise_texture *pertext = new noise_texture(4);
 	hitable **list = new hitable *[4];
 	list[0] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(pertext));
 	list[1] = new sphere(vec3(0, 2, 0), 2, new lambertian(pertext));
+	if (noise_bake_budget > 0)
+		bake_ground_and_sphere(pertext, list[1]);
 	//注意到我们设置的亮度大于(1,1,1)，允许其照亮其他东西
 	list[2] = new sphere(vec3(0, 7, 0), 2, new diffuse_light(new constant_texture(vec3(4, 4, 4))));
 	list[3] = new xy_rect(3, 5, 1, 3, -2, new diffuse_light(new constant_texture(vec3(4, 4, 4))));
+	if (lights)
+		*lights = {list[2], list[3]};
 	return new hitable_list(list, 4);
 }
 
-hitable *cornell_box()
+hitable *cornell_box(std::vector<hitable *> *lights = nullptr)
 {
 	hitable **list = new hitable *[8];
 	int i = 0;
@@ -124,6 +337,8 @@ hitable *cornell_box()
 	list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
 	list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
 	list[i++] = new xz_rect(213, 343, 227, 332, 554, light);
+	if (lights)
+		lights->push_back(list[i - 1]);
 	list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
 	list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
 	list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
@@ -132,54 +347,735 @@ hitable *cornell_box()
 	return new hitable_list(list, i);
 }
 
+//cornell_box里的两个盒子换成烟雾：矮的是均匀密度的白烟，高的是由turbulence控制密度的黑烟（delta tracking）
+hitable *cornell_smoke(std::vector<hitable *> *lights = nullptr, participating_media *media = nullptr)
+{
+	hitable **list = new hitable *[8];
+	int i = 0;
+	material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
+	material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
+	material *green = new lambertian(new constant_texture(vec3(0.12, 0.45, 0.15)));
+	material *light = new diffuse_light(new constant_texture(vec3(7, 7, 7)));
+	list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
+	list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
+	list[i++] = new xz_rect(113, 443, 127, 432, 554, light);
+	if (lights)
+		lights->push_back(list[i - 1]);
+	list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
+	list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
+	list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
+	hitable *b1 = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 165, 165), white), -18), vec3(130, 0, 65));
+	hitable *b2 = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white), 15), vec3(265, 0, 295));
+	int surfaces = i;
+	constant_medium *m1 = new constant_medium(b1, 0.01, new constant_texture(vec3(1.0, 1.0, 1.0)));
+	constant_medium *m2 = new constant_medium(b2, 0.03, new turbulence_texture(0.02), new constant_texture(vec3(0.1, 0.1, 0.1)));
+	list[i++] = m1;
+	list[i++] = m2;
+	if (media)
+		*media = {new hitable_list(list, surfaces), {m1, m2}};
+	return new hitable_list(list, i);
+}
+
+std::string cloud_volume_file;//--volume <file>：cloud场景的密度从体积网格文件读入，代替由turbulence生成
+std::string cloud_volume_save;//--save-volume <file>：把cloud场景生成的体积网格写成文件
+
+//cornell_box中间一团稀疏体积网格表示的云，delta tracking按网格的majorant格子跳过空白
+hitable *cloud(std::vector<hitable *> *lights = nullptr, participating_media *media = nullptr)
+{
+	hitable **list = new hitable *[7];
+	int i = 0;
+	material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
+	material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
+	material *green = new lambertian(new constant_texture(vec3(0.12, 0.45, 0.15)));
+	material *light = new diffuse_light(new constant_texture(vec3(7, 7, 7)));
+	list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
+	list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
+	list[i++] = new xz_rect(113, 443, 127, 432, 554, light);
+	if (lights)
+		lights->push_back(list[i - 1]);
+	list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
+	list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
+	list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
+
+	volume_grid *grid = new volume_grid;
+	std::string error;
+	if (cloud_volume_file.empty() || !read_volume_file(cloud_volume_file, *grid, error))
+	{
+		if (!cloud_volume_file.empty())
+			std::cerr << cloud_volume_file << ": " << error << ", generating the cloud instead\n";
+		*grid = turbulence_volume(aabb(vec3(60, 40, 100), vec3(495, 400, 460)), 128, 0.01, 0.3);
+	}
+	if (!cloud_volume_save.empty() && !write_volume_file(cloud_volume_save, *grid))
+		std::cerr << "cannot write " << cloud_volume_save << "\n";
+	std::cerr << "volume " << grid->nx << "x" << grid->ny << "x" << grid->nz << ", " << grid->brick_count() << " of "
+			  << grid->brick_index.size() << " bricks (" << (grid->bytes() >> 10) << " KB)\n";
+	grid_medium *cloud = new grid_medium(grid, 0.1, new constant_texture(vec3(0.9, 0.9, 0.9)));
+	if (media)
+		*media = {new hitable_list(list, i), {cloud}};
+	list[i++] = cloud;
+	return new hitable_list(list, i);
+}
+
+//LED墙：地面上几个球，后面一面由rows x cols块彩色小灯板组成的墙，地面边缘还有一排发光小球。
+//几百个光源里只有少数对一个着色点有明显贡献，均匀选光源时大部分阴影光线是浪费的
+hitable *led_wall(std::vector<hitable *> *lights = nullptr, int cols = 32, int rows = 12)
+{
+	std::vector<hitable *> objects;
+	material *floor = new lambertian(new constant_texture(vec3(0.5, 0.5, 0.5)));
+	material *wall = new lambertian(new constant_texture(vec3(0.1, 0.1, 0.1)));
+	objects.push_back(new xz_rect(-200, 755, -400, 600, 0, floor));
+	objects.push_back(new xy_rect(-200, 755, 0, 500, 560, wall));
+	const vec3 palette[4] = {vec3(8, 1, 1), vec3(1, 8, 1), vec3(1, 1, 8), vec3(6, 6, 6)};
+	std::vector<material *> led(4);
+	for (int c = 0; c < 4; c++)
+		led[c] = new diffuse_light(new constant_texture(palette[c]));
+	real w = 900.0 / cols, h = 400.0 / rows;
+	for (int j = 0; j < rows; j++)
+		for (int i = 0; i < cols; i++)
+		{
+			real x = -172 + i * w, y = 60 + j * h;
+			hitable *panel = new xy_rect(x, x + 0.8 * w, y, y + 0.8 * h, 555, led[hash_u32(j * cols + i) % 4]);
+			objects.push_back(panel);
+			if (lights)
+				lights->push_back(panel);
+		}
+	material *bulb = new diffuse_light(new constant_texture(vec3(10, 8, 5)));
+	for (int i = 0; i < 16; i++)
+	{
+		hitable *s = new sphere(vec3(-100 + i * 50, 6, -150), 6, bulb);
+		objects.push_back(s);
+		if (lights)
+			lights->push_back(s);
+	}
+	objects.push_back(new sphere(vec3(150, 80, 250), 80, new lambertian(new constant_texture(vec3(0.7, 0.3, 0.2)))));
+	objects.push_back(new sphere(vec3(330, 80, 200), 80, new metal(vec3(0.8, 0.8, 0.8), 0.1)));
+	objects.push_back(new sphere(vec3(480, 60, 120), 60, new dielectric(1.5)));
+	hitable **list = new hitable *[objects.size()];
+	std::copy(objects.begin(), objects.end(), list);
+	return new bvh_node(list, int(objects.size()), 0, 1);
+}
+
+//发光带纹理的光源：天花板上一块以地图图片发光的灯板，和一个噪声条纹发光的球。
+//灯板上海洋暗、陆地亮，球上亮暗条纹相间，按面积均匀取点时很多阴影光线落在暗处
+hitable *textured_lights(std::vector<hitable *> *lights = nullptr)
+{
+	std::vector<hitable *> objects;
+	material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
+	objects.push_back(new xz_rect(-400, 400, -400, 400, 0, white));
+	objects.push_back(new xy_rect(-400, 400, 0, 400, 300, white));
+	hitable *panel = new flip_normals(new xz_rect(-150, 150, -50, 250, 300,
+			new diffuse_light(new scale_texture(load_image_texture("../texture/earthmap.jpg"), vec3(6, 6, 6)))));
+	objects.push_back(panel);
+	hitable *globe = new sphere(vec3(150, 60, -80), 60, new diffuse_light(new scale_texture(new noise_texture(0.1), vec3(4, 4, 4))));
+	objects.push_back(globe);
+	if (lights)
+		*lights = {panel, globe};
+	objects.push_back(new sphere(vec3(-120, 80, 60), 80, white));
+	objects.push_back(new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(100, 160, 100), white), 20), vec3(-20, 0, 150)));
+	hitable **list = new hitable *[objects.size()];
+	std::copy(objects.begin(), objects.end(), list);
+	return new hitable_list(list, int(objects.size()));
+}
+
+//场景和与之配套的相机参数
+struct scene_setup
+{
+	hitable *world;
+	vec3 lookfrom, lookat;
+	float vfov;
+	float aperture;//光圈（透镜）大小
+	float dist_to_focus;//焦距长度 为对焦到lookat位置的 长度
+	bool differentials = false;//场景中有图片纹理时相机光线才带光线微分，否则多追踪的微分光线是白费的
+	std::vector<hitable *> lights;//可以直接采样的光源（--integrator nee），没有登记的发光物体只能由BSDF采样击中
+	participating_media media;//阴影光线用ratio tracking穿过的介质
+};
+
+scene_setup make_scene(const std::string &name, int random_grid = 5)
+{
+	//花括号初始化按从左到右的顺序求值，场景函数先填好lights、media再复制进scene_setup
+	std::vector<hitable *> lights;
+	participating_media media;
+	if (name == "random")
+		return {random_scene(random_grid), vec3(13, 2, 3), vec3(0, 0, 0), 20.0, 0.1, 10.0};
+	if (name == "perlin")
+		return {two_perlin_spheres(), vec3(13, 2, 3), vec3(0, 0, 0), 20.0, 0.0, 10.0};
+	if (name == "earth")
+		return {earth(), vec3(13, 2, 3), vec3(0, 0, 0), 20.0, 0.0, 10.0, true};
+	if (name == "earths")
+		return {earth_field(), vec3(0, 4, 10), vec3(0, 1, -10), 40.0, 0.0, 10.0, true};
+	if (name == "light")
+		return {simple_light(&lights), vec3(26, 3, 6), vec3(0, 2, 0), 20.0, 0.0, 10.0, false, lights};
+	if (name == "smoke")
+		return {cornell_smoke(&lights, &media), vec3(278, 278, -800), vec3(278, 278, 0), 40.0, 0.0, 10.0, false, lights, media};
+	if (name == "cloud")
+		return {cloud(&lights, &media), vec3(278, 278, -800), vec3(278, 278, 0), 40.0, 0.0, 10.0, false, lights, media};
+	if (name == "ledwall")
+		return {led_wall(&lights), vec3(278, 200, -700), vec3(278, 180, 300), 45.0, 0.0, 10.0, false, lights};
+	if (name == "texlight")
+		return {textured_lights(&lights), vec3(0, 200, -700), vec3(0, 120, 0), 45.0, 0.0, 10.0, false, lights};
+	if (name != "cornell")
+		std::cerr << "unknown scene " << name << ", using cornell\n";
+	return {cornell_box(&lights), vec3(278, 278, -800), vec3(278, 278, 0), 40.0, 0.0, 10.0, false, lights};
+}
+
+//由场景文件（scene_file.h）建立场景，与RayGL_Win的GPU路径读的是同一个文件
+bool file_scene(const std::string &path, scene_setup &setup)
+{
+	scene_desc desc;
+	std::string error;
+	if (!read_scene_file(path, desc, error))
+	{
+		std::cerr << error << "\n";
+		return false;
+	}
+	vec3 lookfrom = scene_vec3(desc.lookfrom), lookat = scene_vec3(desc.lookat);
+	scene_hitables h = scene_to_hitables(desc);
+	setup = {h.world, lookfrom, lookat, desc.vfov, desc.aperture, float((lookfrom - lookat).length()), false, h.lights};
+	return true;
+}
+
+//以一个带有关键帧动画的random_scene作为序列渲染的场景
+struct animation
+{
+	hitable *ground;//地面球半径太大，放在bvh外面，否则它会主导SAH代价
+	hitable **list;//bvh的叶子物体，重建bvh时需要用到
+	int n;
+	std::vector<keyframed *> animated;//每帧需要更新位置的物体
+	camera_path path;
+};
+
+animation animated_scene(int frames)
+{
+	animation anim;
+	anim.list = new hitable *[103];
+	int i = 0;
+	texture *checker = new checker_texture(new constant_texture(vec3(0.2, 0.3, 0.1)),
+										   new constant_texture(vec3(0.9, 0.9, 0.9)));
+	anim.ground = new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker));
+	for (int a = -5; a < 5; a++)
+	{
+		for (int b = -5; b < 5; b++)
+		{
+			vec3 center(a + 0.9 * drand48(), 0.2, b + 0.9 * drand48());
+			anim.list[i++] = new sphere(center, 0.2, new lambertian(new constant_texture(
+					vec3(drand48() * drand48(), drand48() * drand48(), drand48() * drand48()))));
+		}
+	}
+
+	//三个大球在场景里来回弹跳和平移
+	hitable *big[3] = {
+			new sphere(vec3(0, 1, 0), 1.0, new dielectric(1.5)),
+			new sphere(vec3(-4, 1, 0), 1.0, new lambertian(new constant_texture(vec3(0.4, 0.2, 0.1)))),
+			new sphere(vec3(4, 1, 0), 1.0, new metal(vec3(0.7, 0.6, 0.5), 0.0))};
+	for (int k = 0; k < 3; k++)
+	{
+		std::vector<object_keyframe> keys;
+		keys.push_back({0, vec3(0, 0, 0)});
+		keys.push_back({frames * 0.25f, vec3(0, 1.5f + k, 0)});
+		keys.push_back({frames * 0.5f, vec3(0, 0, 0)});
+		keys.push_back({float(frames), vec3(2.0f - 2 * k, 0, 3)});
+		auto *obj = new keyframed(big[k], keys);
+		anim.animated.push_back(obj);
+		anim.list[i++] = obj;
+	}
+	anim.n = i;
+	anim.path = camera_path::orbit(vec3(0, 0.5, 0), 13, 1.5, frames);
+	return anim;
+}
+
+//像素(i, j)第s0到s1-1个样本的颜色之和（线性，未除以样本数，也没有做gamma）
+//nee不为空时用带直接光照采样的color_nee()
+vec3 render_pixel(hitable *world, camera &cam, int i, int j, int nx, int ny, int s0, int s1,
+				  const material_table *table = nullptr, const nee_scene *nee = nullptr)
+{
+	vec3 col(0, 0, 0);
+	for (int s = s0; s < s1; s++)//通过ns次的模糊化后，进行抗锯齿
+	{
+		//像素内的抖动是每个样本的第一对维度，其后是透镜、时间和各次弹射
+		if (active_sampler)
+			active_sampler->start_pixel_sample(i, j, s);
+		float du, dv;
+		sample_2d(du, dv);
+		float u = float(i + du) / float(nx);
+		float v = float(j + dv) / float(ny);
+		ray r = cam.get_ray(u, v);
+		if (nee)
+			col += color_nee(r, world, *nee, 0, bounce_info());
+		else
+			col += table ? color_table(r, world, *table, 0) : color(r, world, 0);
+	}
+	return col;
+}
+
+//把一帧画面渲染到framebuffer中（按ppm的行序，从上往下）
+//table不为空时使用material_table分派材质
+void render(hitable *world, camera &cam, int nx, int ny, int ns, std::vector<vec3> &framebuffer,
+			const material_table *table = nullptr, const nee_scene *nee = nullptr)
+{
+	framebuffer.resize(nx * ny);
+	for (int j = ny - 1; j >= 0; j--)
+	{
+		for (int i = 0; i < nx; i++)
+		{
+			vec3 col = render_pixel(world, cam, i, j, nx, ny, 0, ns, table, nee) / float(ns);
+			framebuffer[(ny - 1 - j) * nx + i] = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
+		}
+	}
+}
+
+//按tile x tile的块渲染，每个样本把块内所有像素的相机光线组成一个光线包求第一次交点，
+//之后的弹射退回到单条光线的color()。光圈不为0时相机光线的原点各不相同，区间测试同样成立
+void render_packets(hitable *world, camera &cam, int nx, int ny, int ns, int tile, std::vector<vec3> &framebuffer)
+{
+	framebuffer.assign(nx * ny, vec3(0, 0, 0));
+	ray_packet packet;
+	for (int y0 = 0; y0 < ny; y0 += tile)
+	{
+		for (int x0 = 0; x0 < nx; x0 += tile)
+		{
+			int x1 = std::min(x0 + tile, nx), y1 = std::min(y0 + tile, ny);
+			for (int s = 0; s < ns; s++)
+			{
+				packet.clear();
+				for (int j = y0; j < y1; j++)
+					for (int i = x0; i < x1; i++)
+						packet.add(cam.get_ray(float(i + drand48()) / float(nx), float(j + drand48()) / float(ny)));
+				packet.trace(world, ray_epsilon);
+				int k = 0;
+				for (int j = y0; j < y1; j++)
+					for (int i = x0; i < x1; i++, k++)
+						framebuffer[(ny - 1 - j) * nx + i] += packet.hit[k] ? shade(packet.rays[k], packet.rec[k], world, 0)
+																			 : background(packet.rays[k]);
+			}
+		}
+	}
+	for (vec3 &col : framebuffer)
+	{
+		col /= float(ns);
+		col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
+	}
+}
+
+void write_ppm(const std::string &path, const std::vector<vec3> &framebuffer, int nx, int ny)
+{
+	std::ofstream file(path);
+	file << "P3\n" << nx << " " << ny << "\n255\n";
+	for (const vec3 &col : framebuffer)
+	{
+		int ir = int(255.99 * col[0]);
+		int ig = int(255.99 * col[1]);
+		int ib = int(255.99 * col[2]);
+		file << ir << " " << ig << " " << ib << "\n";
+	}
+}
+
+//在一个进程里渲染整段动画：场景、纹理和framebuffer在各帧之间复用，
+//每帧只对bvh做refit，当SAH代价超过刚建树时的rebuild_threshold倍才重新建树
+void render_sequence(animation &anim, int frames, int nx, int ny, int ns, float rebuild_threshold,
+					 const std::string &prefix)
+{
+	std::vector<vec3> framebuffer(nx * ny);
+	for (keyframed *obj : anim.animated)
+		obj->set_time(0);
+	bvh_node *bvh = new bvh_node(anim.list, anim.n, 0, 1);
+	float built_cost = bvh->sah_cost();
+	hitable *scene[2] = {anim.ground, bvh};
+	hitable_list world(scene, 2);
+
+	for (int f = 0; f < frames; f++)
+	{
+		float time = float(f);
+		if (f > 0)
+		{
+			for (keyframed *obj : anim.animated)
+				obj->set_time(time);
+			bvh->refit(0, 1);
+			float cost = bvh->sah_cost();
+			if (cost > rebuild_threshold * built_cost)
+			{
+				std::cerr << "frame " << f << ": SAH cost " << cost << " > " << rebuild_threshold << " x "
+						  << built_cost << ", rebuilding bvh\n";
+				bvh_node::destroy(bvh);
+				bvh = new bvh_node(anim.list, anim.n, 0, 1);
+				built_cost = bvh->sah_cost();
+				scene[1] = bvh;
+			}
+		}
+
+		vec3 lookfrom, lookat;
+		anim.path.at(time, lookfrom, lookat);
+		camera cam(lookfrom, lookat, vec3(0, 1, 0), 20.0, float(nx) / float(ny), 0.0, 10.0, 0.0, 1.0);
+		render(&world, cam, nx, ny, ns, framebuffer);
+
+		char name[16];
+		snprintf(name, sizeof(name), "%04d.ppm", f);
+		write_ppm(prefix + name, framebuffer, nx, ny);
+		std::cerr << "frame " << f + 1 << "/" << frames << " done\n";
+	}
+	bvh_node::destroy(bvh);
+}
+
 int main(int argc, char* argv[])
 {
 	//画面是200*100
 	int nx = 400;
 	int ny = 200;
 	int ns = 100;//对一个像素点重复采样进行抗锯齿
-	std::ofstream file;
-	file.open("../output/Part2/instance2.ppm");
 
-	file << "P3\n" << nx << " " << ny << "\n255\n";
+	//--sequence <帧数>：渲染一段转台动画，输出到../output/sequence/
+	int frames = 0;
+	float rebuild_threshold = 1.5;
+	std::string scene_name = "cornell";
+	std::string scene_file;//--scene-file <path>：从场景文件读入场景，代替--scene
+	bool use_table = false;//--materials table：使用material_table分派材质
+	bool bench_materials = false;//--bench-materials：对比虚函数与material_table两种材质分派的耗时
+	bool wavefront = false;//--integrator wavefront：使用按阶段批处理的wavefront积分器代替color()的递归
+	bool nee = false;//--integrator nee：在非镜面散射点上对光源做直接采样（color_nee）
+	bool uniform_lights = false;//--light-sampling uniform：nee等概率地选光源，而不是按light_bvh估计的贡献
+	int emission_res = 32;//--emission-res <n>：光源发光制表的分辨率n x n，0表示在光源表面上均匀取点
+	int packet = 0;//--packet 4|8：相机光线按4x4或8x8的光线包追踪
+	bool sort_rays = false;//--sort-rays：wavefront积分器中对二次弹射光线按原点和方向分bin排序
+	int random_grid = 5;//--random-grid <n>：random场景中小球网格的半宽
+	bool bench_vec3 = false;//--bench-vec3：测量perlin::noise与整帧渲染的耗时，用来对比标量和SIMD的vec3
+	bool check_noise = false;//--check-noise：校验SIMD的perlin与标量实现逐位一致，并比较耗时
+	size_t texture_cache_mb = 0;//--texture-cache <MB>：tile缓存的内存上限，0表示不用分块纹理
+	bool differentials = true;//--no-differentials：相机光线不带光线微分，图片纹理只在最精细的mip层上采样
+	std::string sampler_name;//--sampler independent|stratified|sobol：像素、透镜、时间和弹射用的采样器
+	int workers = 0;//--workers <n>：fork出n个worker进程按tile渲染，再在本进程拼成整幅画面
+	int crash_worker = -1;//--crash-worker <i>：第i个worker完成一个tile后退出，用来检验tile重新排队
+	bool spp_range = false;//--spp-range <s0> <s1>：只渲染每个像素的第s0到s1-1个样本，输出累加文件
+	int spp0 = 0, spp1 = 0;
+	std::string accum_path;//--accum <path>：累加文件的路径
+	for (int a = 1; a < argc; a++)
+	{
+		if (strcmp(argv[a], "--sequence") == 0 && a + 1 < argc)
+			frames = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--rebuild-threshold") == 0 && a + 1 < argc)
+			rebuild_threshold = atof(argv[++a]);
+		else if (strcmp(argv[a], "--size") == 0 && a + 3 < argc)
+		{
+			nx = atoi(argv[++a]);
+			ny = atoi(argv[++a]);
+			ns = atoi(argv[++a]);
+		}
+		else if (strcmp(argv[a], "--scene") == 0 && a + 1 < argc)
+			scene_name = argv[++a];
+		else if (strcmp(argv[a], "--scene-file") == 0 && a + 1 < argc)
+			scene_file = argv[++a];
+		else if (strcmp(argv[a], "--materials") == 0 && a + 1 < argc)
+			use_table = strcmp(argv[++a], "table") == 0;
+		else if (strcmp(argv[a], "--bench-materials") == 0)
+			bench_materials = true;
+		else if (strcmp(argv[a], "--integrator") == 0 && a + 1 < argc)
+		{
+			a++;
+			wavefront = strcmp(argv[a], "wavefront") == 0;
+			nee = strcmp(argv[a], "nee") == 0;
+		}
+		else if (strcmp(argv[a], "--light-sampling") == 0 && a + 1 < argc)
+			uniform_lights = strcmp(argv[++a], "uniform") == 0;
+		else if (strcmp(argv[a], "--emission-res") == 0 && a + 1 < argc)
+			emission_res = std::max(atoi(argv[++a]), 0);
+		else if (strcmp(argv[a], "--packet") == 0 && a + 1 < argc)
+			packet = std::min(atoi(argv[++a]), 8);
+		else if (strcmp(argv[a], "--sort-rays") == 0)
+			sort_rays = wavefront = true;
+		else if (strcmp(argv[a], "--random-grid") == 0 && a + 1 < argc)
+			random_grid = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--bench-vec3") == 0)
+			bench_vec3 = true;
+		else if (strcmp(argv[a], "--no-differentials") == 0)
+			differentials = false;
+		else if (strcmp(argv[a], "--bake-noise") == 0 && a + 1 < argc)
+			noise_bake_budget = size_t(atoi(argv[++a])) << 20;
+		else if (strcmp(argv[a], "--volume") == 0 && a + 1 < argc)
+			cloud_volume_file = argv[++a];
+		else if (strcmp(argv[a], "--save-volume") == 0 && a + 1 < argc)
+			cloud_volume_save = argv[++a];
+		else if (strcmp(argv[a], "--check-noise") == 0)
+			check_noise = true;
+		else if (strcmp(argv[a], "--texture-cache") == 0 && a + 1 < argc)
+			texture_cache_mb = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--sampler") == 0 && a + 1 < argc)
+			sampler_name = argv[++a];
+		else if (strcmp(argv[a], "--workers") == 0 && a + 1 < argc)
+			workers = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--crash-worker") == 0 && a + 1 < argc)
+			crash_worker = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--spp-range") == 0 && a + 2 < argc)
+		{
+			spp_range = true;
+			spp0 = atoi(argv[++a]);
+			spp1 = atoi(argv[++a]);
+		}
+		else if (strcmp(argv[a], "--accum") == 0 && a + 1 < argc)
+			accum_path = argv[++a];
+	}
+	//--spp-range的结果要能检出不同的输入，场景文件和体积文件按渲染开始前读到的内容计入哈希
+	std::string input_hashes;
+	if (spp_range)
+	{
+		if (!scene_file.empty())
+			input_hashes += " scene file " + std::to_string(fnv1a_file(scene_file));
+		if (!cloud_volume_file.empty())
+			input_hashes += " volume file " + std::to_string(fnv1a_file(cloud_volume_file));
+	}
+	if (!spp_range)
+		spp1 = ns;
+	else if (spp0 < 0 || spp0 >= spp1 || spp1 > ns)
+	{
+		std::cerr << "--spp-range needs 0 <= s0 < s1 <= spp (" << ns << ")\n";
+		return 1;
+	}
+	if ((workers > 0 || spp_range) && (wavefront || packet > 0))
+	{
+		std::cerr << "--workers and --spp-range render with the recursive integrator only\n";
+		return 1;
+	}
+	//多进程、分段渲染要求每个样本的随机数只由像素和样本编号决定，默认用逐样本设种子的independent
+	if ((workers > 0 || spp_range) && sampler_name.empty())
+		sampler_name = "independent";
+
+	//只有逐像素递归的render()按像素、样本编号驱动sampler；wavefront和光线包仍然直接用drand48
+	std::unique_ptr<sampler> pixel_sampler;
+	if (!sampler_name.empty())
+	{
+		pixel_sampler.reset(make_sampler(sampler_name, ns));
+		if (!pixel_sampler)
+		{
+			std::cerr << "unknown sampler " << sampler_name << "\n";
+			return 1;
+		}
+		if (wavefront || packet > 0)
+			std::cerr << "--sampler is ignored by the wavefront and packet renderers\n";
+		else
+			active_sampler = pixel_sampler.get();
+	}
+
+	if (check_noise)
+	{
+		perlin noise;
+		const int points = 1 << 20;
+		std::vector<vec3> p(points);
+		for (int i = 0; i < points; i++)
+			p[i] = vec3(100 * drand48() - 50, 100 * drand48() - 50, 100 * drand48() - 50);
+		std::vector<float> scalar(points), batch(points);
 
-	//hitable *world = random_scene();
-	//hitable *world = two_perlin_spheres();
-	//hitable *world = earth();
-	//hitable *world = simple_light();
-	hitable *world = cornell_box();
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < points; i++)
+			scalar[i] = noise.noise(p[i]);
+		double t_scalar = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		start = std::chrono::steady_clock::now();
+		noise.noise(p.data(), batch.data(), points);
+		double t_batch = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		//逐位比较；FMA收缩标量代码（如-march=native）或者real为double时会有末位差异，同时给出最大误差
+		auto compare = [&](const char *name, double t0, double t1) {
+			int mismatches = 0;
+			float max_error = 0;
+			for (int i = 0; i < points; i++)
+			{
+				mismatches += memcmp(&scalar[i], &batch[i], sizeof(float)) != 0;
+				max_error = std::max(max_error, std::fabs(scalar[i] - batch[i]));
+			}
+			std::cout << name << ": scalar " << t0 / points * 1e9 << " ns, simd " << t1 / points * 1e9 << " ns, "
+					  << mismatches << "/" << points << " mismatches, max error " << max_error << "\n";
+			return mismatches;
+		};
+		int mismatches = compare("noise", t_scalar, t_batch);
+
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < points; i++)
+			scalar[i] = noise.turb_scalar(p[i]);
+		t_scalar = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < points; i++)
+			batch[i] = noise.turb(p[i]);
+		t_batch = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		mismatches += compare("turb", t_scalar, t_batch);
+		return mismatches == 0 ? 0 : 1;
+	}
 
-	vec3 lookfrom(278,278,-800);
-	vec3 lookat(278,278,0);
+	if (frames > 0)
+	{
+		std::filesystem::create_directories("../output/sequence");
+		animation anim = animated_scene(frames);
+		render_sequence(anim, frames, nx, ny, ns, rebuild_threshold, "../output/sequence/frame_");
+		return 0;
+	}
+
+	if (texture_cache_mb > 0)
+		tile_cache = new texture_cache(texture_cache_mb << 20);
+	scene_setup scene;
+	if (scene_file.empty())
+		scene = make_scene(scene_name, random_grid);
+	else if (file_scene(scene_file, scene))
+		scene_name = scene_file;
+	else
+		return 1;
+	hitable *world = scene.world;
+	std::unique_ptr<light_bvh> lights;
+	if (nee)
+	{
+		if (packet > 0)
+		{
+			std::cerr << "--integrator nee does not support --packet\n";
+			return 1;
+		}
+		auto start = std::chrono::steady_clock::now();
+		lights.reset(new light_bvh(scene.lights, emission_res));
+		lights->uniform = uniform_lights;
+		std::cerr << "lights: " << lights->size() << " (" << lights->skipped << " skipped, " << lights->tabulated
+				  << " with tabulated emission), light bvh depth " << lights->depth
+				  << (uniform_lights ? ", uniform selection" : "") << ", "
+				  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s\n";
+	}
+	nee_scene nee_info{lights.get(), scene.media.surfaces ? scene.media.surfaces : world, scene.media.media};
 	const vec3 vup(0,1,0);
-	const float fov = 40.0;
-	float dist_to_focus = 10;//焦距长度 为对焦到lookat位置的 长度
-	float aperture = 0.0;//光圈（透镜）大小
-	camera cam(lookfrom, lookat, vup, fov, float(nx) / float(ny), aperture, dist_to_focus, 0.0, 1.0);
+	camera cam(scene.lookfrom, scene.lookat, vup, scene.vfov, float(nx) / float(ny), scene.aperture,
+			   scene.dist_to_focus, 0.0, 1.0);
+	if (scene.differentials && differentials)
+		cam.set_resolution(nx, ny);
 
-	for (int j = ny - 1; j >= 0; j--)
+	std::vector<vec3> framebuffer;
+	std::vector<float> image;//按样本段或多进程渲染时每个像素的线性颜色之和，行序从下往上
+	material_table table;
+	table.add_scene(world);
+	if (bench_vec3)
 	{
-		for (int i = 0; i < nx; i++)
+#ifdef RAYTRACE_SIMD_VEC3
+		std::cout << "vec3: simd (" << simd_backend() << "), sizeof(vec3) = " << sizeof(vec3) << "\n";
+#else
+		std::cout << "vec3: scalar, sizeof(vec3) = " << sizeof(vec3) << "\n";
+#endif
+		perlin noise;
+		const int points = 1 << 22;
+		float sum = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < points; i++)
+			sum += noise.noise(vec3(i * 0.0137f, i * 0.0071f, i * 0.0029f));
+		double t_noise = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "perlin::noise: " << t_noise / points * 1e9 << " ns/call (checksum " << sum << ")\n";
+
+		start = std::chrono::steady_clock::now();
+		render(world, cam, nx, ny, ns, framebuffer);
+		std::cout << "render " << scene_name << " " << nx << "x" << ny << " spp " << ns << ": "
+				  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s\n";
+		return 0;
+	}
+	if (bench_materials)
+	{
+		//两种分派交替各渲染两次取最快的一次；每次渲染使用同样的随机数序列，结果应当逐像素一致
+		std::vector<vec3> reference;
+		double t_virtual = 1e30, t_table = 1e30;
+		for (int round = 0; round < 2; round++)
 		{
-			vec3 col(0, 0, 0);
-			for (int s = 0; s < ns; s++)//通过ns次的模糊化后，进行抗锯齿
-			{
-				//drand48生成一个[0,1)之间的double
-				float u = float(i + drand48()) / float(nx);
-				float v = float(j + drand48()) / float(ny);
-				ray r = cam.get_ray(u, v);
-				vec3 p = r.point_at_parameter(2.0);
-				col += color(r, world, 0);
-			}
-			col /= float(ns);
-			col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
+			srand48(1);
+			auto start = std::chrono::steady_clock::now();
+			render(world, cam, nx, ny, ns, reference);
+			auto mid = std::chrono::steady_clock::now();
+			srand48(1);
+			render(world, cam, nx, ny, ns, framebuffer, &table);
+			auto end = std::chrono::steady_clock::now();
+			t_virtual = std::min(t_virtual, std::chrono::duration<double>(mid - start).count());
+			t_table = std::min(t_table, std::chrono::duration<double>(end - mid).count());
+		}
 
-			int ir = int(255.99 * col[0]);
-			int ig = int(255.99 * col[1]);
-			int ib = int(255.99 * col[2]);
+		float max_diff = 0;
+		for (size_t i = 0; i < framebuffer.size(); i++)
+			for (int c = 0; c < 3; c++)
+				max_diff = ffmax(max_diff, fabs(framebuffer[i][c] - reference[i][c]));
+		std::cout << "scene " << scene_name << " " << nx << "x" << ny << " spp " << ns << "\n"
+				  << "virtual dispatch: " << t_virtual << " s\n"
+				  << "material_table:   " << t_table << " s (" << t_virtual / t_table << "x), "
+				  << table.materials.size() << " materials, " << table.textures.size() << " textures\n"
+				  << "max pixel difference: " << max_diff << "\n";
+		return 0;
+	}
 
-			file << ir << " " << ig << " " << ib << "\n";
+	auto start = std::chrono::steady_clock::now();
+	if (wavefront)
+	{
+		wavefront_integrator integrator(world, table);
+		integrator.sort_rays = sort_rays;
+		integrator.render(cam, nx, ny, ns, framebuffer);
+		std::cerr << "rays traced: " << integrator.rays_traced << ", intersect time: " << integrator.intersect_seconds
+				  << " s (" << integrator.rays_traced / integrator.intersect_seconds / 1e6 << " Mrays/s), cache misses: ";
+		if (integrator.intersect_cache_misses > 0)
+			std::cerr << integrator.intersect_cache_misses << " ("
+					  << double(integrator.intersect_cache_misses) / integrator.rays_traced << " per ray)\n";
+		else
+			std::cerr << "n/a\n";
+	}
+	else if (packet > 0)
+		render_packets(world, cam, nx, ny, ns, packet, framebuffer);
+	else if (workers > 0 || spp_range)
+	{
+		//每个像素求[spp0, spp1)这段样本的线性颜色之和，多进程时按tile分给worker
+		const material_table *dispatch = use_table ? &table : nullptr;
+		auto render_tile = [&](const farm_tile &t, float *out) {
+			for (int j = t.y0; j < t.y1; j++)
+				for (int i = t.x0; i < t.x1; i++, out += 3)
+				{
+					vec3 col = render_pixel(world, cam, i, j, nx, ny, spp0, spp1, dispatch, nee ? &nee_info : nullptr);
+					out[0] = col[0];
+					out[1] = col[1];
+					out[2] = col[2];
+				}
+		};
+		if (workers > 0)
+		{
+			farm_stats stats = render_farm(nx, ny, 32, workers, render_tile, image, crash_worker);
+			std::cerr << "farm: " << stats.tiles << " tiles, " << stats.requeued << " requeued, " << stats.local
+					  << " rendered locally, per worker:";
+			for (int n : stats.per_worker)
+				std::cerr << " " << n;
+			std::cerr << "\n";
+		}
+		else
+		{
+			image.resize(size_t(nx) * ny * 3);
+			render_tile({0, 0, 0, nx, ny}, image.data());
+		}
+		framebuffer.resize(nx * ny);
+		for (int j = 0; j < ny; j++)
+			for (int i = 0; i < nx; i++)
+			{
+				const float *c = &image[(size_t(j) * nx + i) * 3];
+				vec3 col = vec3(c[0], c[1], c[2]) / float(spp1 - spp0);
+				framebuffer[(ny - 1 - j) * nx + i] = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
+			}
+	}
+	else
+		render(world, cam, nx, ny, ns, framebuffer, use_table ? &table : nullptr, nee ? &nee_info : nullptr);
+	std::cerr << "render time: " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+			  << " s\n";
+	if (tile_cache)
+		std::cerr << "texture cache: " << tile_cache->hits << " hits, " << tile_cache->misses << " misses, "
+				  << tile_cache->evictions << " evictions, " << (tile_cache->resident_bytes() >> 10) << " KB resident\n";
+	if (spp_range)
+	{
+		//只输出累加文件，最终画面由accmerge合并各段之后得到
+		std::string scene_desc = scene_name + " grid " + std::to_string(random_grid) + " sampler " + sampler_name +
+								 " differentials " + std::to_string(scene.differentials && differentials) +
+								 " bake " + std::to_string(noise_bake_budget) + " tiles " + std::to_string(texture_cache_mb > 0) +
+								 " volume " + cloud_volume_file + " nee " + std::to_string(nee) +
+								 " uniform lights " + std::to_string(uniform_lights) + " emission res " + std::to_string(emission_res) + input_hashes;
+		std::vector<accum_pixel> pixels(size_t(nx) * ny);
+		for (int j = 0; j < ny; j++)
+			for (int i = 0; i < nx; i++)
+			{
+				const float *c = &image[(size_t(j) * nx + i) * 3];
+				pixels[size_t(ny - 1 - j) * nx + i] = {c[0], c[1], c[2], uint32_t(spp1 - spp0)};
+			}
+		if (accum_path.empty())
+			accum_path = "../output/Part2/instance2_" + std::to_string(spp0) + "_" + std::to_string(spp1) + ".acc";
+		if (!write_accum_file(accum_path, make_accum_header(nx, ny, ns, spp0, spp1, fnv1a(scene_desc)), pixels))
+		{
+			std::cerr << "cannot write " << accum_path << "\n";
+			return 1;
 		}
+		std::cerr << "samples [" << spp0 << ", " << spp1 << ") of " << ns << " -> " << accum_path << "\n";
+		return 0;
 	}
-	file.close();
-}
\ No newline at end of file
+	write_ppm("../output/Part2/instance2.ppm", framebuffer, nx, ny);
+}
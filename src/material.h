@@ -8,14 +8,7 @@
 #include "rays.h"
 #include "hitable.h"
 #include "texture.h"
-
-vec3 random_in_unit_sphere() {
-	vec3 p;
-	do {
-		p = 2.0*vec3(drand48(),drand48(),drand48()) - vec3(1,1,1);
-	} while (p.squared_length() >= 1.0);
-	return p;
-}
+#include "sampling.h"
 
 //镜面反射的反射光线方向
 vec3 reflect(const vec3 &v, const vec3 &n){
@@ -43,6 +36,88 @@ bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted) {
 		return false;
 }
 
+//下面三个函数是各材质散射方向的计算，虚函数版本和material_table的switch版本共用同一份实现
+inline ray lambertian_scatter(const ray &r_in, const hit_record &rec)
+{
+	//按余弦加权在法线一侧的半球内取方向，pdf与cos/pi抵消，衰减仍然就是albedo
+	return ray(rec.p, random_cosine_direction(unit_vector(rec.normal)), r_in.time());//散射光线
+}
+
+//光线微分随镜面反射/折射一起传递：两条微分光线从相邻像素的击中点出发，
+//方向用那一点的法线做同样的弯折（bend返回false时放弃微分）
+template<typename F>
+inline void transfer_differentials(const ray &r_in, const hit_record &rec, ray &scattered, F bend)
+{
+	if (!r_in.has_differentials() || !rec.has_differentials)
+		return;
+	vec3 dx, dy;
+	if (bend(r_in.rx_direction(), rec.normal + rec.dndx, dx) && bend(r_in.ry_direction(), rec.normal + rec.dndy, dy))
+		scattered.set_differentials(rec.p + rec.dpdx, dx, rec.p + rec.dpdy, dy);
+}
+
+inline bool metal_scatter(float fuzz, const ray &r_in, const hit_record &rec, ray &scattered)
+{
+	vec3 jitter = fuzz * random_in_unit_sphere();
+	vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);//计算出反射光线方向
+	scattered = ray(rec.p, reflected + jitter);
+	transfer_differentials(r_in, rec, scattered, [&](const vec3 &d, const vec3 &n, vec3 &out) {
+		out = reflect(unit_vector(d), unit_vector(n)) + jitter;
+		return true;
+	});
+	return (dot(scattered.direction(), rec.normal) > 0);//反射光线与法线呈锐角，证明散射成功
+}
+
+inline ray dielectric_scatter(float ref_idx, const ray &r_in, const hit_record &rec)
+{
+	vec3 outward_normal;//建立一个与入射光线恒为钝角的法线
+	vec3 reflected = reflect(r_in.direction(), rec.normal);//计算反射光线方向
+	float ni_over_nt;//即为ni/nt（ni是入射光原来的介质，nt是要进入的介质）
+	vec3 refracted;//保存计算得到的折射光线的方向
+
+	float reflect_prob;
+	float cosine;
+
+	//让outward_normal始终是介质法线，与入射光线呈钝角；确定折光率n之比（ni是入射光原来的介质，nt是要进入的介质）
+	if (dot(r_in.direction(), rec.normal) > 0)//从球体内射出（光密射光疏，可能全反射）
+	{
+		outward_normal = -rec.normal;
+		ni_over_nt = ref_idx;
+
+		cosine = dot(r_in.direction(), rec.normal) / r_in.direction().length();
+		cosine = sqrt(1 - ref_idx * ref_idx * (1 - cosine * cosine));
+	}
+	else//从球体外射入（光密射光密，不可能有全反射）
+	{
+		outward_normal = rec.normal;
+		ni_over_nt = 1.0 / ref_idx;//恒<1，代入下面计算可知一定不可能会全反射
+
+		cosine = -dot(r_in.direction(), rec.normal) / r_in.direction().length();
+	}
+	if (refract(r_in.direction(), outward_normal, ni_over_nt, refracted))
+		reflect_prob = schlick(cosine, ref_idx);
+	else
+		reflect_prob = 1.0;
+	ray scattered;
+	if (sample_1d() < reflect_prob)
+	{
+		scattered = ray(rec.p, reflected);
+		transfer_differentials(r_in, rec, scattered, [&](const vec3 &d, const vec3 &n, vec3 &out) {
+			out = reflect(d, unit_vector(n));
+			return true;
+		});
+	}
+	else
+	{
+		scattered = ray(rec.p, refracted);
+		//微分光线一侧的法线与outward_normal同向
+		float side = dot(outward_normal, rec.normal) > 0 ? 1.0f : -1.0f;
+		transfer_differentials(r_in, rec, scattered, [&](const vec3 &d, const vec3 &n, vec3 &out) {
+			return refract(d, side * unit_vector(n), ni_over_nt, out);
+		});
+	}
+	return scattered;
+}
+
 class material
 {
 public:
@@ -50,6 +125,19 @@ public:
 
 	virtual vec3 emitted(float u, float v, const vec3 &p) const
 	{ return vec3(0, 0, 0); }//对于所有不发光的，一律设置发光是(0,0,0)，使之不产生叠加效应
+
+	//着色时是否需要光线微分：要么纹理需要足迹，要么镜面散射需要把微分继续传下去
+	virtual bool uses_differentials() const
+	{ return false; }
+
+	//next event estimation用：单位方向wi上的f*cos，以及scatter()采样到wi的立体角pdf。
+	//镜面材质只能由scatter()采样到，返回false
+	virtual bool eval(const ray &r_in, const hit_record &rec, const vec3 &wi, vec3 &f_cos, float &pdf) const
+	{ return false; }
+
+	//eval只在法线一侧不为0（表面），选光源时可以去掉法线背面的光源；介质的相函数返回false
+	virtual bool one_sided() const
+	{ return true; }
 };
 
 //漫反射
@@ -61,13 +149,25 @@ public:
 	//入射光，hit点的的记录，衰减，散射
 	virtual bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
 	{
-		vec3 target = rec.p + rec.normal + random_in_unit_sphere();//进行漫反射随机化反射方向
-		scattered = ray(rec.p, target - rec.p, r_in.time());//散射光线
-		attenuation = albedo->value(rec.u, rec.v, rec.p);//需要在反射强度上通过u,v值进行控制
+		scattered = lambertian_scatter(r_in, rec);
+		attenuation = albedo->filtered_value(rec.u, rec.v, rec.p, rec.du, rec.dv);//需要在反射强度上通过u,v值进行控制
+		return true;
+	}
+
+	virtual bool uses_differentials() const
+	{ return albedo->filtered(); }
+
+	//与lambertian_scatter的余弦加权采样对应：pdf = cos/pi，f*cos = albedo*cos/pi
+	virtual bool eval(const ray &r_in, const hit_record &rec, const vec3 &wi, vec3 &f_cos, float &pdf) const
+	{
+		float cosine = dot(unit_vector(rec.normal), wi);
+		pdf = cosine > 0 ? cosine / M_PI : 0;
+		f_cos = albedo->filtered_value(rec.u, rec.v, rec.p, rec.du, rec.dv) * pdf;
 		return true;
 	}
 
 private:
+	friend class material_table;
 	texture *albedo;//反射率（根据绑定的纹理内容进行处理）
 };
 
@@ -83,13 +183,15 @@ public:
 
 	virtual bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
 	{
-		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);//计算出反射光线方向
-		scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere());
 		attenuation = albedo;
-		return (dot(scattered.direction(), rec.normal) > 0);//反射光线与法线呈锐角，证明散射成功
+		return metal_scatter(fuzz, r_in, rec, scattered);
 	}
 
+	virtual bool uses_differentials() const
+	{ return true; }
+
 private:
+	friend class material_table;
 	vec3 albedo;//反射率
 	float fuzz;//反射光线模糊率[0,1]
 };
@@ -101,43 +203,16 @@ public:
 
 	virtual bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
 	{
-		vec3 outward_normal;//建立一个与入射光线恒为钝角的法线
-		vec3 reflected = reflect(r_in.direction(), rec.normal);//计算反射光线方向
-		float ni_over_nt;//即为ni/nt（ni是入射光原来的介质，nt是要进入的介质）
 		attenuation = vec3(1.0, 1.0, 1.0);//这里表面是glass，即设定折射界面不会吸收光线
-		vec3 refracted;//保存计算得到的折射光线的方向
-
-		float reflect_prob;
-		float cosine;
-
-		//让outward_normal始终是介质法线，与入射光线呈钝角；确定折光率n之比（ni是入射光原来的介质，nt是要进入的介质）
-		if (dot(r_in.direction(), rec.normal) > 0)//从球体内射出（光密射光疏，可能全反射）
-		{
-			outward_normal = -rec.normal;
-			ni_over_nt = ref_idx;
-
-			cosine = dot(r_in.direction(), rec.normal) / r_in.direction().length();
-			cosine = sqrt(1 - ref_idx * ref_idx * (1 - cosine * cosine));
-		}
-		else//从球体外射入（光密射光密，不可能有全反射）
-		{
-			outward_normal = rec.normal;
-			ni_over_nt = 1.0 / ref_idx;//恒<1，代入下面计算可知一定不可能会全反射
-
-			cosine = -dot(r_in.direction(), rec.normal) / r_in.direction().length();
-		}
-		if (refract(r_in.direction(), outward_normal, ni_over_nt, refracted))
-			reflect_prob = schlick(cosine, ref_idx);
-		else
-			reflect_prob = 1.0;
-		if (drand48() < reflect_prob)
-			scattered = ray(rec.p, reflected);
-		else
-			scattered = ray(rec.p, refracted);
+		scattered = dielectric_scatter(ref_idx, r_in, rec);
 		return true;
 	}
 
+	virtual bool uses_differentials() const
+	{ return true; }
+
 private:
+	friend class material_table;
 	float ref_idx;//球体材质折光率，一般恒>1
 };
 
@@ -154,6 +229,7 @@ public:
 	{ return emit->value(u, v, p); }
 
 private:
+	friend class material_table;
 	texture *emit;
 };
 
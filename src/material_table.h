@@ -0,0 +1,213 @@
+#ifndef RAYTRACE_MATERIAL_TABLE_H
+#define RAYTRACE_MATERIAL_TABLE_H
+
+#include <vector>
+#include <unordered_map>
+#include "material.h"
+#include "image_texture.h"
+#include "constant_medium.h"
+
+//material/texture的另一种表示：把虚函数对象编成紧凑的带标签记录，存在一张扁平的表里，
+//着色时用switch分派。常见的lambertian+constant_texture路径可以完全被编译器内联
+enum class texture_type : int
+{
+	constant,
+	checker,
+	noise,
+	image,
+	other//表不认识的纹理，退回虚函数调用
+};
+
+struct texture_record
+{
+	texture_type type;
+	int even, odd;//checker两个子纹理在表中的下标
+	vec3 color;
+	const texture *ptr;//noise/image/other时指向原对象
+};
+
+enum class material_type : int
+{
+	lambertian,
+	metal,
+	dielectric,
+	diffuse_light,
+	isotropic,
+	other//表不认识的材质，退回虚函数调用
+};
+
+struct material_record
+{
+	material_type type;
+	int tex;//lambertian、isotropic的albedo或diffuse_light的emit在纹理表中的下标
+	vec3 albedo;//metal的反射率
+	float param;//metal的fuzz或dielectric的折光率
+	const material *ptr;
+};
+
+class material_table : private material_binder
+{
+public:
+	//渲染前把场景用到的材质编入表中，并让每个物体记下自己材质的下标（hitable::bind_materials），
+	//之后表只读，着色时直接用hit()填好的hit_record::mat_id，mat_id为-1时scatter/emitted退回虚函数调用
+	void add_scene(hitable *world);
+
+	//du、dv是像素在uv空间中的足迹，只有image纹理会用到
+	vec3 texture_value(int tex, float u, float v, const vec3 &p, float du = 0, float dv = 0) const;
+
+	//与material::scatter/emitted含义相同，材质由hit_record::mat_id索引
+	bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const;
+	vec3 emitted(const hit_record &rec) const;
+
+	std::vector<material_record> materials;
+	std::vector<texture_record> textures;
+
+private:
+	//同一个材质只编一次
+	virtual int bind(const material *m);
+	int add(const material *m);
+	int add_texture(const texture *t);
+
+	std::unordered_map<const material *, int> ids;//只在编表时用
+};
+
+void material_table::add_scene(hitable *world)
+{ world->bind_materials(*this); }
+
+int material_table::bind(const material *m)
+{
+	if (!m)
+		return -1;
+	auto it = ids.find(m);
+	if (it != ids.end())
+		return it->second;
+	return ids[m] = add(m);
+}
+
+int material_table::add_texture(const texture *t)
+{
+	texture_record r{texture_type::other, -1, -1, vec3(0, 0, 0), t};
+	if (auto *c = dynamic_cast<const constant_texture *>(t))
+	{
+		r.type = texture_type::constant;
+		r.color = c->color;
+	}
+	else if (auto *c = dynamic_cast<const checker_texture *>(t))
+	{
+		r.type = texture_type::checker;
+		r.even = add_texture(c->even);
+		r.odd = add_texture(c->odd);
+	}
+	else if (dynamic_cast<const noise_texture *>(t))
+		r.type = texture_type::noise;
+	else if (dynamic_cast<const image_texture *>(t))
+		r.type = texture_type::image;
+	textures.push_back(r);
+	return int(textures.size()) - 1;
+}
+
+int material_table::add(const material *m)
+{
+	material_record r{material_type::other, -1, vec3(0, 0, 0), 0, m};
+	if (auto *l = dynamic_cast<const lambertian *>(m))
+	{
+		r.type = material_type::lambertian;
+		r.tex = add_texture(l->albedo);
+	}
+	else if (auto *mt = dynamic_cast<const metal *>(m))
+	{
+		r.type = material_type::metal;
+		r.albedo = mt->albedo;
+		r.param = mt->fuzz;
+	}
+	else if (auto *d = dynamic_cast<const dielectric *>(m))
+	{
+		r.type = material_type::dielectric;
+		r.param = d->ref_idx;
+	}
+	else if (auto *e = dynamic_cast<const diffuse_light *>(m))
+	{
+		r.type = material_type::diffuse_light;
+		r.tex = add_texture(e->emit);
+	}
+	else if (auto *i = dynamic_cast<const isotropic *>(m))
+	{
+		r.type = material_type::isotropic;
+		r.tex = add_texture(i->albedo);
+	}
+	materials.push_back(r);
+	return int(materials.size()) - 1;
+}
+
+inline vec3 material_table::texture_value(int tex, float u, float v, const vec3 &p, float du, float dv) const
+{
+	//checker的子纹理通过循环而不是递归处理
+	for (;;)
+	{
+		const texture_record &t = textures[tex];
+		switch (t.type)
+		{
+			case texture_type::constant:
+				return t.color;
+			case texture_type::checker:
+			{
+				float sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
+				tex = sines < 0 ? t.odd : t.even;
+				break;
+			}
+			case texture_type::noise:
+				return static_cast<const noise_texture *>(t.ptr)->noise_texture::value(u, v, p);
+			case texture_type::image:
+				return static_cast<const image_texture *>(t.ptr)->image_texture::filtered_value(u, v, p, du, dv);
+			default:
+				return t.ptr->filtered_value(u, v, p, du, dv);
+		}
+	}
+}
+
+inline bool material_table::scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
+{
+	if (rec.mat_id < 0)
+		return rec.mat_ptr->scatter(r_in, rec, attenuation, scattered);
+	const material_record &m = materials[rec.mat_id];
+	switch (m.type)
+	{
+		case material_type::lambertian:
+			scattered = lambertian_scatter(r_in, rec);
+			attenuation = texture_value(m.tex, rec.u, rec.v, rec.p, rec.du, rec.dv);
+			return true;
+		case material_type::metal:
+			attenuation = m.albedo;
+			return metal_scatter(m.param, r_in, rec, scattered);
+		case material_type::dielectric:
+			attenuation = vec3(1.0, 1.0, 1.0);
+			scattered = dielectric_scatter(m.param, r_in, rec);
+			return true;
+		case material_type::diffuse_light:
+			return false;
+		case material_type::isotropic:
+			scattered = ray(rec.p, random_unit_vector(), r_in.time());
+			attenuation = texture_value(m.tex, rec.u, rec.v, rec.p);
+			return true;
+		default:
+			return m.ptr->scatter(r_in, rec, attenuation, scattered);
+	}
+}
+
+inline vec3 material_table::emitted(const hit_record &rec) const
+{
+	if (rec.mat_id < 0)
+		return rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+	const material_record &m = materials[rec.mat_id];
+	switch (m.type)
+	{
+		case material_type::diffuse_light:
+			return texture_value(m.tex, rec.u, rec.v, rec.p);
+		case material_type::other:
+			return m.ptr->emitted(rec.u, rec.v, rec.p);
+		default:
+			return vec3(0, 0, 0);
+	}
+}
+
+#endif //RAYTRACE_MATERIAL_TABLE_H
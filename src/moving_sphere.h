@@ -6,18 +6,20 @@
 #define RAYTRACE_MOVING_SPHERE_H
 
 
-#include "hitable.h"
+#include "sphere.h"
 
 class moving_sphere : public hitable
 {
 public:
 	moving_sphere() = default;
 
-	moving_sphere(vec3 cen0, vec3 cen1, float t0, float t1, float r, material *m) :
+	moving_sphere(vec3 cen0, vec3 cen1, float t0, float t1, real r, material *m) :
 			center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), mat_ptr(m){}
 
-	virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+	virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
+	virtual void bind_materials(material_binder &binder)
+	{ mat_id = binder.bind(mat_ptr); }
 
 	vec3 center(float time) const
 	{
@@ -27,39 +29,22 @@ public:
 private:
 	vec3 center0, center1;
 	float time0, time1;
-	float radius;
+	real radius;
 	material *mat_ptr;
+	int mat_id = -1;
 };
 
-bool moving_sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
+bool moving_sphere::hit(const ray &r, real t_min, real t_max, hit_record &rec) const
 {
-	vec3 oc = r.origin() - center(r.time());
-	float a = dot(r.direction(), r.direction());
-	float b = dot(oc, r.direction());
-	float c = dot(oc, oc) - radius * radius;
-	float discriminant = b * b - a * c;
-	if (discriminant > 0)
-	{
-		float temp = (-b - sqrt(discriminant)) / a;//依旧是交点t的求根公式；变形是因为分子提出了2，所以与分母的2a中的2约去
-		if (temp < t_max && temp > t_min)//两个解中t小的那个光线击中了球面
-		{
-			rec.t = temp;
-			rec.p = r.point_at_parameter(rec.t);
-			rec.normal = (rec.p - center(r.time())) / radius;
-			rec.mat_ptr = mat_ptr;
-			return true;
-		}
-		temp = (-b + sqrt(discriminant)) / a;
-		if (temp < t_max && temp > t_min)//判定两个解大的那个光线是否击中球面
-		{
-			rec.t = temp;
-			rec.p = r.point_at_parameter(rec.t);
-			rec.normal = (rec.p - center(r.time())) / radius;
-			rec.mat_ptr = mat_ptr;
-			return true;
-		}
-	}
-	return false;
+	vec3 cen = center(r.time());
+	if (!sphere_intersect(cen, radius, r, t_min, t_max, rec.t))
+		return false;
+	rec.p = r.point_at_parameter(rec.t);
+	rec.normal = (rec.p - cen) / radius;
+	rec.mat_ptr = mat_ptr;
+	rec.mat_id = mat_id;
+	rec.prim = this;
+	return true;
 }
 
 bool moving_sphere::bounding_box(float t0, float t1, aabb &box) const
@@ -0,0 +1,167 @@
+#ifndef RAYTRACE_PACKET_H
+#define RAYTRACE_PACKET_H
+
+#include <stdint.h>
+#include "bvh.h"
+
+const int PACKET_MAX = 64;//最大8x8个像素一包
+
+//一个tile的相机光线组成的光线包。相机光线之间高度相干，
+//用所有光线原点和方向倒数的区间做区间算术，可以一次判定整个包都没有击中某个bvh节点
+struct ray_packet
+{
+	int n = 0;
+	ray rays[PACKET_MAX];
+	real t_max[PACKET_MAX];//每条光线当前最近的交点
+	bool hit[PACKET_MAX];
+	hit_record rec[PACKET_MAX];
+
+	void add(const ray &r)
+	{
+		rays[n] = r;
+		t_max[n] = FLT_MAX;
+		hit[n] = false;
+		n++;
+	}
+
+	void clear()
+	{ n = 0; }
+
+	//求整个包中最近的交点，结果写在hit/rec中
+	void trace(const hitable *world, real t_min);
+
+private:
+	void prepare_bounds();
+	bool may_hit(const aabb &box, real t_min) const;
+	uint64_t hit_mask(const aabb &box, real t_min, uint64_t active) const;
+	void traverse(const hitable *node, real t_min, uint64_t active);
+
+	vec3 org_lo, org_hi;//所有光线原点的区间
+	vec3 inv_lo, inv_hi;//所有光线方向倒数的区间
+	bool axis_valid[3];//方向分量在这个轴上同号时区间才是有界的
+	real t_max_hi;
+};
+
+void ray_packet::prepare_bounds()
+{
+	org_lo = org_hi = rays[0].origin();
+	vec3 d = rays[0].direction();
+	bool positive[3], negative[3];
+	for (int a = 0; a < 3; a++)
+	{
+		inv_lo[a] = inv_hi[a] = 1 / d[a];
+		positive[a] = d[a] > 0;
+		negative[a] = d[a] < 0;
+	}
+	for (int i = 1; i < n; i++)
+	{
+		vec3 o = rays[i].origin();
+		vec3 dir = rays[i].direction();
+		for (int a = 0; a < 3; a++)
+		{
+			org_lo[a] = ffmin(org_lo[a], o[a]);
+			org_hi[a] = ffmax(org_hi[a], o[a]);
+			real inv = 1 / dir[a];
+			inv_lo[a] = ffmin(inv_lo[a], inv);
+			inv_hi[a] = ffmax(inv_hi[a], inv);
+			positive[a] = positive[a] && dir[a] > 0;
+			negative[a] = negative[a] && dir[a] < 0;
+		}
+	}
+	for (int a = 0; a < 3; a++)
+		axis_valid[a] = positive[a] || negative[a];
+}
+
+//区间乘法[a0,a1]*[b0,b1]
+inline void interval_mul(real a0, real a1, real b0, real b1, real &lo, real &hi)
+{
+	real p0 = a0 * b0, p1 = a0 * b1, p2 = a1 * b0, p3 = a1 * b1;
+	lo = ffmin(ffmin(p0, p1), ffmin(p2, p3));
+	hi = ffmax(ffmax(p0, p1), ffmax(p2, p3));
+}
+
+//保守判定：返回false时包里所有光线都一定没有击中box
+bool ray_packet::may_hit(const aabb &box, real t_min) const
+{
+	real enter = t_min;//所有光线进入时刻的下界
+	real leave = t_max_hi;//所有光线离开时刻的上界
+	for (int a = 0; a < 3; a++)
+	{
+		if (!axis_valid[a])//方向分量跨过0，这个轴上不做剔除
+			continue;
+		real lo0, hi0, lo1, hi1;
+		interval_mul(box.min()[a] - org_hi[a], box.min()[a] - org_lo[a], inv_lo[a], inv_hi[a], lo0, hi0);
+		interval_mul(box.max()[a] - org_hi[a], box.max()[a] - org_lo[a], inv_lo[a], inv_hi[a], lo1, hi1);
+		if (inv_lo[a] > 0)//光线沿正方向，从min面进入，从max面离开
+		{
+			enter = ffmax(enter, lo0);
+			leave = ffmin(leave, hi1);
+		}
+		else
+		{
+			enter = ffmax(enter, lo1);
+			leave = ffmin(leave, hi0);
+		}
+		if (leave <= enter)
+			return false;
+	}
+	return true;
+}
+
+//对区间测试通过的节点，再逐条光线测试得到真正需要继续向下的光线
+uint64_t ray_packet::hit_mask(const aabb &box, real t_min, uint64_t active) const
+{
+	uint64_t mask = 0;
+	for (int i = 0; i < n; i++)
+		if ((active >> i) & 1 && box.hit(rays[i], t_min, t_max[i]))
+			mask |= uint64_t(1) << i;
+	return mask;
+}
+
+void ray_packet::traverse(const hitable *node, real t_min, uint64_t active)
+{
+	if (auto *bvh = dynamic_cast<const bvh_node *>(node))
+	{
+		if (!may_hit(bvh->box, t_min))
+			return;
+		active = hit_mask(bvh->box, t_min, active);
+		if (!active)
+			return;
+		traverse(bvh->left, t_min, active);
+		if (bvh->right != bvh->left)
+			traverse(bvh->right, t_min, active);
+		return;
+	}
+
+	//叶子物体逐条光线求交，用各自当前最近的t作为上界
+	hit_record temp;
+	bool any = false;
+	for (int i = 0; i < n; i++)
+	{
+		if ((active >> i) & 1 && node->hit(rays[i], t_min, t_max[i], temp))
+		{
+			hit[i] = true;
+			t_max[i] = temp.t;
+			rec[i] = temp;
+			any = true;
+		}
+	}
+	if (any)//收紧整个包的t上界
+	{
+		t_max_hi = t_max[0];
+		for (int i = 1; i < n; i++)
+			t_max_hi = ffmax(t_max_hi, t_max[i]);
+	}
+}
+
+void ray_packet::trace(const hitable *world, real t_min)
+{
+	if (n == 0)
+		return;
+	prepare_bounds();
+	t_max_hi = FLT_MAX;
+	uint64_t active = n == 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+	traverse(world, t_min, active);
+}
+
+#endif //RAYTRACE_PACKET_H
@@ -5,7 +5,12 @@
 #ifndef RAYTRACE_PERLIN_H
 #define RAYTRACE_PERLIN_H
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory>
+#include <mutex>
 #include "vec3.h"
+#include "simd.h"
 
 inline float perlin_interp(vec3 c[2][2][2],float u, float v,float w)
 {
@@ -24,10 +29,29 @@ inline float perlin_interp(vec3 c[2][2][2],float u, float v,float w)
 	return accum;
 }
 
+//下标i处的梯度和三个轴的置换表交错存在一起，查表时一个像素的梯度和置换多半在同一条cache line上
+struct perlin_entry
+{
+	float gx, gy, gz;
+	uint8_t px, py, pz, pad;
+};
+
+struct alignas(64) perlin_tables
+{
+	perlin_entry e[256];
+};
+
 class perlin {
 public:
+	//与drand48的初始状态相同，默认种子下的表和原来在main之前用drand48生成的表同分布
+	static constexpr uint64_t default_seed = 0x1234ABCD330EULL;
+
+	explicit perlin(uint64_t seed = default_seed) : seed(seed)
+	{}
+
 	float noise(const vec3 &p) const
 	{
+		const perlin_entry *t = tables();
 		float u = p.x() - floor(p.x());
 		float v = p.y() - floor(p.y());
 		float w = p.z() - floor(p.z());
@@ -39,13 +63,68 @@ public:
 		for (int di = 0; di < 2; di++)
 			for (int dj = 0; dj < 2; dj++)
 				for (int dk = 0; dk < 2; dk++)
-					c[di][dj][dk] = ranvec[perm_x[(i + di) & 255] ^ perm_y[(j + dj) & 255] ^ perm_z[(k + dk) & 255]];
+				{
+					const perlin_entry &g = t[t[(i + di) & 255].px ^ t[(j + dj) & 255].py ^ t[(k + dk) & 255].pz];
+					c[di][dj][dk] = vec3(g.gx, g.gy, g.gz);
+				}
 
 		return perlin_interp(c, u, v, w);
 	}
 
-	//把几个noise进行叠加形成turbulence
+	//同时求4个点的noise（x、y、z分量分开存放），每个lane与noise()的运算顺序完全相同，
+	//real为float时结果逐位一致
+	void noise4(const float *x, const float *y, const float *z, float *out) const;
+
+	//批量求n个点的noise
+	void noise(const vec3 *p, float *out, int n) const
+	{
+		float x[4], y[4], z[4];
+		for (int b = 0; b < n; b += 4)
+		{
+			int m = n - b < 4 ? n - b : 4;
+			for (int l = 0; l < 4; l++)
+			{
+				const vec3 &q = p[b + (l < m ? l : m - 1)];//不足4个时重复最后一个点
+				x[l] = q.x();
+				y[l] = q.y();
+				z[l] = q.z();
+			}
+			float r[4];
+			noise4(x, y, z, r);
+			for (int l = 0; l < m; l++)
+				out[b + l] = r[l];
+		}
+	}
+
+	//把几个noise进行叠加形成turbulence。各个octave放在不同的lane里一起求，再按原来的顺序累加，
+	//所以与turb_scalar()结果相同
 	float turb(const vec3 &p, int depth = 7) const
+	{
+		float accum = 0;
+		float weight = 1.0;
+		float scale = 1.0;
+		float x[4], y[4], z[4], n[4];
+		for (int o = 0; o < depth; o += 4)
+		{
+			for (int l = 0; l < 4; l++)
+			{
+				x[l] = p.x() * scale;
+				y[l] = p.y() * scale;
+				z[l] = p.z() * scale;
+				scale *= 2;
+			}
+			noise4(x, y, z, n);
+			for (int l = 0; l < 4 && o + l < depth; l++)
+			{
+				accum += weight * n[l];
+				weight *= 0.5;
+			}
+		}
+		return fabs(accum);
+	}
+
+	//turb的逐个octave标量实现，用来校验
+	float turb_scalar(const vec3 &p, int depth = 7) const
 	{
 		float accum = 0;
 		vec3 temp_p = p;
@@ -60,40 +139,95 @@ public:
 	}
 
 private:
-	static vec3 *ranvec;
-	static int *perm_x;
-	static int *perm_y;
-	static int *perm_z;
+	//第一次用到时才由种子生成表，多线程同时第一次使用也只生成一次
+	const perlin_entry *tables() const
+	{
+		std::call_once(built, [this] { build(); });
+		return block->e;
+	}
+
+	void build() const;
+
+	uint64_t seed;
+	mutable std::once_flag built;
+	mutable std::unique_ptr<perlin_tables> block;
 };
 
-static vec3* perlin_generate() {
-	auto *p = new vec3[256];
+void perlin::build() const
+{
+	//erand48的状态是48位，取种子的低48位
+	unsigned short state[3] = {(unsigned short) seed, (unsigned short) (seed >> 16), (unsigned short) (seed >> 32)};
+	block.reset(new perlin_tables);
+	perlin_entry *t = block->e;
 	for (int i = 0; i < 256; ++i)
-		p[i] = unit_vector(vec3(-1 + 2*drand48(),-1 + 2*drand48(),-1 + 2*drand48()));
-	return p;
+	{
+		float x = -1 + 2 * erand48(state);
+		float y = -1 + 2 * erand48(state);
+		float z = -1 + 2 * erand48(state);
+		vec3 g = unit_vector(vec3(x, y, z));
+		t[i].gx = g.x();
+		t[i].gy = g.y();
+		t[i].gz = g.z();
+		t[i].pad = 0;
+	}
+	//三个置换表依次做Fisher-Yates洗牌
+	uint8_t perlin_entry::*perm[3] = {&perlin_entry::px, &perlin_entry::py, &perlin_entry::pz};
+	for (auto p : perm)
+	{
+		for (int i = 0; i < 256; i++)
+			t[i].*p = uint8_t(i);
+		for (int i = 255; i > 0; i--)
+		{
+			int target = int(erand48(state) * (i + 1));
+			uint8_t tmp = t[i].*p;
+			t[i].*p = t[target].*p;
+			t[target].*p = tmp;
+		}
+	}
 }
 
-void permute(int *p, int n) {
-	for (int i = n - 1; i > 0; i--)
+void perlin::noise4(const float *x, const float *y, const float *z, float *out) const
+{
+	const perlin_entry *t = tables();
+	//取整和查表没有SIMD的gather，逐个lane做；8个角点的梯度按分量转置成每个lane一列
+	float fu[4], fv[4], fw[4];
+	float g[8][3][4];
+	for (int l = 0; l < 4; l++)
 	{
-		int target = int(drand48() * (i + 1));
-		int tmp = p[i];
-		p[i] = p[target];
-		p[target] = tmp;
+		float fx = floor(x[l]), fy = floor(y[l]), fz = floor(z[l]);
+		fu[l] = x[l] - fx;
+		fv[l] = y[l] - fy;
+		fw[l] = z[l] - fz;
+		int i = fx, j = fy, k = fz;
+		int px[2] = {t[i & 255].px, t[(i + 1) & 255].px};
+		int py[2] = {t[j & 255].py, t[(j + 1) & 255].py};
+		int pz[2] = {t[k & 255].pz, t[(k + 1) & 255].pz};
+		for (int c = 0; c < 8; c++)
+		{
+			const perlin_entry &r = t[px[c >> 2] ^ py[(c >> 1) & 1] ^ pz[c & 1]];
+			g[c][0][l] = r.gx;
+			g[c][1][l] = r.gy;
+			g[c][2][l] = r.gz;
+		}
 	}
-}
 
-static int* perlin_generate_perm() {
-	int * p = new int[256];
-	for (int i = 0; i < 256; i++)
-		p[i] = i;
-	permute(p, 256);
-	return p;
+	//下面与perlin_interp一一对应；不用f4_fmadd，融合乘加会改变舍入
+	f4 one = f4_splat(1), two = f4_splat(2), three = f4_splat(3);
+	f4 u = f4_load(fu), v = f4_load(fv), w = f4_load(fw);
+	f4 uu = f4_mul(f4_mul(u, u), f4_sub(three, f4_mul(two, u)));
+	f4 vv = f4_mul(f4_mul(v, v), f4_sub(three, f4_mul(two, v)));
+	f4 ww = f4_mul(f4_mul(w, w), f4_sub(three, f4_mul(two, w)));
+	f4 wx[2] = {f4_sub(one, uu), uu}, wy[2] = {f4_sub(one, vv), vv}, wz[2] = {f4_sub(one, ww), ww};
+	f4 dx[2] = {u, f4_sub(u, one)}, dy[2] = {v, f4_sub(v, one)}, dz[2] = {w, f4_sub(w, one)};
+	f4 accum = f4_splat(0);
+	for (int c = 0; c < 8; c++)
+	{
+		int i = c >> 2, j = (c >> 1) & 1, k = c & 1;
+		f4 d = f4_add(f4_add(f4_mul(f4_load(g[c][0]), dx[i]), f4_mul(f4_load(g[c][1]), dy[j])),
+					  f4_mul(f4_load(g[c][2]), dz[k]));
+		accum = f4_add(accum, f4_mul(f4_mul(f4_mul(wx[i], wy[j]), wz[k]), d));
+	}
+	f4_store(out, accum);
 }
 
-vec3 *perlin::ranvec = perlin_generate();
-int *perlin::perm_x = perlin_generate_perm();
-int *perlin::perm_y = perlin_generate_perm();
-int *perlin::perm_z = perlin_generate_perm();
-
 #endif //RAYTRACE_PERLIN_H
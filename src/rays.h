@@ -7,34 +7,67 @@
 
 #include "vec3.h"
 
-class ray
+template<typename T>
+class ray_t
 {
 public:
-	ray(){}
+	ray_t(){}
 
-	ray(const vec3 &a, const vec3 &b, float ti = 0.0)
+	ray_t(const vec3_t<T> &a, const vec3_t<T> &b, float ti = 0.0)
 	{
 		A = a;
 		B = b;
 		_time = ti;
 	}
 
-	vec3 origin() const
+	vec3_t<T> origin() const
 	{ return A; }
 
-	vec3 direction() const
+	vec3_t<T> direction() const
 	{ return B; }
 
 	float time() const
 	{ return _time; }
 
-	vec3 point_at_parameter(float t) const
+	vec3_t<T> point_at_parameter(T t) const
 	{ return A + t * B; }
 
+	//光线微分：相邻一个像素（x和y方向）的两条光线，用来估计击中点处像素在纹理上的足迹
+	bool has_differentials() const
+	{ return _has_differentials; }
+
+	vec3_t<T> rx_origin() const
+	{ return rx_A; }
+
+	vec3_t<T> rx_direction() const
+	{ return rx_B; }
+
+	vec3_t<T> ry_origin() const
+	{ return ry_A; }
+
+	vec3_t<T> ry_direction() const
+	{ return ry_B; }
+
+	void set_differentials(const vec3_t<T> &ox, const vec3_t<T> &dx, const vec3_t<T> &oy, const vec3_t<T> &dy)
+	{
+		rx_A = ox;
+		rx_B = dx;
+		ry_A = oy;
+		ry_B = dy;
+		_has_differentials = true;
+	}
+
 private:
-	vec3 A;//光源
-	vec3 B;//朝向
+	vec3_t<T> A;//光源
+	vec3_t<T> B;//朝向
 	float _time;//光线射出的时间（相比较快门按下之后）
+	bool _has_differentials = false;
+	vec3_t<T> rx_A, rx_B, ry_A, ry_B;
 };
 
+typedef ray_t<real> ray;
+
+//求交时t的下限，避免散射光线与出发的表面自相交；double精度下可以小得多
+const real ray_epsilon = sizeof(real) == sizeof(double) ? 1e-7 : 1e-3;
+
 #endif //RAYTRACE_RAYS_H
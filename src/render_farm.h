@@ -0,0 +1,259 @@
+#ifndef RAYTRACE_RENDER_FARM_H
+#define RAYTRACE_RENDER_FARM_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <algorithm>
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+//多进程渲染：协调进程把画面切成tile，经socketpair交给fork出来的worker，收回每个tile的线性颜色拼成整幅画面。
+//worker是协调进程建好场景之后fork的，场景完全相同；只要采样器按像素、样本编号确定随机数，
+//结果就与tile怎样分配、worker有几个无关。worker中途退出时它手上的tile重新排队交给别的worker，
+//所有worker都退出时剩下的tile由协调进程自己渲染
+
+//协调进程发给worker的任务，也是worker回复的头部；id < 0表示退出
+struct farm_tile
+{
+	int32_t id;
+	int32_t x0, y0, x1, y1;//像素范围[x0,x1) x [y0,y1)，y向上
+
+	size_t floats() const
+	{ return size_t(x1 - x0) * size_t(y1 - y0) * 3; }
+};
+
+//渲染一个tile，按行（j从y0开始）、每行从x0开始写入rgb三个float
+typedef std::function<void(const farm_tile &, float *)> farm_tile_renderer;
+
+struct farm_stats
+{
+	int tiles = 0;
+	int requeued = 0;//从退出的worker收回重新分配的tile数
+	int local = 0;//没有worker可用时协调进程自己渲染的tile数
+	std::vector<int> per_worker;//每个worker完成的tile数
+};
+
+//把画面切成tile x tile的块
+inline std::vector<farm_tile> make_farm_tiles(int nx, int ny, int tile)
+{
+	std::vector<farm_tile> tiles;
+	for (int y0 = 0; y0 < ny; y0 += tile)
+		for (int x0 = 0; x0 < nx; x0 += tile)
+			tiles.push_back({int32_t(tiles.size()), x0, y0, std::min(x0 + tile, nx), std::min(y0 + tile, ny)});
+	return tiles;
+}
+
+#ifndef _WIN32
+//socket上的读写可能只完成一部分，循环到全部完成；对端关闭或出错时返回false
+inline bool farm_read(int fd, void *data, size_t bytes)
+{
+	char *p = (char *) data;
+	while (bytes > 0)
+	{
+		ssize_t n = read(fd, p, bytes);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= size_t(n);
+	}
+	return true;
+}
+
+inline bool farm_write(int fd, const void *data, size_t bytes)
+{
+	const char *p = (const char *) data;
+	while (bytes > 0)
+	{
+		ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);//worker已经退出时不要因为SIGPIPE结束协调进程
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= size_t(n);
+	}
+	return true;
+}
+
+//worker进程的主循环，不返回
+[[noreturn]] inline void farm_worker(int fd, const farm_tile_renderer &render, int crash_after)
+{
+	farm_tile t;
+	std::vector<float> pixels;
+	int done = 0;
+	while (farm_read(fd, &t, sizeof(t)) && t.id >= 0)
+	{
+		if (crash_after >= 0 && done == crash_after)
+			_exit(3);//模拟worker中途崩溃，手上的tile由协调进程重新分配
+		pixels.resize(t.floats());
+		render(t, pixels.data());
+		if (!farm_write(fd, &t, sizeof(t)) || !farm_write(fd, pixels.data(), pixels.size() * sizeof(float)))
+			break;
+		done++;
+	}
+	close(fd);
+	_exit(0);//不执行atexit和静态析构，避免重复刷出父进程缓冲区里的内容
+}
+#endif
+
+//用workers个子进程渲染nx x ny的画面，image按行（j从0开始）存rgb三个float。
+//crash_worker >= 0时，该编号的worker在完成crash_after个tile后退出，用来检验重新排队
+inline farm_stats render_farm(int nx, int ny, int tile, int workers, const farm_tile_renderer &render,
+							  std::vector<float> &image, int crash_worker = -1, int crash_after = 1)
+{
+	image.assign(size_t(nx) * ny * 3, 0.0f);
+	std::vector<farm_tile> tiles = make_farm_tiles(nx, ny, tile);
+	farm_stats stats;
+	stats.tiles = int(tiles.size());
+	stats.per_worker.assign(workers, 0);
+	std::deque<int> pending;
+	for (const farm_tile &t : tiles)
+		pending.push_back(t.id);
+
+	auto store = [&](const farm_tile &t, const float *pixels) {
+		size_t row = size_t(t.x1 - t.x0) * 3;
+		for (int j = t.y0; j < t.y1; j++)
+			std::copy(pixels + (j - t.y0) * row, pixels + (j - t.y0 + 1) * row, &image[(size_t(j) * nx + t.x0) * 3]);
+	};
+
+#ifndef _WIN32
+	struct worker
+	{
+		pid_t pid = -1;
+		int fd = -1;
+		int tile = -1;//正在渲染的tile，-1表示空闲
+	};
+	std::vector<worker> pool(workers);
+	std::cout.flush();
+	std::cerr.flush();
+	for (int w = 0; w < workers; w++)
+	{
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+		{
+			perror("socketpair");
+			break;
+		}
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(sv[0]);
+			for (int k = 0; k < w; k++)//不持有其他worker的socket，否则它们退出时协调进程收不到EOF
+				if (pool[k].fd >= 0)
+					close(pool[k].fd);
+			farm_worker(sv[1], render, w == crash_worker ? crash_after : -1);
+		}
+		close(sv[1]);
+		if (pid < 0)
+		{
+			perror("fork");
+			close(sv[0]);
+			break;
+		}
+		pool[w].pid = pid;
+		pool[w].fd = sv[0];
+	}
+
+	auto retire = [&](worker &wk) {
+		if (wk.tile >= 0)
+		{
+			pending.push_front(wk.tile);
+			stats.requeued++;
+			std::cerr << "worker " << wk.pid << " exited, tile " << wk.tile << " requeued\n";
+		}
+		close(wk.fd);
+		waitpid(wk.pid, nullptr, 0);
+		wk.fd = -1;
+		wk.tile = -1;
+	};
+	auto assign = [&]() {
+		for (worker &wk : pool)
+			if (wk.fd >= 0 && wk.tile < 0 && !pending.empty())
+			{
+				wk.tile = pending.front();
+				pending.pop_front();
+				if (!farm_write(wk.fd, &tiles[wk.tile], sizeof(farm_tile)))
+					retire(wk);
+			}
+	};
+
+	std::vector<float> pixels;
+	int done = 0;
+	assign();
+	while (done < stats.tiles)
+	{
+		std::vector<pollfd> fds;
+		std::vector<int> owner;
+		for (int w = 0; w < workers; w++)
+			if (pool[w].fd >= 0 && pool[w].tile >= 0)
+			{
+				fds.push_back({pool[w].fd, POLLIN, 0});
+				owner.push_back(w);
+			}
+		if (fds.empty())
+			break;//没有活着的worker
+		if (poll(fds.data(), fds.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		for (size_t k = 0; k < fds.size(); k++)
+		{
+			if (!fds[k].revents)
+				continue;
+			worker &wk = pool[owner[k]];
+			farm_tile t;
+			bool ok = farm_read(wk.fd, &t, sizeof(t)) && t.id == wk.tile;
+			if (ok)
+			{
+				pixels.resize(tiles[t.id].floats());
+				ok = farm_read(wk.fd, pixels.data(), pixels.size() * sizeof(float));
+			}
+			if (!ok)
+			{
+				retire(wk);
+				continue;
+			}
+			store(tiles[t.id], pixels.data());
+			stats.per_worker[owner[k]]++;
+			wk.tile = -1;
+			done++;
+		}
+		assign();
+	}
+
+	farm_tile quit = {-1, 0, 0, 0, 0};
+	for (worker &wk : pool)
+		if (wk.fd >= 0)
+		{
+			farm_write(wk.fd, &quit, sizeof(quit));
+			close(wk.fd);
+			waitpid(wk.pid, nullptr, 0);
+		}
+#endif
+
+	//没有worker（或者全部退出了）时在本进程里渲染剩下的tile
+	std::vector<float> local;
+	for (int id : pending)
+	{
+		local.resize(tiles[id].floats());
+		render(tiles[id], local.data());
+		store(tiles[id], local.data());
+		stats.local++;
+	}
+	return stats;
+}
+
+#endif //RAYTRACE_RENDER_FARM_H
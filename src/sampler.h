@@ -0,0 +1,248 @@
+#ifndef RAYTRACE_SAMPLER_H
+#define RAYTRACE_SAMPLER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+
+//每个像素样本按顺序要的随机数：像素内抖动(2D)、透镜(2D)、时间(1D)，之后每次弹射按材质需要取。
+//sampler按“第几个像素、第几个样本、第几维”给出数值，好的sampler让同一维在一个像素的各样本之间分布均匀
+class sampler
+{
+public:
+	virtual ~sampler() {}
+
+	//开始像素(px, py)的第s个样本，维度从0重新计数
+	virtual void start_pixel_sample(int px, int py, int s) = 0;
+
+	virtual float get_1d() = 0;
+	virtual void get_2d(float &u, float &v) = 0;
+};
+
+//当前线程正在使用的sampler；为空时sample_1d/sample_2d退回drand48
+inline thread_local sampler *active_sampler = nullptr;
+
+inline float sample_1d()
+{ return active_sampler ? active_sampler->get_1d() : float(drand48()); }
+
+inline void sample_2d(float &u, float &v)
+{
+	if (active_sampler)
+		active_sampler->get_2d(u, v);
+	else
+	{
+		u = drand48();
+		v = drand48();
+	}
+}
+
+//32位整数哈希（lowbias32）
+inline uint32_t hash_u32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v)
+{ return hash_u32(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2))); }
+
+//[0, 2^32)的整数映射到[0, 1)，保证不会舍入到1
+inline float u32_to_unit(uint32_t x)
+{ return fminf(x * (1.0f / 4294967296.0f), 0x1.fffffep-1f); }
+
+//完全独立的随机数。每个像素样本用(px, py, s)的哈希重新设置一个erand48状态，
+//所以同一个样本不论在哪个进程、以什么顺序渲染，得到的随机数都相同
+class independent_sampler : public sampler
+{
+public:
+	independent_sampler(uint32_t seed = 0) : seed(seed)
+	{}
+
+	virtual void start_pixel_sample(int px, int py, int s)
+	{
+		uint32_t h = hash_combine(hash_combine(hash_combine(seed, uint32_t(px)), uint32_t(py)), uint32_t(s));
+		state[0] = 0x330E;
+		state[1] = (unsigned short) (h & 0xffff);
+		state[2] = (unsigned short) (h >> 16);
+	}
+
+	virtual float get_1d()
+	{ return erand48(state); }
+
+	virtual void get_2d(float &u, float &v)
+	{
+		u = erand48(state);
+		v = erand48(state);
+	}
+
+private:
+	uint32_t seed;
+	unsigned short state[3] = {0x330E, 0xABCD, 0x1234};
+};
+
+//Kensler的哈希置换：把i在[0, l)内按种子p置换，不需要存表（Correlated Multi-Jittered Sampling, 2013）
+inline uint32_t kensler_permute(uint32_t i, uint32_t l, uint32_t p)
+{
+	uint32_t w = l - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do
+	{
+		i ^= p;
+		i *= 0xe170893du;
+		i ^= p >> 16;
+		i ^= (i & w) >> 4;
+		i ^= p >> 8;
+		i *= 0x0929eb3fu;
+		i ^= p >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1 | p >> 27;
+		i *= 0x6935fa69u;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303u;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3u;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3dfu;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= l);
+	return (i + p) % l;
+}
+
+//分层抖动：每一维把一个像素的spp个样本放进不同的层里（2D用sqrt(spp)见方的网格），
+//每一维、每个像素用不同的置换打乱层的顺序，避免各维之间相关
+class stratified_sampler : public sampler
+{
+public:
+	stratified_sampler(int spp, uint32_t seed = 0) : spp(spp), seed(seed)
+	{
+		nx = int(ceil(sqrt(double(spp))));
+		ny = (spp + nx - 1) / nx;
+	}
+
+	virtual void start_pixel_sample(int px, int py, int s)
+	{
+		pixel_seed = hash_combine(hash_combine(seed, uint32_t(px)), uint32_t(py));
+		index = uint32_t(s);
+		dim = 0;
+	}
+
+	virtual float get_1d()
+	{
+		uint32_t h = hash_combine(pixel_seed, dim++);
+		uint32_t stratum = kensler_permute(index % spp, spp, h);
+		return (stratum + jitter(h)) / spp;
+	}
+
+	virtual void get_2d(float &u, float &v)
+	{
+		uint32_t h = hash_combine(pixel_seed, dim++);
+		uint32_t stratum = kensler_permute(index % spp, nx * ny, h);
+		u = ((stratum % nx) + jitter(h)) / nx;
+		v = ((stratum / nx) + jitter(h ^ 0x5bd1e995u)) / ny;
+	}
+
+private:
+	float jitter(uint32_t h) const
+	{ return u32_to_unit(hash_combine(h, index)); }
+
+	uint32_t spp, nx, ny;
+	uint32_t seed;
+	uint32_t pixel_seed = 0, index = 0, dim = 0;
+};
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+//Laine-Karras风格的哈希，等价于对反转后的位做一次嵌套均匀Owen scrambling
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{ return reverse_bits(laine_karras_permutation(reverse_bits(x), seed)); }
+
+//Sobol序列的前两维：第0维是van der Corput，第1维的方向数是v_{k+1} = v_k ^ (v_k >> 1)
+inline uint32_t sobol_dim0(uint32_t index)
+{ return reverse_bits(index); }
+
+inline uint32_t sobol_dim1(uint32_t index)
+{
+	uint32_t r = 0;
+	for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+		if (index & 1)
+			r ^= v;
+	return r;
+}
+
+//Owen scrambled Sobol（Burley, Practical Hash-based Owen Scrambling, 2020）：
+//每一维（或一对维）用二维Sobol的一份独立打乱的拷贝，样本下标也按维各自打乱（padding），
+//所以维数不受方向数表的限制。spp取2的幂时分层效果最好
+class sobol_sampler : public sampler
+{
+public:
+	sobol_sampler(uint32_t seed = 0) : seed(seed)
+	{}
+
+	virtual void start_pixel_sample(int px, int py, int s)
+	{
+		pixel_seed = hash_combine(hash_combine(seed, uint32_t(px)), uint32_t(py));
+		index = uint32_t(s);
+		dim = 0;
+	}
+
+	virtual float get_1d()
+	{
+		uint32_t h = hash_combine(pixel_seed, dim++);
+		uint32_t i = nested_uniform_scramble(index, h);
+		return u32_to_unit(nested_uniform_scramble(sobol_dim0(i), hash_combine(h, 1)));
+	}
+
+	virtual void get_2d(float &u, float &v)
+	{
+		uint32_t h = hash_combine(pixel_seed, dim++);
+		uint32_t i = nested_uniform_scramble(index, h);
+		u = u32_to_unit(nested_uniform_scramble(sobol_dim0(i), hash_combine(h, 1)));
+		v = u32_to_unit(nested_uniform_scramble(sobol_dim1(i), hash_combine(h, 2)));
+	}
+
+private:
+	uint32_t seed;
+	uint32_t pixel_seed = 0, index = 0, dim = 0;
+};
+
+//按名字创建sampler：independent、stratified、sobol；不认识的名字返回nullptr
+inline sampler *make_sampler(const std::string &name, int spp)
+{
+	if (name == "independent")
+		return new independent_sampler;
+	if (name == "stratified")
+		return new stratified_sampler(spp);
+	if (name == "sobol")
+		return new sobol_sampler;
+	return nullptr;
+}
+
+#endif //RAYTRACE_SAMPLER_H
@@ -0,0 +1,111 @@
+#ifndef RAYTRACE_SAMPLING_H
+#define RAYTRACE_SAMPLING_H
+
+#include "vec3.h"
+#include "sampler.h"
+
+//把[0,1)^2上的均匀样本直接映射到各种形状上，不用拒绝采样：每个点正好消耗一个2D（或再加一个1D）样本，
+//分层和低差异序列在映射之后仍然保持分布均匀
+
+//同心圆映射（Shirley-Chiu）：正方形的同心方环映射到圆盘的同心圆环，面积保持均匀，扭曲比极坐标小
+inline void concentric_sample_disk(float u, float v, float &x, float &y)
+{
+	float a = 2 * u - 1, b = 2 * v - 1;
+	if (a == 0 && b == 0)
+	{
+		x = y = 0;
+		return;
+	}
+	float r, phi;
+	if (fabsf(a) > fabsf(b))
+	{
+		r = a;
+		phi = float(M_PI / 4) * (b / a);
+	}
+	else
+	{
+		r = b;
+		phi = float(M_PI / 2) - float(M_PI / 4) * (a / b);
+	}
+	x = r * cosf(phi);
+	y = r * sinf(phi);
+}
+
+//单位球面上的均匀方向：z在[-1,1]上均匀，方位角在[0,2pi)上均匀
+inline vec3 uniform_sample_sphere(float u, float v)
+{
+	float z = 1 - 2 * u;
+	float r = sqrtf(fmaxf(0.0f, 1 - z * z));
+	float phi = float(2 * M_PI) * v;
+	return vec3(r * cosf(phi), r * sinf(phi), z);
+}
+
+//以+z为轴、半角余弦为cos_max的锥内的均匀方向，pdf = 1/(2pi(1-cos_max))
+inline vec3 uniform_sample_cone(float u, float v, float cos_max)
+{
+	float z = 1 - u * (1 - cos_max);
+	float r = sqrtf(fmaxf(0.0f, 1 - z * z));
+	float phi = float(2 * M_PI) * v;
+	return vec3(r * cosf(phi), r * sinf(phi), z);
+}
+
+//以+z为法线的余弦加权半球方向（Malley方法：圆盘上均匀取点再投影到半球上），pdf = cos/pi
+inline vec3 cosine_sample_hemisphere(float u, float v)
+{
+	float x, y;
+	concentric_sample_disk(u, v, x, y);
+	return vec3(x, y, sqrtf(fmaxf(0.0f, 1 - x * x - y * y)));
+}
+
+//以单位向量n为z轴的正交基（Duff等，Building an Orthonormal Basis, Revisited），没有分支和归一化
+struct onb
+{
+	explicit onb(const vec3 &n) : w(n)
+	{
+		real sign = copysign(real(1), n.z());
+		real a = -1 / (sign + n.z());
+		real b = n.x() * n.y() * a;
+		u = vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+		v = vec3(b, sign + n.y() * n.y() * a, -n.y());
+	}
+
+	vec3 local(const vec3 &d) const
+	{ return d.x() * u + d.y() * v + d.z() * w; }
+
+	vec3 u, v, w;
+};
+
+//单位圆盘内的均匀点（z=0），消耗一个2D样本
+inline vec3 random_in_unit_disk()
+{
+	float a, b, x, y;
+	sample_2d(a, b);
+	concentric_sample_disk(a, b, x, y);
+	return vec3(x, y, 0);
+}
+
+//单位球体内的均匀点：方向取一个2D样本，半径按体积取1D样本的立方根
+inline vec3 random_in_unit_sphere()
+{
+	float a, b;
+	sample_2d(a, b);
+	return cbrtf(sample_1d()) * uniform_sample_sphere(a, b);
+}
+
+//单位球面上的均匀方向，消耗一个2D样本
+inline vec3 random_unit_vector()
+{
+	float a, b;
+	sample_2d(a, b);
+	return uniform_sample_sphere(a, b);
+}
+
+//围绕单位法线n的余弦加权方向，消耗一个2D样本
+inline vec3 random_cosine_direction(const vec3 &n)
+{
+	float a, b;
+	sample_2d(a, b);
+	return onb(n).local(cosine_sample_hemisphere(a, b));
+}
+
+#endif //RAYTRACE_SAMPLING_H
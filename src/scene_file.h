@@ -0,0 +1,217 @@
+#ifndef RAYTRACE_SCENE_FILE_H
+#define RAYTRACE_SCENE_FILE_H
+
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+//CPU光线追踪（src/）和RayGL_Win的GPU路径共用的场景描述：只有两边都能表达的物体和材质，
+//不依赖vec3或glm。scene_hitable.h把它导出成hitable，RayGL_Win的Scene.h（ExportShapes）导出成std430的Shape缓冲区。
+//文本格式，每行一条，#之后是注释：
+//  camera lookfrom x y z lookat x y z vfov 度数 [aperture a]
+//  material 名字 lambertian r g b
+//  material 名字 metal r g b 模糊度
+//  material 名字 dielectric 折射率
+//  material 名字 light r g b          只发光不散射
+//  sphere 材质 cx cy cz 半径
+//  box 材质 x0 y0 z0 x1 y1 z1 [rotate_y 度数]     绕盒子中心的竖直轴旋转，方向与rotate_y相同
+//  rect 材质 x0 y0 z0 x1 y1 z1 [flip]            某一轴上x0 == x1，法线指向该轴正方向，flip时反向
+
+struct scene_material
+{
+	enum kind_t
+	{
+		lambertian, metal, dielectric, light
+	} kind;
+	float albedo[3];//light时为发光颜色
+	float param;//metal的模糊度或dielectric的折射率
+};
+
+struct scene_object
+{
+	enum kind_t
+	{
+		sphere, box, rect
+	} kind;
+	int material;//scene_desc::materials中的下标
+	float p0[3];//sphere的球心，box和rect的最小角
+	float p1[3];//box和rect的最大角；sphere时p1[0]是半径
+	float rotate_y;//box绕竖直轴旋转的度数
+	int axis;//rect所在平面的法线轴
+	bool flip;//rect的法线朝负方向
+};
+
+struct scene_desc
+{
+	float lookfrom[3] = {0, 0, 1};
+	float lookat[3] = {0, 0, 0};
+	float vfov = 40;
+	float aperture = 0;
+	std::vector<std::string> material_names;
+	std::vector<scene_material> materials;
+	std::vector<scene_object> objects;
+};
+
+//GPU的Shape把立方体的转角存成uint的毫弧度（(角度 + 360)换算成弧度再乘1000取整，见RayGL_Win的Cube），
+//两个导出都用这个量化之后的值，保证两边的几何完全一致。返回的是GPU旋转的毫弧度，
+//GPU把局部坐标按这个角度旋转到世界坐标，和rotate_y的方向相反，所以对rotate_y取负
+inline uint32_t scene_box_milliradians(float rotate_y)
+{
+	return uint32_t(double((-rotate_y + 360) * 0.01745329251994329576923690768489f) * 1000.0);
+}
+
+//上面的量化转角换回rotate_y的度数
+inline float scene_box_rotate_y(float rotate_y)
+{
+	return -float(double(scene_box_milliradians(rotate_y)) / 1000.0 * 180.0 / 3.14159265358979323846);
+}
+
+//读入场景文件；失败时error给出文件名、行号和原因
+inline bool read_scene_file(const std::string &path, scene_desc &scene, std::string &error)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		error = path + ": cannot open";
+		return false;
+	}
+	scene = scene_desc();
+	std::string line;
+	int line_no = 0;
+	auto fail = [&](const std::string &what) {
+		error = path + ":" + std::to_string(line_no) + ": " + what;
+		return false;
+	};
+	auto read3 = [](std::istringstream &in, float *v) { return bool(in >> v[0] >> v[1] >> v[2]); };
+	auto find_material = [&](const std::string &name) {
+		for (size_t k = 0; k < scene.material_names.size(); k++)
+			if (scene.material_names[k] == name)
+				return int(k);
+		return -1;
+	};
+
+	while (std::getline(file, line))
+	{
+		line_no++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream in(line);
+		std::string cmd;
+		if (!(in >> cmd))
+			continue;
+		if (cmd == "camera")
+		{
+			std::string key;
+			while (in >> key)
+			{
+				bool ok;
+				if (key == "lookfrom")
+					ok = read3(in, scene.lookfrom);
+				else if (key == "lookat")
+					ok = read3(in, scene.lookat);
+				else if (key == "vfov")
+					ok = bool(in >> scene.vfov);
+				else if (key == "aperture")
+					ok = bool(in >> scene.aperture);
+				else
+					return fail("unknown camera parameter " + key);
+				if (!ok)
+					return fail("bad camera " + key);
+			}
+		}
+		else if (cmd == "material")
+		{
+			std::string name, kind;
+			scene_material m = {scene_material::lambertian, {1, 1, 1}, 0};
+			if (!(in >> name >> kind))
+				return fail("material needs a name and a kind");
+			if (find_material(name) >= 0)
+				return fail("material " + name + " defined twice");
+			bool ok;
+			if (kind == "lambertian")
+				ok = read3(in, m.albedo);
+			else if (kind == "metal")
+			{
+				m.kind = scene_material::metal;
+				ok = read3(in, m.albedo) && in >> m.param;
+			}
+			else if (kind == "dielectric")
+			{
+				m.kind = scene_material::dielectric;
+				ok = bool(in >> m.param);
+			}
+			else if (kind == "light")
+			{
+				m.kind = scene_material::light;
+				ok = read3(in, m.albedo);
+			}
+			else
+				return fail("unknown material kind " + kind);
+			if (!ok)
+				return fail("bad " + kind + " material " + name);
+			scene.material_names.push_back(name);
+			scene.materials.push_back(m);
+		}
+		else if (cmd == "sphere" || cmd == "box" || cmd == "rect")
+		{
+			std::string mat;
+			scene_object o = {scene_object::sphere, -1, {0, 0, 0}, {0, 0, 0}, 0, 0, false};
+			if (!(in >> mat))
+				return fail(cmd + " needs a material");
+			o.material = find_material(mat);
+			if (o.material < 0)
+				return fail("unknown material " + mat);
+			if (cmd == "sphere")
+			{
+				if (!read3(in, o.p0) || !(in >> o.p1[0]) || o.p1[0] <= 0)
+					return fail("sphere needs a center and a positive radius");
+			}
+			else
+			{
+				o.kind = cmd == "box" ? scene_object::box : scene_object::rect;
+				if (!read3(in, o.p0) || !read3(in, o.p1))
+					return fail(cmd + " needs two corners");
+				int flat = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					if (o.p0[k] > o.p1[k])
+						return fail(cmd + " corners must be min then max");
+					if (o.p0[k] == o.p1[k])
+					{
+						flat++;
+						o.axis = k;
+					}
+				}
+				if (o.kind == scene_object::rect && flat != 1)
+					return fail("rect must be flat along exactly one axis");
+				if (o.kind == scene_object::box && flat != 0)
+					return fail("box must not be flat");
+				std::string opt;
+				while (in >> opt)
+				{
+					if (o.kind == scene_object::box && opt == "rotate_y" && in >> o.rotate_y)
+						continue;
+					if (o.kind == scene_object::rect && opt == "flip")
+					{
+						o.flip = true;
+						continue;
+					}
+					return fail("unexpected " + opt);
+				}
+			}
+			scene.objects.push_back(o);
+		}
+		else
+			return fail("unknown command " + cmd);
+		std::string extra;
+		if (in >> extra)
+			return fail("unexpected " + extra);
+	}
+	if (scene.objects.empty())
+		return fail("no objects");
+	return true;
+}
+
+#endif //RAYTRACE_SCENE_FILE_H
@@ -0,0 +1,77 @@
+#ifndef RAYTRACE_SCENE_HITABLE_H
+#define RAYTRACE_SCENE_HITABLE_H
+
+#include "scene_file.h"
+#include "hitable_list.h"
+#include "sphere.h"
+#include "aa_rect.h"
+#include "box.h"
+#include "material.h"
+
+//把scene_desc导出成hitable：materials按下标对应scene_desc::materials，objects按下标对应scene_desc::objects，
+//比较两个后端时用它们由mat_ptr、物体下标找回场景中的元素
+struct scene_hitables
+{
+	hitable *world;
+	std::vector<material *> materials;
+	std::vector<hitable *> objects;
+	std::vector<hitable *> lights;//发光材质的物体，给light_bvh做直接光照采样
+};
+
+inline vec3 scene_vec3(const float *v)
+{ return vec3(v[0], v[1], v[2]); }
+
+inline scene_hitables scene_to_hitables(const scene_desc &scene)
+{
+	scene_hitables out;
+	for (const scene_material &m : scene.materials)
+	{
+		vec3 c = scene_vec3(m.albedo);
+		switch (m.kind)
+		{
+			case scene_material::lambertian: out.materials.push_back(new lambertian(new constant_texture(c))); break;
+			case scene_material::metal: out.materials.push_back(new metal(c, m.param)); break;
+			case scene_material::dielectric: out.materials.push_back(new dielectric(m.param)); break;
+			case scene_material::light: out.materials.push_back(new diffuse_light(new constant_texture(c))); break;
+		}
+	}
+	for (const scene_object &o : scene.objects)
+	{
+		material *mat = out.materials[o.material];
+		vec3 p0 = scene_vec3(o.p0), p1 = scene_vec3(o.p1);
+		hitable *h = nullptr;
+		switch (o.kind)
+		{
+			case scene_object::sphere:
+				h = new sphere(p0, o.p1[0], mat);
+				break;
+			case scene_object::box:
+			{
+				//以盒子中心为原点旋转再平移回去，与GPU绕中心旋转一致。转角用GPU量化之后的值，
+				//rotate_y为0时GPU也有约0.01度的量化误差，所以不旋转的盒子同样经过rotate_y
+				vec3 half = (p1 - p0) * 0.5;
+				h = new translate(new rotate_y(new box(-half, half, mat), scene_box_rotate_y(o.rotate_y)), p0 + half);
+				break;
+			}
+			case scene_object::rect:
+				switch (o.axis)
+				{
+					case 0: h = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), mat); break;
+					case 1: h = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), mat); break;
+					default: h = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat); break;
+				}
+				if (o.flip)
+					h = new flip_normals(h);
+				break;
+		}
+		out.objects.push_back(h);
+		if (scene.materials[o.material].kind == scene_material::light)
+			out.lights.push_back(h);
+	}
+	hitable **list = new hitable *[out.objects.size()];
+	std::copy(out.objects.begin(), out.objects.end(), list);
+	out.world = new hitable_list(list, int(out.objects.size()));
+	return out;
+}
+
+#endif //RAYTRACE_SCENE_HITABLE_H
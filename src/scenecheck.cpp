@@ -0,0 +1,121 @@
+//检查同一个场景文件导出的两种表示是否描述同样的几何：src/的hitable（scene_hitable.h）
+//和RayGL_Win的Shape缓冲区（Scene.h，由Compute.comp的CPU移植ComputeCPU.h求交）。
+//相机穿过每个像素的光线，加上场景包围盒内随机起点、随机方向的光线，分别与两边求最近交点，
+//比较击中的物体、t和法线。两边在同一t上击中不同物体（共面、共边）算作并列，不算不一致
+//用法：scenecheck <场景文件> [随机光线数]
+#include <iostream>
+#include <random>
+#include "scene_hitable.h"
+#include "Scene.h"
+#include "ShapeBVH.h"
+#include "ComputeCPU.h"
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "usage: scenecheck <file.scene> [random rays]\n";
+		return 1;
+	}
+	scene_desc scene;
+	std::string error;
+	if (!read_scene_file(argv[1], scene, error))
+	{
+		std::cerr << error << "\n";
+		return 1;
+	}
+	int random_rays = argc > 2 ? atoi(argv[2]) : 1 << 20;
+
+	scene_hitables cpu = scene_to_hitables(scene);
+	ComputeCPU::Buffers gpu;
+	gpu.objects = ExportShapes(scene);
+	ComputeCPU::Invocation inv(gpu);
+	const float tmin = 0.001f, tmax = 1000.0f;//与Compute.comp的Color()相同
+
+	//最近交点的物体下标，没有击中时为-1
+	auto trace_cpu = [&](const vec3 &o, const vec3 &d, hit_record &rec) {
+		int hit = -1;
+		real closest = tmax;
+		for (size_t i = 0; i < cpu.objects.size(); i++)
+			if (cpu.objects[i]->hit(ray(o, d, 0), tmin, closest, rec))
+			{
+				closest = rec.t;
+				hit = int(i);
+			}
+		if (hit >= 0)//rec保留最后一次击中的结果
+			cpu.objects[hit]->hit(ray(o, d, 0), tmin, tmax, rec);
+		return hit;
+	};
+	auto trace_gpu = [&](const vec3 &o, const vec3 &d, ComputeCPU::HitInfo &best) {
+		ComputeCPU::Ray r = {glm::vec3(o.x(), o.y(), o.z()), glm::vec3(d.x(), d.y(), d.z())};
+		int hit = -1;
+		best.t = tmax;
+		for (size_t i = 0; i < gpu.objects.size(); i++)
+		{
+			ComputeCPU::HitInfo h = inv.HitShape(ComputeCPU::LoadShape(gpu.objects[i]), r, tmin);
+			if (h.hit && best.t > h.t)
+			{
+				best = h;
+				hit = int(i);
+			}
+		}
+		return hit;
+	};
+
+	long long rays = 0, hits = 0, ties = 0, mismatches = 0;
+	double max_t_error = 0, max_normal_error = 0;
+	auto compare = [&](const vec3 &o, const vec3 &d) {
+		hit_record rec;
+		ComputeCPU::HitInfo h;
+		int a = trace_cpu(o, d, rec), b = trace_gpu(o, d, h);
+		rays++;
+		if (a < 0 && b < 0)
+			return;
+		if (a == b)
+		{
+			hits++;
+			vec3 n = unit_vector(rec.normal);
+			glm::vec3 m = glm::normalize(h.normal);
+			max_t_error = std::max(max_t_error, std::fabs(double(rec.t) - h.t) / h.t);
+			max_normal_error = std::max(max_normal_error, 1.0 - (n.x() * m.x + n.y() * m.y + n.z() * m.z));
+			return;
+		}
+		if (a >= 0 && b >= 0 && std::fabs(double(rec.t) - h.t) <= 1e-4 * h.t)
+		{
+			ties++;
+			return;
+		}
+		if (mismatches++ < 10)
+			std::cerr << "ray (" << o << ") + t (" << d << "): src/ hits " << a << " at t " << (a >= 0 ? rec.t : 0)
+					  << ", shader hits " << b << " at t " << (b >= 0 ? h.t : 0) << "\n";
+	};
+
+	//相机光线：像素中心，与GetRay在光圈为0时相同
+	Camera cam = ExportCamera(scene, 1.0f);
+	const int n = 512;
+	vec3 origin(cam.Origin().x, cam.Origin().y, cam.Origin().z);
+	for (int j = 0; j < n; j++)
+		for (int i = 0; i < n; i++)
+		{
+			glm::vec3 p = cam.LowerLeft() + (i + 0.5f) / n * cam.Horizontal() + (j + 0.5f) / n * cam.Vertical();
+			compare(origin, vec3(p.x, p.y, p.z) - origin);
+		}
+
+	//场景包围盒内的随机光线，覆盖相机看不到的背面和物体内部
+	ShapeBounds bounds;
+	for (const Shape &s : gpu.objects)
+		bounds.Grow(BoundsOf(s));
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> u01(0, 1);
+	for (int k = 0; k < random_rays; k++)
+	{
+		glm::vec3 p = glm::mix(bounds.min, bounds.max, glm::vec3(u01(rng), u01(rng), u01(rng)));
+		float z = 1 - 2 * u01(rng), phi = float(2 * M_PI) * u01(rng), r = sqrtf(std::max(0.0f, 1 - z * z));
+		compare(vec3(p.x, p.y, p.z), vec3(r * cosf(phi), r * sinf(phi), z));
+	}
+
+	std::cout << scene.objects.size() << " objects, " << rays << " rays, " << hits << " hits agree, " << ties
+			  << " ties, " << mismatches << " mismatches\n"
+			  << "max relative t error " << max_t_error << ", max normal error (1 - cos) " << max_normal_error << "\n";
+	return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#ifndef RAYTRACE_SIMD_H
+#define RAYTRACE_SIMD_H
+
+#include <math.h>
+
+//4路float向量的一层薄封装：x86上用SSE（编译器开启FMA时用FMA指令），ARM上用NEON，
+//其他平台退化成普通数组。vec3_simd.h和perlin的批量求值都建立在这层之上
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACE_SIMD_SSE
+#include <immintrin.h>
+typedef __m128 f4;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RAYTRACE_SIMD_NEON
+#include <arm_neon.h>
+typedef float32x4_t f4;
+#else
+#define RAYTRACE_SIMD_SCALAR
+struct f4 { float v[4]; };
+#endif
+
+inline const char *simd_backend()
+{
+#if defined(RAYTRACE_SIMD_SSE)
+#if defined(__FMA__)
+	return "sse+fma";
+#else
+	return "sse";
+#endif
+#elif defined(RAYTRACE_SIMD_NEON)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+#if defined(RAYTRACE_SIMD_SSE)
+
+inline f4 f4_set(float x, float y, float z, float w) { return _mm_set_ps(w, z, y, x); }
+inline f4 f4_splat(float a) { return _mm_set1_ps(a); }
+inline f4 f4_load(const float *p) { return _mm_loadu_ps(p); }
+inline void f4_store(float *p, f4 a) { _mm_storeu_ps(p, a); }
+inline f4 f4_add(f4 a, f4 b) { return _mm_add_ps(a, b); }
+inline f4 f4_sub(f4 a, f4 b) { return _mm_sub_ps(a, b); }
+inline f4 f4_mul(f4 a, f4 b) { return _mm_mul_ps(a, b); }
+inline f4 f4_div(f4 a, f4 b) { return _mm_div_ps(a, b); }
+inline f4 f4_min(f4 a, f4 b) { return _mm_min_ps(a, b); }
+inline f4 f4_max(f4 a, f4 b) { return _mm_max_ps(a, b); }
+inline f4 f4_sqrt(f4 a) { return _mm_sqrt_ps(a); }
+//(x,y,z,w) -> (y,z,x,w)
+inline f4 f4_yzx(f4 a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+#if defined(__FMA__)
+inline f4 f4_fmadd(f4 a, f4 b, f4 c) { return _mm_fmadd_ps(a, b, c); }
+inline f4 f4_fmsub(f4 a, f4 b, f4 c) { return _mm_fmsub_ps(a, b, c); }
+#else
+inline f4 f4_fmadd(f4 a, f4 b, f4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+inline f4 f4_fmsub(f4 a, f4 b, f4 c) { return _mm_sub_ps(_mm_mul_ps(a, b), c); }
+#endif
+//近似的1/sqrt(a)，再做一次牛顿迭代，精度约22位
+inline f4 f4_rsqrt(f4 a)
+{
+	f4 r = _mm_rsqrt_ps(a);
+	f4 half_a = _mm_mul_ps(a, _mm_set1_ps(0.5f));
+	return _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(half_a, _mm_mul_ps(r, r))));
+}
+//前三个分量的点积，结果广播到所有分量。有FMA时y、z两项用融合乘加累加到x*y上，少两次舍入
+inline f4 f4_dot3(f4 a, f4 b)
+{
+#if defined(__FMA__)
+	f4 s = _mm_mul_ss(a, b);
+	s = _mm_fmadd_ss(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 1, 1, 1)), s);
+	s = _mm_fmadd_ss(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 2, 2)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 2, 2)), s);
+#else
+	f4 p = _mm_mul_ps(a, b);
+	f4 s = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+	s = _mm_add_ss(s, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2)));
+#endif
+	return _mm_shuffle_ps(s, s, _MM_SHUFFLE(0, 0, 0, 0));
+}
+inline float f4_first(f4 a) { return _mm_cvtss_f32(a); }
+
+#elif defined(RAYTRACE_SIMD_NEON)
+
+inline f4 f4_set(float x, float y, float z, float w)
+{
+	float v[4] = {x, y, z, w};
+	return vld1q_f32(v);
+}
+inline f4 f4_splat(float a) { return vdupq_n_f32(a); }
+inline f4 f4_load(const float *p) { return vld1q_f32(p); }
+inline void f4_store(float *p, f4 a) { vst1q_f32(p, a); }
+inline f4 f4_add(f4 a, f4 b) { return vaddq_f32(a, b); }
+inline f4 f4_sub(f4 a, f4 b) { return vsubq_f32(a, b); }
+inline f4 f4_mul(f4 a, f4 b) { return vmulq_f32(a, b); }
+inline f4 f4_min(f4 a, f4 b) { return vminq_f32(a, b); }
+inline f4 f4_max(f4 a, f4 b) { return vmaxq_f32(a, b); }
+#if defined(__aarch64__)
+inline f4 f4_div(f4 a, f4 b) { return vdivq_f32(a, b); }
+inline f4 f4_sqrt(f4 a) { return vsqrtq_f32(a); }
+inline f4 f4_fmadd(f4 a, f4 b, f4 c) { return vfmaq_f32(c, a, b); }
+inline f4 f4_fmsub(f4 a, f4 b, f4 c) { return vnegq_f32(vfmsq_f32(c, a, b)); }
+#else
+inline f4 f4_div(f4 a, f4 b)
+{
+	float x[4], y[4];
+	vst1q_f32(x, a);
+	vst1q_f32(y, b);
+	return f4_set(x[0] / y[0], x[1] / y[1], x[2] / y[2], x[3] / y[3]);
+}
+inline f4 f4_sqrt(f4 a)
+{
+	float x[4];
+	vst1q_f32(x, a);
+	return f4_set(sqrtf(x[0]), sqrtf(x[1]), sqrtf(x[2]), sqrtf(x[3]));
+}
+inline f4 f4_fmadd(f4 a, f4 b, f4 c) { return vmlaq_f32(c, a, b); }
+inline f4 f4_fmsub(f4 a, f4 b, f4 c) { return vsubq_f32(vmulq_f32(a, b), c); }
+#endif
+inline f4 f4_yzx(f4 a)
+{
+	float x[4];
+	vst1q_f32(x, a);
+	return f4_set(x[1], x[2], x[0], x[3]);
+}
+inline f4 f4_rsqrt(f4 a)
+{
+	f4 r = vrsqrteq_f32(a);
+	r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a, r), r));
+	return vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a, r), r));
+}
+inline f4 f4_dot3(f4 a, f4 b)
+{
+#if defined(__aarch64__)
+	//aarch64总有FMA，与SSE+FMA的累加顺序相同
+	float s = vgetq_lane_f32(a, 0) * vgetq_lane_f32(b, 0);
+	s = fmaf(vgetq_lane_f32(a, 1), vgetq_lane_f32(b, 1), s);
+	return vdupq_n_f32(fmaf(vgetq_lane_f32(a, 2), vgetq_lane_f32(b, 2), s));
+#else
+	f4 p = vmulq_f32(a, b);
+	return vdupq_n_f32(vgetq_lane_f32(p, 0) + vgetq_lane_f32(p, 1) + vgetq_lane_f32(p, 2));
+#endif
+}
+inline float f4_first(f4 a) { return vgetq_lane_f32(a, 0); }
+
+#else
+
+inline f4 f4_set(float x, float y, float z, float w) { return f4{{x, y, z, w}}; }
+inline f4 f4_splat(float a) { return f4{{a, a, a, a}}; }
+inline f4 f4_load(const float *p) { return f4{{p[0], p[1], p[2], p[3]}}; }
+inline void f4_store(float *p, f4 a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+#define RAYTRACE_F4_LANEWISE(name, expr) \
+	inline f4 name(f4 a, f4 b) { f4 r; for (int i = 0; i < 4; i++) r.v[i] = (expr); return r; }
+RAYTRACE_F4_LANEWISE(f4_add, a.v[i] + b.v[i])
+RAYTRACE_F4_LANEWISE(f4_sub, a.v[i] - b.v[i])
+RAYTRACE_F4_LANEWISE(f4_mul, a.v[i] * b.v[i])
+RAYTRACE_F4_LANEWISE(f4_div, a.v[i] / b.v[i])
+RAYTRACE_F4_LANEWISE(f4_min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+RAYTRACE_F4_LANEWISE(f4_max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+#undef RAYTRACE_F4_LANEWISE
+inline f4 f4_sqrt(f4 a) { return f4_set(sqrtf(a.v[0]), sqrtf(a.v[1]), sqrtf(a.v[2]), sqrtf(a.v[3])); }
+inline f4 f4_fmadd(f4 a, f4 b, f4 c) { return f4_add(f4_mul(a, b), c); }
+inline f4 f4_fmsub(f4 a, f4 b, f4 c) { return f4_sub(f4_mul(a, b), c); }
+inline f4 f4_yzx(f4 a) { return f4_set(a.v[1], a.v[2], a.v[0], a.v[3]); }
+inline f4 f4_rsqrt(f4 a)
+{ return f4_set(1 / sqrtf(a.v[0]), 1 / sqrtf(a.v[1]), 1 / sqrtf(a.v[2]), 1 / sqrtf(a.v[3])); }
+inline f4 f4_dot3(f4 a, f4 b) { return f4_splat(a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2]); }
+inline float f4_first(f4 a) { return a.v[0]; }
+
+#endif
+
+#endif //RAYTRACE_SIMD_H
@@ -6,53 +6,179 @@
 #define RAYTRACE_SPHERE_H
 
 #include "hitable.h"
+#include "sampling.h"
+#include "material.h"
+#include "distribution.h"
+
+//光线与球面在(t_min, t_max)内最近的交点，按标量类型T模板化，float和double两种精度共用
+template<typename T>
+inline bool sphere_intersect(const vec3_t<T> &center, T radius, const ray_t<T> &r, T t_min, T t_max, T &t)
+{
+	vec3_t<T> oc = r.origin() - center;
+	T a = dot(r.direction(), r.direction());
+	T b = dot(oc, r.direction());//注意原来这里是b = 2 * dot(oc, r.direction()); 这个2提出来和4ac一起拿到根号外了
+	T c = dot(oc, oc) - radius * radius;
+	T discriminant = b * b - a * c;//这里不是b^2 - 4ac，原因见上
+	if (discriminant > 0)
+	{
+		T temp = (-b - sqrt(discriminant)) / a;//依旧是交点t的求根公式；变形是因为分子提出了2，所以与分母的2a中的2约去
+		if (temp < t_max && temp > t_min)//两个解中t小的那个光线击中了球面
+		{
+			t = temp;
+			return true;
+		}
+		temp = (-b + sqrt(discriminant)) / a;
+		if (temp < t_max && temp > t_min)//判定两个解大的那个光线是否击中球面
+		{
+			t = temp;
+			return true;
+		}
+	}
+	return false;
+}
 
 class sphere : public hitable
 {
 public:
 	sphere(){}
-	sphere(vec3 cen, float r, material *m) : center(cen), radius(r), mat_ptr(m){}
+	sphere(vec3 cen, real r, material *m) : center(cen), radius(r), mat_ptr(m){}
 
-	virtual bool hit(const ray &r, float tmin, float tmax, hit_record &rec) const;
+	virtual bool hit(const ray &r, real tmin, real tmax, hit_record &rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
+	virtual bool hit_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const;
+	virtual real pdf_value(const vec3 &o, const vec3 &v) const;
+	virtual vec3 random(const vec3 &o) const;
+	virtual bool emitter_shape(real &area, vec3 &axis, real &theta_o, bool &two_sided) const
+	{
+		area = 4 * M_PI * radius * radius;
+		axis = vec3(0, 0, 1);
+		theta_o = M_PI;//法线朝向所有方向
+		two_sided = false;
+		return true;
+	}
+	virtual bool tabulate_emission(int res, real &power);
+	virtual void bind_materials(material_binder &binder)
+	{ mat_id = binder.bind(mat_ptr); }
 
 private:
+	//球面uv（get_sphere_uv的反函数）对应的点，jacobian是面积元dA / (du dv)
+	vec3 uv_point(float u, float v, real &jacobian) const;
+
+	//按emit_dist在整个球面上取点时方向v的立体角pdf
+	real emission_pdf(const vec3 &o, const vec3 &v) const;
+
 	vec3 center;
-	float radius;
+	real radius;
 	material *mat_ptr;
+	int mat_id = -1;
+	distribution_2d *emit_dist = nullptr;//为空时在可见的锥内均匀取方向
 };
 
-bool sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
+bool sphere::hit(const ray &r, real t_min, real t_max, hit_record &rec) const
+{
+	if (!sphere_intersect(center, radius, r, t_min, t_max, rec.t))
+		return false;
+	rec.p = r.point_at_parameter(rec.t);
+	get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
+	rec.normal = (rec.p - center) / radius;
+	rec.mat_ptr = mat_ptr;
+	rec.mat_id = mat_id;
+	rec.prim = this;
+	return true;
+}
+
+//一次求出两个根，而不是两次hit()
+bool sphere::hit_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const
 {
 	vec3 oc = r.origin() - center;
-	float a = dot(r.direction(), r.direction());
-	float b = dot(oc, r.direction());//注意原来这里是b = 2 * dot(oc, r.direction()); 这个2提出来和4ac一起拿到根号外了
-	float c = dot(oc, oc) - radius * radius;
-	float discriminant = b * b - a * c;//这里不是b^2 - 4ac，原因见上
-	if (discriminant > 0)
+	real a = dot(r.direction(), r.direction());
+	real b = dot(oc, r.direction());
+	real c = dot(oc, oc) - radius * radius;
+	real discriminant = b * b - a * c;
+	if (discriminant <= 0)
+		return false;
+	real root = sqrt(discriminant);
+	return clip_interval((-b - root) / a, (-b + root) / a, t_min, t_max, t_enter, t_exit);
+}
+
+//在o看到的球冠所对的锥内均匀取方向；o在球内时退回整个球面
+real sphere::pdf_value(const vec3 &o, const vec3 &v) const
+{
+	if (emit_dist)
+		return emission_pdf(o, v);
+	hit_record rec;
+	if (!hit(ray(o, v), ray_epsilon, FLT_MAX, rec))
+		return 0;
+	real distance_squared = (center - o).squared_length();
+	if (distance_squared <= radius * radius)
+		return 1 / (4 * M_PI);
+	real cos_max = sqrt(1 - radius * radius / distance_squared);
+	return 1 / (2 * M_PI * (1 - cos_max));
+}
+
+vec3 sphere::random(const vec3 &o) const
+{
+	float a, b;
+	if (emit_dist)
 	{
-		float temp = (-b - sqrt(discriminant)) / a;//依旧是交点t的求根公式；变形是因为分子提出了2，所以与分母的2a中的2约去
-		if (temp < t_max && temp > t_min)//两个解中t小的那个光线击中了球面
-		{
-			rec.t = temp;
-			rec.p = r.point_at_parameter(rec.t);
-			get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-			rec.normal = (rec.p - center) / radius;
-			rec.mat_ptr = mat_ptr;
-			return true;
-		}
-		temp = (-b + sqrt(discriminant)) / a;
-		if (temp < t_max && temp > t_min)//判定两个解大的那个光线是否击中球面
-		{
-			rec.t = temp;
-			rec.p = r.point_at_parameter(rec.t);
-			get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-			rec.normal = (rec.p - center) / radius;
-			rec.mat_ptr = mat_ptr;
-			return true;
-		}
+		real jacobian;
+		sample_uv(emit_dist, a, b);
+		return uv_point(a, b, jacobian) - o;
 	}
-	return false;
+	sample_2d(a, b);
+	vec3 direction = center - o;
+	real distance_squared = direction.squared_length();
+	if (distance_squared <= radius * radius)
+		return uniform_sample_sphere(a, b);
+	real cos_max = sqrt(1 - radius * radius / distance_squared);
+	return onb(unit_vector(direction)).local(uniform_sample_cone(a, b, cos_max));
+}
+
+vec3 sphere::uv_point(float u, float v, real &jacobian) const
+{
+	real phi = M_PI - 2 * M_PI * u;
+	real theta = M_PI * v - M_PI / 2;//纬度
+	jacobian = 2 * M_PI * M_PI * radius * radius * cos(theta);
+	return center + radius * vec3(cos(theta) * cos(phi), sin(theta), cos(theta) * sin(phi));
+}
+
+//取的点可能在背面，这时方向v先击中正面，所以直线与球面的每个交点都可能是取到的点，
+//各自的面积pdf换算成立体角后相加；o在球内时只有前方的一个交点
+real sphere::emission_pdf(const vec3 &o, const vec3 &v) const
+{
+	vec3 oc = o - center;
+	real a = dot(v, v);
+	real b = dot(oc, v);
+	real c = dot(oc, oc) - radius * radius;
+	real discriminant = b * b - a * c;
+	if (discriminant <= 0)
+		return 0;
+	real root = sqrt(discriminant);
+	real pdf = 0;
+	for (real t : {(-b - root) / a, (-b + root) / a})
+	{
+		if (t <= ray_epsilon)
+			continue;
+		vec3 n = (oc + t * v) / radius;
+		float u, w;
+		get_sphere_uv(n, u, w);
+		real cos_lat = sqrt(ffmax(real(0), 1 - n.y() * n.y()));
+		real area_pdf = emit_dist->pdf(u, w) / (2 * M_PI * M_PI * radius * radius * ffmax(cos_lat, real(1e-6)));
+		real cosine = fabs(dot(n, v)) / sqrt(a);
+		if (cosine <= 0)
+			continue;
+		pdf += area_pdf * t * t * a / cosine;
+	}
+	return pdf;
+}
+
+bool sphere::tabulate_emission(int res, real &power)
+{
+	delete emit_dist;
+	emit_dist = tabulate_surface_emission(res, [&](float u, float v, real &jacobian) {
+		return luminance(mat_ptr->emitted(u, v, uv_point(u, v, jacobian)));
+	}, power);
+	return emit_dist != nullptr;
 }
 
 //绑定了球体外接正方体的左下角和右上角作为min和max
@@ -0,0 +1,360 @@
+#ifndef RAYTRACE_TEX_FILE_H
+#define RAYTRACE_TEX_FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "vec3.h"
+
+//mip金字塔中的一层，按行存放的rgb浮点数
+struct texture_level
+{
+	int nx, ny;
+	std::vector<float> rgb;
+};
+
+//由8位rgb图片生成完整的mip金字塔：第0层是原图，之后每层长宽减半，直到1x1
+std::vector<texture_level> build_mip_chain(const unsigned char *pixels, int nx, int ny)
+{
+	std::vector<texture_level> mips;
+	texture_level base;
+	base.nx = nx;
+	base.ny = ny;
+	base.rgb.resize(3 * nx * ny);
+	for (size_t k = 0; k < base.rgb.size(); k++)
+		base.rgb[k] = pixels[k] / 255.0f;
+	mips.push_back(std::move(base));
+
+	//逐层缩小，每个方向上把相邻两个像素平均；奇数边长时最后一个输出像素取最后三个像素的平均，
+	//这样最后一行/列并入前面的像素，而不是被丢掉
+	while (mips.back().nx > 1 || mips.back().ny > 1)
+	{
+		const texture_level &prev = mips.back();
+		texture_level next;
+		next.nx = prev.nx > 1 ? prev.nx / 2 : 1;
+		next.ny = prev.ny > 1 ? prev.ny / 2 : 1;
+		next.rgb.resize(3 * next.nx * next.ny);
+		//输出像素i在这一方向上覆盖的输入像素[first, first + count)
+		auto taps = [](int i, int n, int next_n, int &first, int &count) {
+			first = n > 1 ? 2 * i : 0;
+			count = n == 1 ? 1 : (n % 2 == 1 && i == next_n - 1 ? 3 : 2);
+		};
+		for (int j = 0; j < next.ny; j++)
+			for (int i = 0; i < next.nx; i++)
+			{
+				int i0, ci, j0, cj;
+				taps(i, prev.nx, next.nx, i0, ci);
+				taps(j, prev.ny, next.ny, j0, cj);
+				for (int c = 0; c < 3; c++)
+				{
+					float sum = 0;
+					for (int y = j0; y < j0 + cj; y++)
+						for (int x = i0; x < i0 + ci; x++)
+							sum += prev.rgb[3 * (x + prev.nx * y) + c];
+					next.rgb[3 * (i + next.nx * j) + c] = sum / (ci * cj);
+				}
+			}
+		mips.push_back(std::move(next));
+	}
+	return mips;
+}
+
+//分块纹理文件（.tex）：tex_file_header，接着levels个tex_level_header，然后是各层的tile数据。
+//每层切成TEX_TILE x TEX_TILE的tile，边缘不足一个tile的部分重复最后一行/列补齐；
+//tile按行排列，tile内的像素按Morton顺序存放，二维上相邻的像素在文件和内存中也大多相邻。
+//文件由texconv离线生成，可以直接mmap进image_texture，或者经texture_cache按tile读入
+const int TEX_TILE = 32;
+
+//像素值一律是渲染器直接使用的值（原图字节/255），两种格式的区别只在精度
+enum class tex_format : uint32_t
+{
+	rgb8 = 0,//每个分量一个字节，即原图的字节（mip层四舍五入到8位）
+	rgb16f = 1//每个分量一个半精度浮点数，mip层不损失精度
+};
+
+struct tex_file_header
+{
+	char magic[4];//"RTEX"
+	uint32_t version;
+	uint32_t format;//tex_format
+	uint32_t tile_size;
+	uint32_t levels;
+	uint32_t reserved;
+};
+
+struct tex_level_header
+{
+	uint32_t nx, ny;
+	uint32_t tiles_x, tiles_y;
+	uint64_t offset;//这一层第一个tile在文件中的偏移
+};
+
+inline int tex_texel_bytes(uint32_t format)
+{ return format == uint32_t(tex_format::rgb16f) ? 6 : 3; }
+
+inline size_t tex_tile_bytes(uint32_t format)
+{ return size_t(TEX_TILE) * TEX_TILE * tex_texel_bytes(format); }
+
+//float转IEEE半精度，就近舍入；超出范围变成无穷大，过小的变成非规格化数或0
+inline uint16_t float_to_half(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, 4);
+	uint32_t sign = (x >> 16) & 0x8000u;
+	int exp = int((x >> 23) & 0xFF) - 127 + 15;
+	uint32_t mant = x & 0x7FFFFFu;
+	if (((x >> 23) & 0xFF) == 0xFF)//Inf/NaN
+		return uint16_t(sign | 0x7C00u | (mant ? 0x200u : 0));
+	if (exp >= 31)
+		return uint16_t(sign | 0x7C00u);
+	if (exp <= 0)
+	{
+		if (exp < -10)
+			return uint16_t(sign);
+		mant |= 0x800000u;
+		int shift = 14 - exp;
+		uint32_t h = mant >> shift;
+		uint32_t rest = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+		if (rest > half || (rest == half && (h & 1)))
+			h++;
+		return uint16_t(sign | h);
+	}
+	uint32_t h = sign | (uint32_t(exp) << 10) | (mant >> 13);
+	uint32_t rest = mant & 0x1FFFu;
+	if (rest > 0x1000u || (rest == 0x1000u && (h & 1)))
+		h++;//进位可能一直进到指数上，结果仍然正确
+	return uint16_t(h);
+}
+
+inline float half_to_float(uint16_t h)
+{
+	uint32_t sign = uint32_t(h & 0x8000u) << 16;
+	uint32_t exp = (h >> 10) & 0x1F;
+	uint32_t mant = h & 0x3FFu;
+	uint32_t x;
+	if (exp == 0)
+	{
+		if (mant == 0)
+			x = sign;
+		else//非规格化数，规格化之后再拼成float
+		{
+			exp = 127 - 15 + 1;
+			while (!(mant & 0x400u))
+			{
+				mant <<= 1;
+				exp--;
+			}
+			x = sign | (exp << 23) | ((mant & 0x3FFu) << 13);
+		}
+	}
+	else if (exp == 31)
+		x = sign | 0x7F800000u | (mant << 13);
+	else
+		x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+	float f;
+	memcpy(&f, &x, 4);
+	return f;
+}
+
+inline void encode_texel(uint32_t format, const float *rgb, unsigned char *out)
+{
+	if (format == uint32_t(tex_format::rgb16f))
+	{
+		uint16_t h[3] = {float_to_half(rgb[0]), float_to_half(rgb[1]), float_to_half(rgb[2])};
+		memcpy(out, h, sizeof(h));
+		return;
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		float v = rgb[c] * 255 + 0.5f;
+		out[c] = (unsigned char) (v < 0 ? 0 : v > 255 ? 255 : v);
+	}
+}
+
+inline vec3 decode_texel(uint32_t format, const unsigned char *in)
+{
+	if (format == uint32_t(tex_format::rgb16f))
+	{
+		uint16_t h[3];
+		memcpy(h, in, sizeof(h));
+		return vec3(half_to_float(h[0]), half_to_float(h[1]), half_to_float(h[2]));
+	}
+	return vec3(in[0] / 255.0f, in[1] / 255.0f, in[2] / 255.0f);
+}
+
+//把x的低8位分散到偶数位上
+inline uint32_t part1by1(uint32_t x)
+{
+	x = (x | (x << 4)) & 0x0F0F0F0Fu;
+	x = (x | (x << 2)) & 0x33333333u;
+	x = (x | (x << 1)) & 0x55555555u;
+	return x;
+}
+
+//tile内坐标(x, y)的Morton下标
+inline uint32_t tile_morton(uint32_t x, uint32_t y)
+{ return part1by1(x) | (part1by1(y) << 1); }
+
+//文件头是否合法；levels不为空时还检查各层：第0层之后每层的长宽都是上一层减半（与build_mip_chain一致），
+//tile数正好盖住这一层，并且数据都在size之内。tile()按(u, v)算出的tile下标因此不会越过文件
+inline bool tex_header_valid(const tex_file_header &header, const tex_level_header *levels, uint64_t size)
+{
+	if (memcmp(header.magic, "RTEX", 4) != 0 || header.version != 1 || header.tile_size != uint32_t(TEX_TILE) ||
+		header.levels == 0 || header.levels > 64 || header.format > uint32_t(tex_format::rgb16f))
+		return false;
+	if (!levels)
+		return true;
+	uint64_t tile_bytes = tex_tile_bytes(header.format);
+	for (uint32_t l = 0; l < header.levels; l++)
+	{
+		const tex_level_header &L = levels[l];
+		if (L.nx == 0 || L.ny == 0 || L.nx > uint32_t(INT32_MAX) || L.ny > uint32_t(INT32_MAX))
+			return false;
+		if (l > 0)
+		{
+			const tex_level_header &prev = levels[l - 1];
+			if ((prev.nx == 1 && prev.ny == 1) || L.nx != (prev.nx > 1 ? prev.nx / 2 : 1) ||
+				L.ny != (prev.ny > 1 ? prev.ny / 2 : 1))
+				return false;
+		}
+		if (L.tiles_x != (L.nx + TEX_TILE - 1) / TEX_TILE || L.tiles_y != (L.ny + TEX_TILE - 1) / TEX_TILE)
+			return false;
+		//tiles_x、tiles_y都不超过2^26，乘积不会溢出
+		if (L.offset > size || uint64_t(L.tiles_x) * L.tiles_y > (size - L.offset) / tile_bytes)
+			return false;
+	}
+	return true;
+}
+
+//把mip金字塔切块后写成.tex文件
+bool write_tiled_texture(const std::string &path, const std::vector<texture_level> &mips, uint32_t format)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	tex_file_header header = {{'R', 'T', 'E', 'X'}, 1, format, uint32_t(TEX_TILE), uint32_t(mips.size()), 0};
+	size_t tile_bytes = tex_tile_bytes(format);
+	std::vector<tex_level_header> levels(mips.size());
+	uint64_t offset = sizeof(header) + sizeof(tex_level_header) * mips.size();
+	for (size_t l = 0; l < mips.size(); l++)
+	{
+		tex_level_header &L = levels[l];
+		L.nx = mips[l].nx;
+		L.ny = mips[l].ny;
+		L.tiles_x = (L.nx + TEX_TILE - 1) / TEX_TILE;
+		L.tiles_y = (L.ny + TEX_TILE - 1) / TEX_TILE;
+		L.offset = offset;
+		offset += uint64_t(L.tiles_x) * L.tiles_y * tile_bytes;
+	}
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(levels.data(), sizeof(tex_level_header), levels.size(), f);
+
+	int texel_bytes = tex_texel_bytes(format);
+	std::vector<unsigned char> tile(tile_bytes);
+	for (size_t l = 0; l < mips.size(); l++)
+	{
+		const texture_level &m = mips[l];
+		for (uint32_t ty = 0; ty < levels[l].tiles_y; ty++)
+			for (uint32_t tx = 0; tx < levels[l].tiles_x; tx++)
+			{
+				for (int y = 0; y < TEX_TILE; y++)
+					for (int x = 0; x < TEX_TILE; x++)
+					{
+						int i = std::min(int(tx) * TEX_TILE + x, m.nx - 1);
+						int j = std::min(int(ty) * TEX_TILE + y, m.ny - 1);
+						encode_texel(format, &m.rgb[3 * (i + m.nx * j)], &tile[texel_bytes * tile_morton(x, y)]);
+					}
+				fwrite(tile.data(), 1, tile_bytes, f);
+			}
+	}
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+//只读映射一个.tex文件。不支持mmap的平台上退化成整个读进内存
+class mapped_tex_file
+{
+public:
+	~mapped_tex_file()
+	{
+#ifndef _WIN32
+		if (data && buffer.empty())
+			munmap(const_cast<unsigned char *>(data), size);
+#endif
+	}
+
+	//映射并检查文件头，失败时返回nullptr
+	static mapped_tex_file *open(const std::string &path)
+	{
+		mapped_tex_file *m = new mapped_tex_file;
+#ifndef _WIN32
+		int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				m->data = (const unsigned char *) p;
+				m->size = size_t(st.st_size);
+			}
+		}
+		if (fd >= 0)
+			close(fd);
+#else
+		if (FILE *f = fopen(path.c_str(), "rb"))
+		{
+			fseek(f, 0, SEEK_END);
+			m->buffer.resize(size_t(_ftelli64(f)));
+			fseek(f, 0, SEEK_SET);
+			if (fread(m->buffer.data(), 1, m->buffer.size(), f) == m->buffer.size())
+			{
+				m->data = m->buffer.data();
+				m->size = m->buffer.size();
+			}
+			fclose(f);
+		}
+#endif
+		if (!m->data || m->size < sizeof(tex_file_header) ||
+			!tex_header_valid(*m->header(), nullptr, m->size) ||
+			m->size < sizeof(tex_file_header) + m->header()->levels * sizeof(tex_level_header) ||
+			!tex_header_valid(*m->header(), m->level(0), m->size))
+		{
+			delete m;
+			return nullptr;
+		}
+		return m;
+	}
+
+	const tex_file_header *header() const
+	{ return (const tex_file_header *) data; }
+
+	const tex_level_header *level(int l) const
+	{ return (const tex_level_header *) (data + sizeof(tex_file_header)) + l; }
+
+	//第level层(tx, ty)处tile的数据
+	const unsigned char *tile(int l, int tx, int ty) const
+	{
+		const tex_level_header *L = level(l);
+		return data + L->offset + (uint64_t(ty) * L->tiles_x + tx) * tex_tile_bytes(header()->format);
+	}
+
+private:
+	mapped_tex_file() {}
+
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+	std::vector<unsigned char> buffer;
+};
+
+#endif //RAYTRACE_TEX_FILE_H
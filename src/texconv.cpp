@@ -0,0 +1,59 @@
+//离线纹理转换：解码一次图片，生成mip、切块，写成image_texture可以直接mmap的.tex文件
+//用法：texconv <输入图片> <输出.tex> [--format rgb8|rgb16f]
+#include <iostream>
+#include <cstring>
+#include <chrono>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "tex_file.h"
+
+int main(int argc, char *argv[])
+{
+	const char *input = nullptr, *output = nullptr;
+	tex_format format = tex_format::rgb8;
+	for (int a = 1; a < argc; a++)
+	{
+		if (strcmp(argv[a], "--format") == 0 && a + 1 < argc)
+		{
+			a++;
+			if (strcmp(argv[a], "rgb8") == 0)
+				format = tex_format::rgb8;
+			else if (strcmp(argv[a], "rgb16f") == 0)
+				format = tex_format::rgb16f;
+			else
+			{
+				std::cerr << "unknown format " << argv[a] << "\n";
+				return 1;
+			}
+		}
+		else if (!input)
+			input = argv[a];
+		else if (!output)
+			output = argv[a];
+	}
+	if (!input || !output)
+	{
+		std::cerr << "usage: texconv <image> <output.tex> [--format rgb8|rgb16f]\n";
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	int nx, ny, nn;
+	unsigned char *pixels = stbi_load(input, &nx, &ny, &nn, 3);
+	if (!pixels)
+	{
+		std::cerr << "cannot decode " << input << ": " << stbi_failure_reason() << "\n";
+		return 1;
+	}
+	std::vector<texture_level> mips = build_mip_chain(pixels, nx, ny);
+	stbi_image_free(pixels);
+	if (!write_tiled_texture(output, mips, uint32_t(format)))
+	{
+		std::cerr << "cannot write " << output << "\n";
+		return 1;
+	}
+	std::cerr << input << " (" << nx << "x" << ny << ") -> " << output << ": " << mips.size() << " levels, "
+			  << (format == tex_format::rgb16f ? "rgb16f" : "rgb8") << ", "
+			  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s\n";
+	return 0;
+}
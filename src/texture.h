@@ -5,12 +5,23 @@
 #ifndef RAYTRACE_TEXTURE_H
 #define RAYTRACE_TEXTURE_H
 
+#include <vector>
+#include <chrono>
 #include "perlin.h"
+#include "aabb.h"
 
 class texture  {
 public:
 	//表示某个uv点的rgb值的接口
 	virtual vec3 value(float u, float v, const vec3& p) const = 0;
+
+	//带足迹的采样，du、dv是一个像素在uv空间中的宽度；不做滤波的纹理直接忽略足迹
+	virtual vec3 filtered_value(float u, float v, const vec3 &p, float du, float dv) const
+	{ return value(u, v, p); }
+
+	//是否需要足迹，不需要时着色可以省掉微分光线的求交
+	virtual bool filtered() const
+	{ return false; }
 };
 
 class constant_texture : public texture {
@@ -23,9 +34,29 @@ public:
 	}
 
 private:
+	friend class material_table;
 	vec3 color;
 };
 
+//另一个纹理乘以一个颜色，例如把图片当作亮度大于1的发光
+class scale_texture : public texture {
+public:
+	scale_texture(texture *t, const vec3 &s) : tex(t), scale(s) {}
+
+	virtual vec3 value(float u, float v, const vec3 &p) const
+	{ return scale * tex->value(u, v, p); }
+
+	virtual vec3 filtered_value(float u, float v, const vec3 &p, float du, float dv) const
+	{ return scale * tex->filtered_value(u, v, p, du, dv); }
+
+	virtual bool filtered() const
+	{ return tex->filtered(); }
+
+private:
+	texture *tex;
+	vec3 scale;
+};
+
 //做一个国际象棋棋盘
 class checker_texture : public texture{
 public:
@@ -41,25 +72,168 @@ public:
 			return even->value(u, v, p);
 	}
 
+	virtual vec3 filtered_value(float u, float v, const vec3 &p, float du, float dv) const
+	{
+		float sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
+		if (sines < 0)
+			return odd->filtered_value(u, v, p, du, dv);
+		else
+			return even->filtered_value(u, v, p, du, dv);
+	}
+
+	virtual bool filtered() const
+	{ return odd->filtered() || even->filtered(); }
+
 private:
+	friend class material_table;
 	texture *odd;
 	texture *even;
 };
 
+//noise_texture::bake的结果：网格大小、占用内存、耗时，以及随机抽样点上turbulence与精确求值的误差
+struct noise_bake_report
+{
+	int nx, ny, nz;
+	size_t bytes;
+	double seconds;
+	float mean_error, max_error;
+};
+
+//预先算好的一块turbulence网格，三线性插值
+struct noise_grid
+{
+	aabb box;
+	int nx, ny, nz;
+	vec3 cell;//格点间距
+	std::vector<float> values;//x最快，其次y、z
+
+	bool contains(const vec3 &p) const
+	{
+		return p.x() >= box.min().x() && p.x() <= box.max().x() && p.y() >= box.min().y() &&
+			   p.y() <= box.max().y() && p.z() >= box.min().z() && p.z() <= box.max().z();
+	}
+
+	float sample(const vec3 &p) const
+	{
+		//box某个轴的长度为0（例如薄的平板）时该轴的格点间距为0，两层格点重合，直接取第一层
+		vec3 q = p - box.min();
+		float x = cell.x() > 0 ? q.x() / cell.x() : 0;
+		float y = cell.y() > 0 ? q.y() / cell.y() : 0;
+		float z = cell.z() > 0 ? q.z() / cell.z() : 0;
+		int i = std::min(int(x), nx - 2), j = std::min(int(y), ny - 2), k = std::min(int(z), nz - 2);
+		float fx = x - i, fy = y - j, fz = z - k;
+		const float *c = &values[(size_t(k) * ny + j) * nx + i];
+		size_t sy = nx, sz = size_t(nx) * ny;
+		float c00 = c[0] + fx * (c[1] - c[0]);
+		float c10 = c[sy] + fx * (c[sy + 1] - c[sy]);
+		float c01 = c[sz] + fx * (c[sz + 1] - c[sz]);
+		float c11 = c[sz + sy] + fx * (c[sz + sy + 1] - c[sz + sy]);
+		float c0 = c00 + fy * (c10 - c00);
+		float c1 = c01 + fy * (c11 - c01);
+		return c0 + fz * (c1 - c0);
+	}
+};
+
 class noise_texture : public texture {
 public:
 	noise_texture() {}
-	noise_texture(float scale): scale(scale){}
+	//不同种子的纹理是互相独立的噪声场
+	noise_texture(float scale, uint64_t seed = perlin::default_seed): noise(seed), scale(scale){}
 
 	virtual vec3 value(float u, float v, const vec3& p) const {
 		//return vec3(1,1,1)*noise.turb(scale * p);
-		return vec3(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * noise.turb(p)));
+		return vec3(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * turbulence(p)));
 	}
 
+	//把box内的turbulence预先算进一张三维网格，之后box内的点用三线性插值代替7个octave的noise，
+	//其他地方仍然精确求值。网格分辨率按box各边长的比例取，不超过budget字节。
+	//同一个纹理用在几个物体上时可以对每个物体各烘焙一块
+	noise_bake_report bake(const aabb &box, size_t budget);
+
 private:
+	float turbulence(const vec3 &p) const
+	{
+		for (const noise_grid &g : grids)
+			if (g.contains(p))
+				return g.sample(p);
+		return noise.turb(p);
+	}
+
 	perlin noise;
 	float scale;
+	std::vector<noise_grid> grids;
 };
 
+//turbulence本身作为灰度值（截断到[0, 1]），适合当作参与介质的密度场
+class turbulence_texture : public texture {
+public:
+	turbulence_texture(float scale, uint64_t seed = perlin::default_seed) : noise(seed), scale(scale) {}
+
+	virtual vec3 value(float u, float v, const vec3 &p) const {
+		return vec3(1, 1, 1) * fmin(1.0f, noise.turb(scale * p));
+	}
+
+private:
+	perlin noise;
+	float scale;
+};
+
+noise_bake_report noise_texture::bake(const aabb &box, size_t budget)
+{
+	auto start = std::chrono::steady_clock::now();
+	vec3 extent = box.max() - box.min();
+	size_t cells = budget / sizeof(float);
+	//每个轴至少2个格点；从均匀间距h出发，放大h直到格点总数不超过预算
+	double h = cbrt(fmax(extent.x(), 1e-6) * fmax(extent.y(), 1e-6) * fmax(extent.z(), 1e-6) / double(cells));
+	int n[3];
+	for (;;)
+	{
+		size_t total = 1;
+		for (int a = 0; a < 3; a++)
+		{
+			n[a] = std::max(2, int(ceil(extent[a] / h)) + 1);
+			total *= n[a];
+		}
+		if (total <= cells || (n[0] == 2 && n[1] == 2 && n[2] == 2))
+			break;
+		h *= 1.01;
+	}
+	noise_grid g;
+	g.box = box;
+	g.nx = n[0];
+	g.ny = n[1];
+	g.nz = n[2];
+	g.cell = vec3(extent.x() / (g.nx - 1), extent.y() / (g.ny - 1), extent.z() / (g.nz - 1));
+	g.values.resize(size_t(g.nx) * g.ny * g.nz);
+	for (int k = 0; k < g.nz; k++)
+		for (int j = 0; j < g.ny; j++)
+			for (int i = 0; i < g.nx; i++)
+				g.values[(size_t(k) * g.ny + j) * g.nx + i] =
+						noise.turb(box.min() + vec3(i * g.cell.x(), j * g.cell.y(), k * g.cell.z()));
+
+	noise_bake_report report;
+	report.nx = g.nx;
+	report.ny = g.ny;
+	report.nz = g.nz;
+	report.bytes = g.values.size() * sizeof(float);
+	report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double sum = 0;
+	report.max_error = 0;
+	const int samples = 100000;
+	unsigned short seed[3] = {0x330E, 0xABCD, 0x1234};//用单独的随机数状态，不打乱渲染用的drand48序列
+	for (int s = 0; s < samples; s++)
+	{
+		//分开取三个数，函数参数的求值顺序不确定，写在一个表达式里不同编译器会得到不同的点
+		double rx = erand48(seed), ry = erand48(seed), rz = erand48(seed);
+		vec3 p = box.min() + vec3(rx * extent.x(), ry * extent.y(), rz * extent.z());
+		float e = fabs(g.sample(p) - noise.turb(p));
+		sum += e;
+		report.max_error = fmax(report.max_error, e);
+	}
+	report.mean_error = float(sum / samples);
+	grids.push_back(std::move(g));
+	return report;
+}
+
 
 #endif //RAYTRACE_TEXTURE_H
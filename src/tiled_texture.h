@@ -0,0 +1,237 @@
+#ifndef RAYTRACE_TILED_TEXTURE_H
+#define RAYTRACE_TILED_TEXTURE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "image_texture.h"
+
+//多个分块纹理共用的tile缓存：按LRU淘汰，常驻tile的总字节数不超过budget，线程安全。
+//tile以shared_ptr交给调用者，被淘汰的tile在最后一个使用者放手之后才真正释放
+class texture_cache
+{
+public:
+	typedef std::shared_ptr<const std::vector<unsigned char>> tile_ptr;
+
+	explicit texture_cache(size_t budget_bytes) : budget(budget_bytes)
+	{}
+
+	~texture_cache()
+	{
+		for (auto &f : files)
+			fclose(f->fp);
+	}
+
+	//打开一个.tex文件，返回文件编号，失败时返回-1。应在开始渲染之前打开所有文件
+	int open(const std::string &path);
+
+	const tex_file_header &header(int file) const
+	{ return files[file]->header; }
+
+	const tex_level_header &level(int file, int l) const
+	{ return files[file]->levels[l]; }
+
+	//取得一个tile，不在缓存中时从文件读入；读取失败返回空指针
+	tile_ptr tile(int file, int level, int tx, int ty);
+
+	size_t resident_bytes() const
+	{ return resident; }
+
+	size_t hits = 0, misses = 0, evictions = 0;
+
+private:
+	struct tex_file
+	{
+		FILE *fp;
+		tex_file_header header;
+		std::vector<tex_level_header> levels;
+		std::mutex io;//同一个文件的seek+read不能交错
+	};
+
+	struct entry
+	{
+		uint64_t key;
+		tile_ptr data;
+	};
+
+	tile_ptr load(tex_file &f, int level, int tx, int ty);
+
+	size_t budget;
+	size_t resident = 0;
+	std::vector<std::unique_ptr<tex_file>> files;
+	std::list<entry> lru;//表头是最近使用的tile
+	std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+	std::mutex lock;
+};
+
+int texture_cache::open(const std::string &path)
+{
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp)
+		return -1;
+	std::unique_ptr<tex_file> f(new tex_file);
+	f->fp = fp;
+	if (fread(&f->header, sizeof(tex_file_header), 1, fp) != 1 || !tex_header_valid(f->header, nullptr, 0))
+	{
+		fclose(fp);
+		return -1;
+	}
+	f->levels.resize(f->header.levels);
+	bool read = fread(f->levels.data(), sizeof(tex_level_header), f->levels.size(), fp) == f->levels.size();
+#ifdef _WIN32
+	uint64_t size = read && _fseeki64(fp, 0, SEEK_END) == 0 ? uint64_t(_ftelli64(fp)) : 0;
+#else
+	uint64_t size = read && fseeko(fp, 0, SEEK_END) == 0 ? uint64_t(ftello(fp)) : 0;
+#endif
+	if (!read || !tex_header_valid(f->header, f->levels.data(), size))
+	{
+		fclose(fp);
+		return -1;
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	files.push_back(std::move(f));
+	return int(files.size()) - 1;
+}
+
+texture_cache::tile_ptr texture_cache::load(tex_file &f, int level, int tx, int ty)
+{
+	const tex_level_header &L = f.levels[level];
+	size_t bytes = tex_tile_bytes(f.header.format);
+	uint64_t offset = L.offset + (uint64_t(ty) * L.tiles_x + tx) * bytes;
+	std::shared_ptr<std::vector<unsigned char>> data(new std::vector<unsigned char>(bytes));
+	std::lock_guard<std::mutex> guard(f.io);
+#ifdef _WIN32
+	if (_fseeki64(f.fp, offset, SEEK_SET) != 0)
+#else
+	if (fseeko(f.fp, off_t(offset), SEEK_SET) != 0)
+#endif
+		return nullptr;
+	if (fread(data->data(), 1, bytes, f.fp) != bytes)
+		return nullptr;
+	return data;
+}
+
+texture_cache::tile_ptr texture_cache::tile(int file, int level, int tx, int ty)
+{
+	uint64_t key = (uint64_t(file) << 48) | (uint64_t(level) << 40) | (uint64_t(ty) << 20) | uint64_t(tx);
+	tex_file *f;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto it = index.find(key);
+		if (it != index.end())
+		{
+			hits++;
+			lru.splice(lru.begin(), lru, it->second);
+			return it->second->data;
+		}
+		f = files[file].get();
+	}
+
+	//读文件时不持有缓存的锁，其他线程可以继续命中；两个线程同时读同一个tile时以先插入的为准
+	tile_ptr data = load(*f, level, tx, ty);
+	if (!data)
+		return nullptr;
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = index.find(key);
+	if (it != index.end())
+		return it->second->data;
+	misses++;
+	lru.push_front({key, data});
+	index[key] = lru.begin();
+	resident += data->size();
+	while (resident > budget && lru.size() > 1)
+	{
+		resident -= lru.back().data->size();
+		index.erase(lru.back().key);
+		lru.pop_back();
+		evictions++;
+	}
+	return data;
+}
+
+//从texture_cache按需读取tile的图片纹理，滤波方式与image_texture相同
+class tiled_texture : public texture
+{
+public:
+	tiled_texture(texture_cache &c, int f) : cache(c), file(f)
+	{}
+
+	//打开.tex文件，失败时返回nullptr
+	static tiled_texture *open(texture_cache &c, const std::string &path)
+	{
+		int f = c.open(path);
+		return f < 0 ? nullptr : new tiled_texture(c, f);
+	}
+
+	virtual vec3 value(float u, float v, const vec3 &p) const
+	{ return filtered_value(u, v, p, 0, 0); }
+
+	virtual vec3 filtered_value(float u, float v, const vec3 &p, float du, float dv) const;
+
+	virtual bool filtered() const
+	{ return true; }
+
+private:
+	//一次双线性插值的四个像素通常落在同一个tile里，只向缓存取一次
+	struct tile_ref
+	{
+		int tx = -1, ty = -1;
+		texture_cache::tile_ptr data;
+	};
+
+	vec3 texel(int level, int i, int j, tile_ref &ref) const;
+	vec3 bilinear(int level, float u, float v) const;
+
+	texture_cache &cache;
+	int file;
+};
+
+vec3 tiled_texture::texel(int level, int i, int j, tile_ref &ref) const
+{
+	const tex_level_header &L = cache.level(file, level);
+	if (i < 0) i = 0;
+	if (j < 0) j = 0;
+	if (i > int(L.nx) - 1) i = L.nx - 1;
+	if (j > int(L.ny) - 1) j = L.ny - 1;
+	int tx = i / TEX_TILE, ty = j / TEX_TILE;
+	if (tx != ref.tx || ty != ref.ty)
+	{
+		ref.data = cache.tile(file, level, tx, ty);
+		ref.tx = tx;
+		ref.ty = ty;
+	}
+	if (!ref.data)
+		return vec3(0, 0, 0);
+	uint32_t format = cache.header(file).format;
+	return decode_texel(format, &(*ref.data)[tex_texel_bytes(format) * tile_morton(i % TEX_TILE, j % TEX_TILE)]);
+}
+
+vec3 tiled_texture::bilinear(int level, float u, float v) const
+{
+	const tex_level_header &L = cache.level(file, level);
+	float x = u * L.nx - 0.5f;
+	float y = (1 - v) * L.ny - 0.5f;
+	int i = int(floor(x));
+	int j = int(floor(y));
+	float fx = x - i, fy = y - j;
+	tile_ref ref;
+	return (1 - fy) * ((1 - fx) * texel(level, i, j, ref) + fx * texel(level, i + 1, j, ref)) +
+		   fy * ((1 - fx) * texel(level, i, j + 1, ref) + fx * texel(level, i + 1, j + 1, ref));
+}
+
+vec3 tiled_texture::filtered_value(float u, float v, const vec3 &p, float du, float dv) const
+{
+	const tex_level_header &base = cache.level(file, 0);
+	float lod = texture_lod(du, dv, base.nx, base.ny);
+	int top = int(cache.header(file).levels) - 1;
+	if (lod >= top)
+		return bilinear(top, u, v);
+	int level = int(lod);
+	float f = lod - level;
+	if (f == 0)
+		return bilinear(level, u, v);
+	return (1 - f) * bilinear(level, u, v) + f * bilinear(level + 1, u, v);
+}
+
+#endif //RAYTRACE_TILED_TEXTURE_H
@@ -4,133 +4,160 @@
 
 #ifndef RAYTRACE_VEC3_H
 #define RAYTRACE_VEC3_H
+
 #include <math.h>
 #include <stdlib.h>
 #include <iostream>
 
-class vec3  {
+//渲染器使用的标量类型：默认float，定义RAYTRACE_DOUBLE时整条光线/求交管线使用double，
+//适合坐标很大、float精度下容易自相交的场景
+#ifdef RAYTRACE_DOUBLE
+typedef double real;
+#else
+typedef float real;
+#endif
+
+//以标量类型T为模板参数的三维向量；运算符都定义成友元，
+//这样float和double字面量都能像原来一样隐式转换后参与运算
+template<typename T>
+class vec3_t  {
 
 
 public:
-	vec3() {}
-	vec3(float e0, float e1, float e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
-	inline float x() const { return e[0]; }
-	inline float y() const { return e[1]; }
-	inline float z() const { return e[2]; }
-	inline float r() const { return e[0]; }
-	inline float g() const { return e[1]; }
-	inline float b() const { return e[2]; }
-
-	inline const vec3& operator+() const { return *this; }
-	inline vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-	inline float operator[](int i) const { return e[i]; }
-	inline float& operator[](int i) { return e[i]; };
-
-	inline vec3& operator+=(const vec3 &v2);
-	inline vec3& operator-=(const vec3 &v2);
-	inline vec3& operator*=(const vec3 &v2);
-	inline vec3& operator/=(const vec3 &v2);
-	inline vec3& operator*=(const float t);
-	inline vec3& operator/=(const float t);
-
-	inline float length() const { return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
-	inline float squared_length() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
+	typedef T scalar;
+
+	vec3_t() {}
+	vec3_t(T e0, T e1, T e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
+	//不同精度之间显式转换
+	template<typename U>
+	explicit vec3_t(const vec3_t<U> &v) { e[0] = T(v[0]); e[1] = T(v[1]); e[2] = T(v[2]); }
+	inline T x() const { return e[0]; }
+	inline T y() const { return e[1]; }
+	inline T z() const { return e[2]; }
+	inline T r() const { return e[0]; }
+	inline T g() const { return e[1]; }
+	inline T b() const { return e[2]; }
+
+	inline const vec3_t& operator+() const { return *this; }
+	inline vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+	inline T operator[](int i) const { return e[i]; }
+	inline T& operator[](int i) { return e[i]; };
+
+	inline vec3_t& operator+=(const vec3_t &v2);
+	inline vec3_t& operator-=(const vec3_t &v2);
+	inline vec3_t& operator*=(const vec3_t &v2);
+	inline vec3_t& operator/=(const vec3_t &v2);
+	inline vec3_t& operator*=(const T t);
+	inline vec3_t& operator/=(const T t);
+
+	inline T length() const { return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
+	inline T squared_length() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
 	inline void make_unit_vector();
 
-	float e[3];
-};
+	friend inline std::istream& operator>>(std::istream &is, vec3_t &t) {
+		is >> t.e[0] >> t.e[1] >> t.e[2];
+		return is;
+	}
 
-inline std::istream& operator>>(std::istream &is, vec3 &t) {
-	is >> t.e[0] >> t.e[1] >> t.e[2];
-	return is;
-}
+	friend inline std::ostream& operator<<(std::ostream &os, const vec3_t &t) {
+		os << t.e[0] << " " << t.e[1] << " " << t.e[2];
+		return os;
+	}
 
-inline std::ostream& operator<<(std::ostream &os, const vec3 &t) {
-	os << t.e[0] << " " << t.e[1] << " " << t.e[2];
-	return os;
-}
+	friend inline vec3_t operator+(const vec3_t &v1, const vec3_t &v2) {
+		return vec3_t(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2]);
+	}
 
-inline void vec3::make_unit_vector() {
-	float k = 1.0 / sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
-	e[0] *= k; e[1] *= k; e[2] *= k;
-}
+	friend inline vec3_t operator-(const vec3_t &v1, const vec3_t &v2) {
+		return vec3_t(v1.e[0] - v2.e[0], v1.e[1] - v2.e[1], v1.e[2] - v2.e[2]);
+	}
 
-inline vec3 operator+(const vec3 &v1, const vec3 &v2) {
-	return vec3(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2]);
-}
+	friend inline vec3_t operator*(const vec3_t &v1, const vec3_t &v2) {
+		return vec3_t(v1.e[0] * v2.e[0], v1.e[1] * v2.e[1], v1.e[2] * v2.e[2]);
+	}
 
-inline vec3 operator-(const vec3 &v1, const vec3 &v2) {
-	return vec3(v1.e[0] - v2.e[0], v1.e[1] - v2.e[1], v1.e[2] - v2.e[2]);
-}
+	friend inline vec3_t operator/(const vec3_t &v1, const vec3_t &v2) {
+		return vec3_t(v1.e[0] / v2.e[0], v1.e[1] / v2.e[1], v1.e[2] / v2.e[2]);
+	}
 
-inline vec3 operator*(const vec3 &v1, const vec3 &v2) {
-	return vec3(v1.e[0] * v2.e[0], v1.e[1] * v2.e[1], v1.e[2] * v2.e[2]);
-}
+	friend inline vec3_t operator*(T t, const vec3_t &v) {
+		return vec3_t(t*v.e[0], t*v.e[1], t*v.e[2]);
+	}
 
-inline vec3 operator/(const vec3 &v1, const vec3 &v2) {
-	return vec3(v1.e[0] / v2.e[0], v1.e[1] / v2.e[1], v1.e[2] / v2.e[2]);
-}
+	friend inline vec3_t operator/(vec3_t v, T t) {
+		return vec3_t(v.e[0]/t, v.e[1]/t, v.e[2]/t);
+	}
 
-inline vec3 operator*(float t, const vec3 &v) {
-	return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
-}
+	friend inline vec3_t operator*(const vec3_t &v, T t) {
+		return vec3_t(t*v.e[0], t*v.e[1], t*v.e[2]);
+	}
 
-inline vec3 operator/(vec3 v, float t) {
-	return vec3(v.e[0]/t, v.e[1]/t, v.e[2]/t);
-}
+	friend inline T dot(const vec3_t &v1, const vec3_t &v2) {
+		return v1.e[0] *v2.e[0] + v1.e[1] *v2.e[1]  + v1.e[2] *v2.e[2];
+	}
 
-inline vec3 operator*(const vec3 &v, float t) {
-	return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
-}
+	friend inline vec3_t cross(const vec3_t &v1, const vec3_t &v2) {
+		return vec3_t( (v1.e[1]*v2.e[2] - v1.e[2]*v2.e[1]),
+					   (-(v1.e[0]*v2.e[2] - v1.e[2]*v2.e[0])),
+					   (v1.e[0]*v2.e[1] - v1.e[1]*v2.e[0]));
+	}
 
-inline float dot(const vec3 &v1, const vec3 &v2) {
-	return v1.e[0] *v2.e[0] + v1.e[1] *v2.e[1]  + v1.e[2] *v2.e[2];
-}
+	friend inline vec3_t unit_vector(vec3_t v) {
+		return v / v.length();
+	}
 
-inline vec3 cross(const vec3 &v1, const vec3 &v2) {
-	return vec3( (v1.e[1]*v2.e[2] - v1.e[2]*v2.e[1]),
-				 (-(v1.e[0]*v2.e[2] - v1.e[2]*v2.e[0])),
-				 (v1.e[0]*v2.e[1] - v1.e[1]*v2.e[0]));
-}
+	T e[3];
+};
 
+template<typename T>
+inline void vec3_t<T>::make_unit_vector() {
+	T k = 1.0 / sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
+	e[0] *= k; e[1] *= k; e[2] *= k;
+}
 
-inline vec3& vec3::operator+=(const vec3 &v){
+template<typename T>
+inline vec3_t<T>& vec3_t<T>::operator+=(const vec3_t &v){
 	e[0]  += v.e[0];
 	e[1]  += v.e[1];
 	e[2]  += v.e[2];
 	return *this;
 }
 
-inline vec3& vec3::operator*=(const vec3 &v){
+template<typename T>
+inline vec3_t<T>& vec3_t<T>::operator*=(const vec3_t &v){
 	e[0]  *= v.e[0];
 	e[1]  *= v.e[1];
 	e[2]  *= v.e[2];
 	return *this;
 }
 
-inline vec3& vec3::operator/=(const vec3 &v){
+template<typename T>
+inline vec3_t<T>& vec3_t<T>::operator/=(const vec3_t &v){
 	e[0]  /= v.e[0];
 	e[1]  /= v.e[1];
 	e[2]  /= v.e[2];
 	return *this;
 }
 
-inline vec3& vec3::operator-=(const vec3& v) {
+template<typename T>
+inline vec3_t<T>& vec3_t<T>::operator-=(const vec3_t& v) {
 	e[0]  -= v.e[0];
 	e[1]  -= v.e[1];
 	e[2]  -= v.e[2];
 	return *this;
 }
 
-inline vec3& vec3::operator*=(const float t) {
+template<typename T>
+inline vec3_t<T>& vec3_t<T>::operator*=(const T t) {
 	e[0]  *= t;
 	e[1]  *= t;
 	e[2]  *= t;
 	return *this;
 }
 
-inline vec3& vec3::operator/=(const float t) {
-	float k = 1.0/t;
+template<typename T>
+inline vec3_t<T>& vec3_t<T>::operator/=(const T t) {
+	T k = 1.0/t;
 
 	e[0]  *= k;
 	e[1]  *= k;
@@ -138,8 +165,11 @@ inline vec3& vec3::operator/=(const float t) {
 	return *this;
 }
 
-inline vec3 unit_vector(vec3 v) {
-	return v / v.length();
-}
+//float版本可以在编译时换成SIMD实现（vec3_simd.h中对vec3_t<float>的特化）
+#if defined(RAYTRACE_SIMD_VEC3)
+#include "vec3_simd.h"
+#endif
+
+typedef vec3_t<real> vec3;
 
 #endif //RAYTRACE_VEC3_H
@@ -0,0 +1,102 @@
+#ifndef RAYTRACE_VEC3_SIMD_H
+#define RAYTRACE_VEC3_SIMD_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <iostream>
+#include "simd.h"
+
+//与vec3.h中标量版本接口完全相同的vec3_t<float>特化，但是补齐成16字节、用4路SIMD寄存器存储，
+//第4个分量恒为0。编译时定义RAYTRACE_SIMD_VEC3来替换标量版本（只影响float精度）
+typedef vec3_t<float> vec3_f;
+
+template<>
+class alignas(16) vec3_t<float>  {
+
+
+public:
+	typedef float scalar;
+
+	vec3_t() {}
+	vec3_t(float e0, float e1, float e2) { m = f4_set(e0, e1, e2, 0); }
+	template<typename U>
+	explicit vec3_t(const vec3_t<U> &v) { m = f4_set(float(v[0]), float(v[1]), float(v[2]), 0); }
+	explicit vec3_t(f4 v) { m = v; }
+	inline float x() const { return e[0]; }
+	inline float y() const { return e[1]; }
+	inline float z() const { return e[2]; }
+	inline float r() const { return e[0]; }
+	inline float g() const { return e[1]; }
+	inline float b() const { return e[2]; }
+
+	inline const vec3_f& operator+() const { return *this; }
+	inline vec3_f operator-() const { return vec3_f(f4_sub(f4_splat(0), m)); }
+	inline float operator[](int i) const { return e[i]; }
+	inline float& operator[](int i) { return e[i]; };
+
+	inline vec3_f& operator+=(const vec3_f &v2) { m = f4_add(m, v2.m); return *this; }
+	inline vec3_f& operator-=(const vec3_f &v2) { m = f4_sub(m, v2.m); return *this; }
+	inline vec3_f& operator*=(const vec3_f &v2) { m = f4_mul(m, v2.m); return *this; }
+	inline vec3_f& operator/=(const vec3_f &v2);
+	inline vec3_f& operator*=(const float t) { m = f4_mul(m, f4_splat(t)); return *this; }
+	inline vec3_f& operator/=(const float t);
+
+	inline float length() const { return sqrtf(f4_first(f4_dot3(m, m))); }
+	inline float squared_length() const { return f4_first(f4_dot3(m, m)); }
+	inline void make_unit_vector() { m = f4_mul(m, f4_rsqrt(f4_dot3(m, m))); }
+
+	union {
+		f4 m;
+		float e[4];
+	};
+};
+
+inline std::istream& operator>>(std::istream &is, vec3_f &t) {
+	is >> t.e[0] >> t.e[1] >> t.e[2];
+	return is;
+}
+
+inline std::ostream& operator<<(std::ostream &os, const vec3_f &t) {
+	os << t.e[0] << " " << t.e[1] << " " << t.e[2];
+	return os;
+}
+
+inline vec3_f operator+(const vec3_f &v1, const vec3_f &v2) { return vec3_f(f4_add(v1.m, v2.m)); }
+inline vec3_f operator-(const vec3_f &v1, const vec3_f &v2) { return vec3_f(f4_sub(v1.m, v2.m)); }
+inline vec3_f operator*(const vec3_f &v1, const vec3_f &v2) { return vec3_f(f4_mul(v1.m, v2.m)); }
+
+//第4个分量是0/0，这里把它重新置0，保证不会有NaN流到后面
+inline vec3_f operator/(const vec3_f &v1, const vec3_f &v2) {
+	return vec3_f(f4_div(v1.m, f4_set(v2.e[0], v2.e[1], v2.e[2], 1)));
+}
+
+inline vec3_f operator*(float t, const vec3_f &v) { return vec3_f(f4_mul(f4_splat(t), v.m)); }
+inline vec3_f operator/(vec3_f v, float t) { return vec3_f(f4_div(v.m, f4_splat(t))); }
+inline vec3_f operator*(const vec3_f &v, float t) { return vec3_f(f4_mul(f4_splat(t), v.m)); }
+
+//dot、length和单位化都经过f4_dot3，有FMA时用乘加累加
+inline float dot(const vec3_f &v1, const vec3_f &v2) { return f4_first(f4_dot3(v1.m, v2.m)); }
+
+//a x b = (a.yzx * b.zxy - a.zxy * b.yzx)，化成一次乘加：((a * b.yzx) - (a.yzx * b)).yzx
+inline vec3_f cross(const vec3_f &v1, const vec3_f &v2) {
+	f4 a_yzx = f4_yzx(v1.m);
+	f4 b_yzx = f4_yzx(v2.m);
+	return vec3_f(f4_yzx(f4_fmsub(v1.m, b_yzx, f4_mul(a_yzx, v2.m))));
+}
+
+inline vec3_f& vec3_f::operator/=(const vec3_f &v) {
+	m = f4_div(m, f4_set(v.e[0], v.e[1], v.e[2], 1));
+	return *this;
+}
+
+inline vec3_f& vec3_f::operator/=(const float t) {
+	m = f4_mul(m, f4_splat(1.0f / t));
+	return *this;
+}
+
+//用近似倒数平方根代替length()之后的三次除法
+inline vec3_f unit_vector(vec3_f v) {
+	return vec3_f(f4_mul(v.m, f4_rsqrt(f4_dot3(v.m, v.m))));
+}
+
+#endif //RAYTRACE_VEC3_SIMD_H
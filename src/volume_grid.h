@@ -0,0 +1,392 @@
+#ifndef RAYTRACE_VOLUME_GRID_H
+#define RAYTRACE_VOLUME_GRID_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "hitable.h"
+#include "constant_medium.h"
+#include "perlin.h"
+
+//稀疏的体素密度网格：体素按brick x brick x brick分块，全为0的块不存储。
+//每个块另有一个majorant（块内插值可能取到的最大密度），组成一张粗网格，
+//delta tracking沿光线用DDA逐个majorant格子前进，每格用自己的上界：
+//空的格子直接跳过，稀薄的格子步长大，只有稠密的地方才需要小步长
+struct volume_grid
+{
+	static const int brick = 8;
+
+	aabb box;
+	int nx = 0, ny = 0, nz = 0;//体素数
+	int bx = 0, by = 0, bz = 0;//块数
+	vec3 voxel_size;
+	std::vector<int32_t> brick_index;//每个块在brick_data中的序号，空块为-1；x最快，其次y、z
+	std::vector<float> brick_data;//每块brick^3个体素，块内同样x最快
+	std::vector<float> majorant;//每块一个，覆盖三线性插值用到的相邻体素
+
+	void resize(const aabb &b, int x, int y, int z)
+	{
+		box = b;
+		nx = x;
+		ny = y;
+		nz = z;
+		bx = (nx + brick - 1) / brick;
+		by = (ny + brick - 1) / brick;
+		bz = (nz + brick - 1) / brick;
+		vec3 extent = box.max() - box.min();
+		voxel_size = vec3(extent.x() / nx, extent.y() / ny, extent.z() / nz);
+		brick_index.assign(size_t(bx) * by * bz, -1);
+		brick_data.clear();
+		majorant.assign(brick_index.size(), 0.0f);
+	}
+
+	size_t brick_count() const
+	{ return brick_data.size() / (brick * brick * brick); }
+
+	size_t bytes() const
+	{ return brick_data.size() * sizeof(float) + brick_index.size() * (sizeof(int32_t) + sizeof(float)); }
+
+	//体素(i, j, k)的密度，网格外和空块为0
+	float voxel(int i, int j, int k) const
+	{
+		if (i < 0 || j < 0 || k < 0 || i >= nx || j >= ny || k >= nz)
+			return 0;
+		int32_t b = brick_index[(size_t(k / brick) * by + j / brick) * bx + i / brick];
+		if (b < 0)
+			return 0;
+		return brick_data[size_t(b) * brick * brick * brick + ((k % brick) * brick + j % brick) * brick + i % brick];
+	}
+
+	//世界坐标p处的密度，体素值在体素中心，三线性插值
+	float density(const vec3 &p) const
+	{
+		vec3 q = p - box.min();
+		float x = q.x() / voxel_size.x() - 0.5f, y = q.y() / voxel_size.y() - 0.5f, z = q.z() / voxel_size.z() - 0.5f;
+		int i = int(floor(x)), j = int(floor(y)), k = int(floor(z));
+		float fx = x - i, fy = y - j, fz = z - k;
+		float c00 = voxel(i, j, k) + fx * (voxel(i + 1, j, k) - voxel(i, j, k));
+		float c10 = voxel(i, j + 1, k) + fx * (voxel(i + 1, j + 1, k) - voxel(i, j + 1, k));
+		float c01 = voxel(i, j, k + 1) + fx * (voxel(i + 1, j, k + 1) - voxel(i, j, k + 1));
+		float c11 = voxel(i, j + 1, k + 1) + fx * (voxel(i + 1, j + 1, k + 1) - voxel(i, j + 1, k + 1));
+		float c0 = c00 + fy * (c10 - c00);
+		float c1 = c01 + fy * (c11 - c01);
+		return c0 + fz * (c1 - c0);
+	}
+
+	//由体素重新计算每块的majorant：块内的点插值时用到的体素下标范围是[块起点-1, 块终点]
+	void build_majorants()
+	{
+		for (int k = 0; k < bz; k++)
+			for (int j = 0; j < by; j++)
+				for (int i = 0; i < bx; i++)
+				{
+					float m = 0;
+					for (int z = k * brick - 1; z <= (k + 1) * brick; z++)
+						for (int y = j * brick - 1; y <= (j + 1) * brick; y++)
+							for (int x = i * brick - 1; x <= (i + 1) * brick; x++)
+								m = std::max(m, voxel(x, y, z));
+					majorant[(size_t(k) * by + j) * bx + i] = m;
+				}
+	}
+
+	//由f(p)逐块生成，全为0的块不分配
+	template<typename F>
+	void fill(F f)
+	{
+		std::vector<float> block(brick * brick * brick);
+		for (int k = 0; k < bz; k++)
+			for (int j = 0; j < by; j++)
+				for (int i = 0; i < bx; i++)
+				{
+					bool empty = true;
+					for (int z = 0; z < brick; z++)
+						for (int y = 0; y < brick; y++)
+							for (int x = 0; x < brick; x++)
+							{
+								int vx = i * brick + x, vy = j * brick + y, vz = k * brick + z;
+								float d = 0;
+								if (vx < nx && vy < ny && vz < nz)
+									d = f(box.min() + vec3((vx + 0.5f) * voxel_size.x(), (vy + 0.5f) * voxel_size.y(),
+														   (vz + 0.5f) * voxel_size.z()));
+								block[(z * brick + y) * brick + x] = d;
+								empty = empty && d <= 0;
+							}
+					if (empty)
+						continue;
+					brick_index[(size_t(k) * by + j) * bx + i] = int32_t(brick_count());
+					brick_data.insert(brick_data.end(), block.begin(), block.end());
+				}
+		build_majorants();
+	}
+};
+
+//由perlin的turbulence生成一团云：box内切椭球之外为0，往中心逐渐变浓，turbulence低于threshold的地方为空。
+//res是最长边上的体素数，各轴体素大小相同
+inline volume_grid turbulence_volume(const aabb &box, int res, float scale, float threshold,
+									 uint64_t seed = perlin::default_seed)
+{
+	vec3 extent = box.max() - box.min();
+	real h = std::max(extent.x(), std::max(extent.y(), extent.z())) / res;
+	volume_grid g;
+	g.resize(box, std::max(1, int(ceil(extent.x() / h))), std::max(1, int(ceil(extent.y() / h))),
+			 std::max(1, int(ceil(extent.z() / h))));
+	perlin noise(seed);
+	vec3 center = 0.5 * (box.min() + box.max()), half = 0.5 * extent;
+	g.fill([&](const vec3 &p) {
+		vec3 q = p - center;
+		float r = vec3(q.x() / half.x(), q.y() / half.y(), q.z() / half.z()).length();
+		if (r >= 1)
+			return 0.0f;
+		float d = noise.turb(scale * p) * 2 * (1 - r) - threshold;
+		return d > 0 ? d : 0.0f;
+	});
+	return g;
+}
+
+//体积网格文件（.vol）：头部之后是brick_count个块，每块是块坐标(x, y, z)和brick^3个float
+struct volume_header
+{
+	char magic[4];//"RVOL"
+	uint32_t version;//1
+	uint32_t nx, ny, nz;
+	uint32_t brick;//必须等于volume_grid::brick
+	uint32_t brick_count;
+	float min[3], max[3];//网格在世界空间中的范围
+};
+
+bool write_volume_file(const std::string &path, const volume_grid &g)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	volume_header h = {{'R', 'V', 'O', 'L'}, 1, uint32_t(g.nx), uint32_t(g.ny), uint32_t(g.nz), uint32_t(volume_grid::brick),
+					   uint32_t(g.brick_count()),
+					   {float(g.box.min().x()), float(g.box.min().y()), float(g.box.min().z())},
+					   {float(g.box.max().x()), float(g.box.max().y()), float(g.box.max().z())}};
+	fwrite(&h, sizeof(h), 1, f);
+	const size_t voxels = volume_grid::brick * volume_grid::brick * volume_grid::brick;
+	for (int k = 0; k < g.bz; k++)
+		for (int j = 0; j < g.by; j++)
+			for (int i = 0; i < g.bx; i++)
+			{
+				int32_t b = g.brick_index[(size_t(k) * g.by + j) * g.bx + i];
+				if (b < 0)
+					continue;
+				uint32_t c[3] = {uint32_t(i), uint32_t(j), uint32_t(k)};
+				fwrite(c, sizeof(c), 1, f);
+				fwrite(&g.brick_data[size_t(b) * voxels], sizeof(float), voxels, f);
+			}
+	bool ok = !ferror(f);
+	return fclose(f) == 0 && ok;
+}
+
+//读入体积网格文件并重新计算majorant；失败时error说明原因。
+//分配内存之前先检查头部：块数不能超过网格的块数，也不能超过文件实际装得下的块数，每个块的位置只能出现一次
+bool read_volume_file(const std::string &path, volume_grid &g, std::string &error)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+	{
+		error = "cannot open";
+		return false;
+	}
+	const size_t voxels = volume_grid::brick * volume_grid::brick * volume_grid::brick;
+	const uint64_t record_bytes = sizeof(uint32_t) * 3 + sizeof(float) * voxels;
+	volume_header h;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1;
+	uint64_t grid_bricks = 0, file_bricks = 0;
+	if (ok)
+	{
+		grid_bricks = ((uint64_t(h.nx) + volume_grid::brick - 1) / volume_grid::brick) *
+					  ((uint64_t(h.ny) + volume_grid::brick - 1) / volume_grid::brick) *
+					  ((uint64_t(h.nz) + volume_grid::brick - 1) / volume_grid::brick);
+		long header_end = ftell(f);
+		if (fseek(f, 0, SEEK_END) == 0)
+			file_bricks = uint64_t(ftell(f) - header_end) / record_bytes;
+		ok = fseek(f, header_end, SEEK_SET) == 0;
+	}
+	if (!ok || memcmp(h.magic, "RVOL", 4) != 0 || h.version != 1)
+		error = "not a volume file";
+	else if (h.brick != volume_grid::brick || h.nx == 0 || h.ny == 0 || h.nz == 0)
+		error = "unsupported brick size or empty grid";
+	else if (h.nx > uint32_t(INT32_MAX) || h.ny > uint32_t(INT32_MAX) || h.nz > uint32_t(INT32_MAX) ||
+			 grid_bricks > uint64_t(INT32_MAX))
+		error = "grid too large";
+	else if (h.brick_count > grid_bricks)
+		error = "more bricks than the grid has";
+	else if (h.brick_count > file_bricks)
+		error = "truncated";
+	else
+	{
+		g.resize(aabb(vec3(h.min[0], h.min[1], h.min[2]), vec3(h.max[0], h.max[1], h.max[2])), h.nx, h.ny, h.nz);
+		g.brick_data.resize(size_t(h.brick_count) * voxels);
+		for (uint32_t n = 0; n < h.brick_count && error.empty(); n++)
+		{
+			uint32_t c[3];
+			if (fread(c, sizeof(c), 1, f) != 1 || fread(&g.brick_data[n * voxels], sizeof(float), voxels, f) != voxels)
+				error = "truncated";
+			else if (c[0] >= uint32_t(g.bx) || c[1] >= uint32_t(g.by) || c[2] >= uint32_t(g.bz))
+				error = "brick out of range";
+			else
+			{
+				int32_t &slot = g.brick_index[(size_t(c[2]) * g.by + c[1]) * g.bx + c[0]];
+				if (slot >= 0)
+					error = "duplicate brick";
+				else
+					slot = int32_t(n);
+			}
+		}
+		if (error.empty())
+			g.build_majorants();
+	}
+	fclose(f);
+	return error.empty();
+}
+
+//以volume_grid为密度场（乘以density_scale）的参与介质，外形就是网格的包围盒。
+//与constant_medium的非均匀密度相同，用delta tracking采样碰撞、ratio tracking求透过率，
+//区别是上界不是全局的：光线用DDA穿过majorant格子，每格的试探碰撞按该格的majorant取。
+//指数分布无记忆，所以走出一格时丢掉剩下的自由程、在下一格从边界重新采样仍然是无偏的
+class grid_medium : public medium
+{
+public:
+	grid_medium(const volume_grid *g, real density_scale, texture *a)
+		: grid(g), density_scale(density_scale), phase_function(new isotropic(a))
+	{
+		cell = grid->voxel_size * real(volume_grid::brick);//最后一块可能只有一部分在网格内
+	}
+
+	virtual bool hit(const ray &r, real t_min, real t_max, hit_record &rec) const
+	{
+		real t = 0;
+		if (!track(r, t_min, t_max, [&](real s, real m) {
+			t = s;
+			return sample_1d() * m < grid->density(r.point_at_parameter(s));
+		}))
+			return false;
+		rec.t = t;
+		rec.p = r.point_at_parameter(t);
+		rec.normal = vec3(1, 0, 0);
+		rec.u = rec.v = 0;
+		rec.mat_ptr = phase_function;
+		rec.mat_id = mat_id;
+		rec.prim = this;
+		return true;
+	}
+
+	virtual bool bounding_box(float t0, float t1, aabb &box) const
+	{
+		box = grid->box;
+		return true;
+	}
+
+	virtual bool hit_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const
+	{ return box_interval(r, t_min, t_max, t_enter, t_exit); }
+
+	virtual void bind_materials(material_binder &binder)
+	{ mat_id = binder.bind(phase_function); }
+
+	virtual real transmittance(const ray &r, real t_min, real t_max) const
+	{
+		real tr = 1;
+		track(r, t_min, t_max, [&](real s, real m) {
+			tr *= 1 - grid->density(r.point_at_parameter(s)) / m;
+			return false;
+		});
+		return tr;
+	}
+
+private:
+	bool box_interval(const ray &r, real t_min, real t_max, real &t_enter, real &t_exit) const
+	{
+		real t0 = t_min, t1 = t_max;
+		for (int a = 0; a < 3; a++)
+		{
+			real inv = 1 / r.direction()[a];
+			real near = (grid->box.min()[a] - r.origin()[a]) * inv;
+			real far = (grid->box.max()[a] - r.origin()[a]) * inv;
+			if (inv < 0)
+				std::swap(near, far);
+			t0 = ffmax(near, t0);
+			t1 = ffmin(far, t1);
+		}
+		t_enter = t0;
+		t_exit = t1;
+		return t0 < t1;
+	}
+
+	//沿光线在网格内的区间做DDA，对每个试探碰撞调用collide(t, m)，m是该格未乘density_scale的majorant，
+	//所以collide直接拿grid->density与m比较；collide返回true时停止并返回true
+	template<typename F>
+	bool track(const ray &r, real t_min, real t_max, F collide) const
+	{
+		real t0, t1;
+		if (!box_interval(r, t_min, t_max, t0, t1))
+			return false;
+		real ray_length = r.direction().length();
+		int n[3] = {grid->bx, grid->by, grid->bz};
+		int c[3], step[3];
+		real t_next[3], t_delta[3];
+		vec3 p = r.point_at_parameter(t0) - grid->box.min();
+		for (int a = 0; a < 3; a++)
+		{
+			c[a] = std::min(std::max(int(floor(p[a] / cell[a])), 0), n[a] - 1);
+			real d = r.direction()[a];
+			if (d > 0)
+			{
+				step[a] = 1;
+				t_delta[a] = cell[a] / d;
+				t_next[a] = t0 + ((c[a] + 1) * cell[a] - p[a]) / d;
+			}
+			else if (d < 0)
+			{
+				step[a] = -1;
+				t_delta[a] = -cell[a] / d;
+				t_next[a] = t0 + (c[a] * cell[a] - p[a]) / d;
+			}
+			else
+			{
+				step[a] = 0;
+				t_delta[a] = FLT_MAX;
+				t_next[a] = FLT_MAX;
+			}
+		}
+		real t = t0;
+		for (;;)
+		{
+			int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+			real cell_exit = std::min(t_next[axis], t1);
+			real m = grid->majorant[(size_t(c[2]) * grid->by + c[1]) * grid->bx + c[0]];
+			if (m > 0)
+			{
+				real sigma = density_scale * m;
+				for (;;)
+				{
+					t += sample_free_flight(sigma) / ray_length;
+					if (t >= cell_exit)
+						break;
+					if (collide(t, m))
+						return true;
+				}
+			}
+			if (t_next[axis] >= t1)
+				return false;
+			t = t_next[axis];
+			c[axis] += step[axis];
+			if (c[axis] < 0 || c[axis] >= n[axis])
+				return false;
+			t_next[axis] += t_delta[axis];
+		}
+	}
+
+	const volume_grid *grid;
+	real density_scale;
+	material *phase_function;
+	int mat_id = -1;
+	vec3 cell;//majorant格子（一个块）在世界空间中的大小
+};
+
+#endif //RAYTRACE_VOLUME_GRID_H
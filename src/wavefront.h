@@ -0,0 +1,354 @@
+#ifndef RAYTRACE_WAVEFRONT_H
+#define RAYTRACE_WAVEFRONT_H
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include "camera.h"
+#include "material_table.h"
+#include "perf_counter.h"
+
+//一批路径的状态，按分量分开存放（SoA）
+struct path_queue
+{
+	std::vector<real> ox, oy, oz;//光线原点
+	std::vector<real> dx, dy, dz;//光线方向
+	std::vector<float> time;
+	std::vector<float> tr, tg, tb;//路径到目前为止的衰减（throughput）
+	std::vector<int> pixel;//路径所属的像素
+	std::vector<int> depth;
+
+	int size() const { return int(pixel.size()); }
+
+	void clear()
+	{
+		ox.clear(); oy.clear(); oz.clear();
+		dx.clear(); dy.clear(); dz.clear();
+		time.clear();
+		tr.clear(); tg.clear(); tb.clear();
+		pixel.clear();
+		depth.clear();
+	}
+
+	void reserve(int n)
+	{
+		ox.reserve(n); oy.reserve(n); oz.reserve(n);
+		dx.reserve(n); dy.reserve(n); dz.reserve(n);
+		time.reserve(n);
+		tr.reserve(n); tg.reserve(n); tb.reserve(n);
+		pixel.reserve(n);
+		depth.reserve(n);
+	}
+
+	//把other中第i条路径追加到队尾
+	void push(const path_queue &other, int i)
+	{
+		ox.push_back(other.ox[i]); oy.push_back(other.oy[i]); oz.push_back(other.oz[i]);
+		dx.push_back(other.dx[i]); dy.push_back(other.dy[i]); dz.push_back(other.dz[i]);
+		time.push_back(other.time[i]);
+		tr.push_back(other.tr[i]); tg.push_back(other.tg[i]); tb.push_back(other.tb[i]);
+		pixel.push_back(other.pixel[i]);
+		depth.push_back(other.depth[i]);
+	}
+
+	void push(const ray &r, const vec3 &throughput, int pix, int d)
+	{
+		ox.push_back(r.origin().x()); oy.push_back(r.origin().y()); oz.push_back(r.origin().z());
+		dx.push_back(r.direction().x()); dy.push_back(r.direction().y()); dz.push_back(r.direction().z());
+		time.push_back(r.time());
+		tr.push_back(throughput.r()); tg.push_back(throughput.g()); tb.push_back(throughput.b());
+		pixel.push_back(pix);
+		depth.push_back(d);
+	}
+
+	ray get_ray(int i) const
+	{ return ray(vec3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]), time[i]); }
+
+	vec3 throughput(int i) const
+	{ return vec3(tr[i], tg[i], tb[i]); }
+};
+
+//wavefront积分器：不再对每个样本做递归，而是把一大批路径按阶段处理
+//（生成相机光线 -> 求交 -> 按材质排序 -> 各材质分别着色 -> 压缩掉结束的路径），
+//同一阶段的代码连续处理整批路径，指令缓存更友好。结果与color()的递归在统计意义上一致
+class wavefront_integrator
+{
+public:
+	wavefront_integrator(hitable *w, const material_table &t, int batch = 1 << 16) : world(w), table(t), batch_size(batch)
+	{}
+
+	//渲染nx*ny*ns个样本，framebuffer的行序与render()一致
+	void render(camera &cam, int nx, int ny, int ns, std::vector<vec3> &framebuffer);
+
+	int max_depth = 50;
+	//对二次弹射光线按(方向卦限, 原点Morton码)排序后再求交，让相邻光线访问相近的bvh节点
+	bool sort_rays = false;
+
+	//最近一次render()的统计
+	long long rays_traced = 0;
+	double intersect_seconds = 0;
+	long long intersect_cache_misses = 0;
+
+private:
+	void generate(camera &cam, int nx, int ny, int ns, long begin, long end);
+	void intersect();
+	void sort_by_material();
+	void shade_miss(int begin, int end);
+	void shade_lambertian(int begin, int end);
+	void shade_metal(int begin, int end);
+	void shade_dielectric(int begin, int end);
+	void shade_emissive(int begin, int end);
+	void shade_other(int begin, int end);
+	void compact();
+	void sort_secondary_rays();
+
+	//着色阶段按材质分桶，miss单独一桶
+	enum bucket { MISS, LAMBERTIAN, METAL, DIELECTRIC, EMISSIVE, OTHER, BUCKETS };
+
+	hitable *world;
+	const material_table &table;
+	int batch_size;
+
+	path_queue paths;//当前活着的路径
+	path_queue next;//着色后继续弹射的路径，压缩后与paths交换
+	std::vector<hit_record> hits;
+	std::vector<int> bucket_of;
+	std::vector<int> order;//按材质排序后的路径下标
+	int bucket_start[BUCKETS + 1];
+	std::vector<vec3> accum;//每个像素的辐射度累加
+	aabb bounds;//场景包围盒，用来量化光线原点
+	std::vector<std::pair<uint64_t, int>> keys;
+	cache_miss_counter misses;
+};
+
+//把10位整数的每一位之间插入两个0
+inline uint32_t expand_bits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+//单元[0,1]^3内点的30位Morton码
+inline uint32_t morton3(float x, float y, float z)
+{
+	x = ffmin(ffmax(x * 1024.0f, 0.0f), 1023.0f);
+	y = ffmin(ffmax(y * 1024.0f, 0.0f), 1023.0f);
+	z = ffmin(ffmax(z * 1024.0f, 0.0f), 1023.0f);
+	return (expand_bits(uint32_t(x)) << 2) | (expand_bits(uint32_t(y)) << 1) | expand_bits(uint32_t(z));
+}
+
+void wavefront_integrator::render(camera &cam, int nx, int ny, int ns, std::vector<vec3> &framebuffer)
+{
+	accum.assign(nx * ny, vec3(0, 0, 0));
+	rays_traced = 0;
+	intersect_seconds = 0;
+	intersect_cache_misses = 0;
+	if (!world->bounding_box(0, 1, bounds))
+		sort_rays = false;
+	paths.reserve(batch_size);
+	next.reserve(batch_size);
+	long total = long(nx) * ny * ns;
+	for (long begin = 0; begin < total; begin += batch_size)
+	{
+		long end = begin + batch_size < total ? begin + batch_size : total;
+		generate(cam, nx, ny, ns, begin, end);
+		while (paths.size() > 0)
+		{
+			intersect();
+			sort_by_material();
+			next.clear();
+			shade_miss(bucket_start[MISS], bucket_start[MISS + 1]);
+			shade_lambertian(bucket_start[LAMBERTIAN], bucket_start[LAMBERTIAN + 1]);
+			shade_metal(bucket_start[METAL], bucket_start[METAL + 1]);
+			shade_dielectric(bucket_start[DIELECTRIC], bucket_start[DIELECTRIC + 1]);
+			shade_emissive(bucket_start[EMISSIVE], bucket_start[EMISSIVE + 1]);
+			shade_other(bucket_start[OTHER], bucket_start[OTHER + 1]);
+			compact();
+			if (sort_rays)
+				sort_secondary_rays();
+		}
+	}
+
+	framebuffer.resize(nx * ny);
+	for (int i = 0; i < nx * ny; i++)
+	{
+		vec3 col = accum[i] / float(ns);
+		framebuffer[i] = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
+	}
+}
+
+//样本编号sample = 像素下标 * ns + 第几次采样
+void wavefront_integrator::generate(camera &cam, int nx, int ny, int ns, long begin, long end)
+{
+	paths.clear();
+	for (long sample = begin; sample < end; sample++)
+	{
+		int pix = int(sample / ns);
+		int i = pix % nx;
+		int j = ny - 1 - pix / nx;
+		float u = float(i + drand48()) / float(nx);
+		float v = float(j + drand48()) / float(ny);
+		paths.push(cam.get_ray(u, v), vec3(1, 1, 1), pix, 0);
+	}
+}
+
+void wavefront_integrator::intersect()
+{
+	int n = paths.size();
+	rays_traced += n;
+	auto start = std::chrono::steady_clock::now();
+	misses.start();
+	hits.resize(n);
+	bucket_of.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		if (!world->hit(paths.get_ray(i), ray_epsilon, FLT_MAX, hits[i]))
+		{
+			bucket_of[i] = MISS;
+			continue;
+		}
+		switch (hits[i].mat_id < 0 ? material_type::other : table.materials[hits[i].mat_id].type)
+		{
+			case material_type::lambertian: bucket_of[i] = LAMBERTIAN; break;
+			case material_type::metal: bucket_of[i] = METAL; break;
+			case material_type::dielectric: bucket_of[i] = DIELECTRIC; break;
+			case material_type::diffuse_light: bucket_of[i] = EMISSIVE; break;
+			default: bucket_of[i] = OTHER; break;
+		}
+	}
+	intersect_cache_misses += misses.stop();
+	intersect_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//计数排序，得到每个材质桶在order中的区间
+void wavefront_integrator::sort_by_material()
+{
+	int count[BUCKETS] = {0};
+	for (int b : bucket_of)
+		count[b]++;
+	bucket_start[0] = 0;
+	for (int b = 0; b < BUCKETS; b++)
+		bucket_start[b + 1] = bucket_start[b] + count[b];
+	int fill[BUCKETS];
+	for (int b = 0; b < BUCKETS; b++)
+		fill[b] = bucket_start[b];
+	order.resize(bucket_of.size());
+	for (int i = 0; i < int(bucket_of.size()); i++)
+		order[fill[bucket_of[i]]++] = i;
+}
+
+//没有击中任何物体，计入背景（与color()相同的background()），路径结束
+void wavefront_integrator::shade_miss(int begin, int end)
+{
+	for (int k = begin; k < end; k++)
+	{
+		int i = order[k];
+		accum[paths.pixel[i]] += paths.throughput(i) * background(paths.get_ray(i));
+	}
+}
+
+void wavefront_integrator::shade_lambertian(int begin, int end)
+{
+	for (int k = begin; k < end; k++)
+	{
+		int i = order[k];
+		if (paths.depth[i] >= max_depth)
+			continue;
+		const hit_record &rec = hits[i];
+		ray r_in = paths.get_ray(i);
+		const material_record &m = table.materials[rec.mat_id];
+		vec3 attenuation = table.texture_value(m.tex, rec.u, rec.v, rec.p);
+		next.push(lambertian_scatter(r_in, rec), paths.throughput(i) * attenuation, paths.pixel[i], paths.depth[i] + 1);
+	}
+}
+
+void wavefront_integrator::shade_metal(int begin, int end)
+{
+	for (int k = begin; k < end; k++)
+	{
+		int i = order[k];
+		if (paths.depth[i] >= max_depth)
+			continue;
+		const hit_record &rec = hits[i];
+		const material_record &m = table.materials[rec.mat_id];
+		ray scattered;
+		if (metal_scatter(m.param, paths.get_ray(i), rec, scattered))
+			next.push(scattered, paths.throughput(i) * m.albedo, paths.pixel[i], paths.depth[i] + 1);
+	}
+}
+
+void wavefront_integrator::shade_dielectric(int begin, int end)
+{
+	for (int k = begin; k < end; k++)
+	{
+		int i = order[k];
+		if (paths.depth[i] >= max_depth)
+			continue;
+		const hit_record &rec = hits[i];
+		const material_record &m = table.materials[rec.mat_id];
+		next.push(dielectric_scatter(m.param, paths.get_ray(i), rec), paths.throughput(i), paths.pixel[i],
+				  paths.depth[i] + 1);
+	}
+}
+
+//diffuse_light只发光不散射，路径在这里结束
+void wavefront_integrator::shade_emissive(int begin, int end)
+{
+	for (int k = begin; k < end; k++)
+	{
+		int i = order[k];
+		accum[paths.pixel[i]] += paths.throughput(i) * table.emitted(hits[i]);
+	}
+}
+
+//表中没有对应记录的材质，走虚函数接口
+void wavefront_integrator::shade_other(int begin, int end)
+{
+	for (int k = begin; k < end; k++)
+	{
+		int i = order[k];
+		const hit_record &rec = hits[i];
+		accum[paths.pixel[i]] += paths.throughput(i) * rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+		vec3 attenuation;
+		ray scattered;
+		if (paths.depth[i] < max_depth && rec.mat_ptr->scatter(paths.get_ray(i), rec, attenuation, scattered))
+			next.push(scattered, paths.throughput(i) * attenuation, paths.pixel[i], paths.depth[i] + 1);
+	}
+}
+
+//着色阶段只把还要继续弹射的路径写进next，结束的路径自然被丢弃，交换后就是压缩过的队列
+void wavefront_integrator::compact()
+{
+	std::swap(paths, next);
+}
+
+//排序键：第30到32位是方向所在卦限，低30位是原点在场景包围盒中的Morton码，
+//键相同的光线构成一个bin，排序后同一个bin的光线连续求交
+void wavefront_integrator::sort_secondary_rays()
+{
+	int n = paths.size();
+	vec3 lo = bounds.min();
+	vec3 extent = bounds.max() - bounds.min();
+	//包围盒在某个轴上是扁的（例如只有一个平面）时这个轴不参与量化，避免除以0
+	real sx = extent.x() > 0 ? 1 / extent.x() : 0;
+	real sy = extent.y() > 0 ? 1 / extent.y() : 0;
+	real sz = extent.z() > 0 ? 1 / extent.z() : 0;
+	keys.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		uint32_t octant = (paths.dx[i] < 0 ? 4u : 0u) | (paths.dy[i] < 0 ? 2u : 0u) | (paths.dz[i] < 0 ? 1u : 0u);
+		uint32_t cell = morton3((paths.ox[i] - lo.x()) * sx, (paths.oy[i] - lo.y()) * sy, (paths.oz[i] - lo.z()) * sz);
+		keys[i] = std::make_pair((uint64_t(octant) << 30) | cell, i);
+	}
+	std::sort(keys.begin(), keys.end());
+	next.clear();
+	for (const auto &key : keys)
+		next.push(paths, key.second);
+	std::swap(paths, next);
+}
+
+#endif //RAYTRACE_WAVEFRONT_H